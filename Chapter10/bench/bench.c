@@ -0,0 +1,331 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include "bench.h"
+
+#ifndef BENCH_NAME
+#define BENCH_NAME "kernel"
+#endif
+
+extern volatile uint32_t cpu_freq;
+
+/*** DWT ***/
+#define DEMCR       (*(volatile uint32_t *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile uint32_t *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile uint32_t *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+#define DWT_CTRL_NOCYCCNT   (1 << 25)
+
+/*** SYSTICK ***/
+#define SYSTICK_RVR (*(volatile uint32_t *)(0xE000E014))
+#define SYSTICK_CVR (*(volatile uint32_t *)(0xE000E018))
+#define SYSTICK_MAX_RELOAD (0x00FFFFFF)
+
+/*** USART2, TX only on PD5 (AF7) ***/
+#define USART2 (0x40004400)
+#define USART2_CR1      (*(volatile uint32_t *)(USART2))
+#define USART2_BRR      (*(volatile uint32_t *)(USART2 + 0x0C))
+#define USART2_SR       (*(volatile uint32_t *)(USART2 + 0x1C))
+#define USART2_DR       (*(volatile uint32_t *)(USART2 + 0x28))
+#define USART2_CR1_USART_ENABLE (1 << 0)
+#define USART2_CR1_TX_ENABLE    (1 << 3)
+#define USART2_SR_TX_EMPTY      (1 << 7)
+
+#define APB1_CLOCK_ER   (*(volatile uint32_t *)(0x40021058))
+#define USART2_APB1_CLOCK_ER_VAL (1 << 17)
+#define AHB2_CLOCK_ER   (*(volatile uint32_t *)(0x4002104C))
+#define GPIOD_AHB2_CLOCK_ER (1 << 3)
+#define GPIOD_BASE 0x48000c00
+#define GPIOD_MODE  (*(volatile uint32_t *)(GPIOD_BASE + 0x00))
+#define GPIOD_AFL   (*(volatile uint32_t *)(GPIOD_BASE + 0x20))
+#define USART2_PIN_AF 7
+#define USART2_TX_PIN 5
+
+#define BENCH_BITRATE  (115200)
+#define BENCH_APB1_DIV (4)          /* PPRE1 in clock_pll_on() */
+
+/* Scenarios give up after this many attempts per sample, e.g. when the
+ * interrupt never fires on an emulator.
+ */
+#define BENCH_MAX_TRIES (16)
+
+volatile uint32_t *bench_clock_reg = &DWT_CYCCNT;
+volatile uint32_t bench_t0 BENCH_SHARED;
+volatile uint32_t bench_pendsv_in BENCH_SHARED, bench_pendsv_out BENCH_SHARED;
+
+static int clock_is_systick BENCH_SHARED;
+static uint32_t systick_reload BENCH_SHARED;
+static volatile int bench_mode BENCH_SHARED;
+static volatile int bench_armed BENCH_SHARED;
+static int reported = 0;
+
+/* Indexed by scenario */
+static const char *const bench_names[BENCH_DONE] = {
+    "pendsv", "pingpong", "svc", "mutex", "irq"
+};
+static struct bench_stat stats[BENCH_DONE] BENCH_SHARED;
+
+static void bench_uart_setup(void)
+{
+    uint32_t reg;
+    AHB2_CLOCK_ER |= GPIOD_AHB2_CLOCK_ER;
+    reg = GPIOD_MODE & ~(0x03 << (USART2_TX_PIN * 2));
+    GPIOD_MODE = reg | (2 << (USART2_TX_PIN * 2));
+    reg = GPIOD_AFL & ~(0xf << (USART2_TX_PIN * 4));
+    GPIOD_AFL = reg | (USART2_PIN_AF << (USART2_TX_PIN * 4));
+    APB1_CLOCK_ER |= USART2_APB1_CLOCK_ER_VAL;
+    USART2_CR1 &= ~USART2_CR1_USART_ENABLE;
+    USART2_BRR = (cpu_freq / BENCH_APB1_DIV) / BENCH_BITRATE;
+    USART2_CR1 |= USART2_CR1_TX_ENABLE | USART2_CR1_USART_ENABLE;
+}
+
+static void bench_puts(const char *s)
+{
+    while (*s) {
+        while ((USART2_SR & USART2_SR_TX_EMPTY) == 0)
+            ;
+        USART2_DR = *s++;
+    }
+}
+
+static void bench_put_u32(uint32_t val)
+{
+    char buf[11];
+    int i = 10;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    bench_puts(buf + i);
+}
+
+/* Called once from main(), after systick_enable() */
+void bench_init(void)
+{
+    volatile int i;
+    uint32_t t;
+
+    bench_uart_setup();
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    t = DWT_CYCCNT;
+    for (i = 0; i < 16; i++)
+        ;
+    if (((DWT_CTRL & DWT_CTRL_NOCYCCNT) == 0) && (DWT_CYCCNT != t))
+        return;
+    /* No cycle counter: fall back to the SysTick current value */
+    clock_is_systick = 1;
+    systick_reload = (SYSTICK_RVR & SYSTICK_MAX_RELOAD) + 1;
+    bench_clock_reg = &SYSTICK_CVR;
+}
+
+uint32_t bench_clock(void)
+{
+    return *bench_clock_reg;
+}
+
+uint32_t bench_elapsed(uint32_t t0, uint32_t t1)
+{
+    if (!clock_is_systick)
+        return t1 - t0;
+    /* SysTick counts down, and wraps to the reload value */
+    if (t1 <= t0)
+        return t0 - t1;
+    return t0 + systick_reload - t1;
+}
+
+static void bench_sample(int scenario, uint32_t cycles)
+{
+    struct bench_stat *st = &stats[scenario];
+    if (st->n < BENCH_SAMPLES)
+        st->samples[st->n++] = cycles;
+}
+
+static int bench_full(int scenario)
+{
+    return stats[scenario].n >= BENCH_SAMPLES;
+}
+
+/* Driver task: runs the scenarios in sequence */
+void bench_driver(void *arg)
+{
+    uint32_t t0, t1;
+    int tries;
+
+    bench_mode = BENCH_PINGPONG;
+    while (!bench_full(BENCH_PINGPONG)) {
+        t0 = bench_now();
+        bench_yield();
+        t1 = bench_now();
+        bench_sample(BENCH_PINGPONG, bench_elapsed(t0, t1));
+        /* The switch that brought us back */
+        bench_sample(BENCH_PENDSV, bench_elapsed(bench_pendsv_in, bench_pendsv_out));
+    }
+
+#ifdef BENCH_HAVE_SVC
+    /* bench_now() is a system call: two in a row are one round trip,
+     * from the clock read in the first handler to the one in the next.
+     */
+    bench_mode = BENCH_SVC;
+    while (!bench_full(BENCH_SVC)) {
+        t0 = bench_now();
+        t1 = bench_now();
+        bench_sample(BENCH_SVC, bench_elapsed(t0, t1));
+    }
+#endif
+
+#ifdef BENCH_HAVE_MUTEX
+    bench_mode = BENCH_MUTEX;
+    while (!bench_full(BENCH_MUTEX)) {
+        bench_lock();
+        /* Let the partner block on the lock */
+        bench_yield();
+        bench_armed = 1;
+        bench_t0 = bench_now();
+        bench_unlock();
+        bench_yield();
+    }
+#endif
+
+#ifdef BENCH_HAVE_IRQ
+    bench_mode = BENCH_IRQ;
+    for (tries = 0; !bench_full(BENCH_IRQ) &&
+            (tries < BENCH_MAX_TRIES * BENCH_SAMPLES); tries++) {
+        if (bench_irq_armed())
+            bench_irq_trigger();
+        bench_yield();
+    }
+#endif
+
+    bench_mode = BENCH_DONE;
+#ifdef BENCH_HAVE_IRQ
+    /* Release the partner if it is still waiting */
+    if (bench_irq_armed())
+        bench_irq_trigger();
+#endif
+    while(1)
+        bench_idle();
+}
+
+/* Partner task: the other side of each scenario */
+void bench_partner(void *arg)
+{
+    int mode;
+    while ((mode = bench_mode) != BENCH_DONE) {
+        switch (mode) {
+#ifdef BENCH_HAVE_MUTEX
+        case BENCH_MUTEX:
+            bench_lock();
+            if (bench_armed) {
+                bench_sample(BENCH_MUTEX, bench_elapsed(bench_t0, bench_now()));
+                bench_armed = 0;
+            }
+            bench_unlock();
+            bench_yield();
+            break;
+#endif
+#ifdef BENCH_HAVE_IRQ
+        case BENCH_IRQ:
+            if (bench_irq_wait() && (bench_mode == BENCH_IRQ))
+                bench_sample(BENCH_IRQ, bench_elapsed(bench_t0, bench_now()));
+            break;
+#endif
+        default:
+            bench_yield();
+        }
+    }
+    while(1)
+        bench_idle();
+}
+
+/* Sorts the samples in place */
+static void bench_report(const char *name, struct bench_stat *st)
+{
+    static const uint8_t pct[3] = { 50, 90, 99 };
+    static const char *pct_name[3] = { " p50=", " p90=", " p99=" };
+    uint32_t i, j, v, total = 0;
+    uint32_t n = st->n;
+    const char *c;
+
+    bench_puts(name);
+    for (c = name; *c; c++)
+        ;
+    for (; c < name + 10; c++)
+        bench_puts(" ");
+    if (n == 0) {
+        bench_puts("n/a\r\n");
+        return;
+    }
+    for (i = 1; i < n; i++) {
+        v = st->samples[i];
+        for (j = i; (j > 0) && (st->samples[j - 1] > v); j--)
+            st->samples[j] = st->samples[j - 1];
+        st->samples[j] = v;
+    }
+    for (i = 0; i < n; i++)
+        total += st->samples[i];
+    bench_puts("n=");
+    bench_put_u32(n);
+    bench_puts(" min=");
+    bench_put_u32(st->samples[0]);
+    bench_puts(" avg=");
+    bench_put_u32(total / n);
+    for (i = 0; i < 3; i++) {
+        /* Nearest rank */
+        j = (n * pct[i] + 99) / 100;
+        bench_puts(pct_name[i]);
+        bench_put_u32(st->samples[j - 1]);
+    }
+    bench_puts(" max=");
+    bench_put_u32(st->samples[n - 1]);
+    bench_puts("\r\n");
+}
+
+/* Called from the kernel idle loop: prints the results once the
+ * driver is done.
+ */
+void bench_report_poll(void)
+{
+    int i;
+    if ((bench_mode != BENCH_DONE) || reported)
+        return;
+    reported = 1;
+    bench_puts("bench: " BENCH_NAME ", ");
+    bench_puts(clock_is_systick ? "SysTick" : "DWT");
+    bench_puts(" clock, ");
+    bench_put_u32(cpu_freq);
+    bench_puts(" Hz, cycles\r\n");
+    for (i = 0; i < BENCH_DONE; i++)
+        bench_report(bench_names[i], &stats[i]);
+}
@@ -0,0 +1,116 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+#include <stdint.h>
+
+/* Context switch and interrupt latency benchmark (make bench).
+ *
+ * Two tasks, the driver and its partner, run the same scenarios on
+ * every Chapter10 kernel:
+ *
+ *   pendsv    PendSV handler, from entry to exception return
+ *   pingpong  yield round trip, driver -> partner -> driver
+ *   svc       back-to-back system calls (BENCH_HAVE_SVC)
+ *   mutex     unlock to the waiter running as the owner (BENCH_HAVE_MUTEX)
+ *   irq       EXTI line 13 software trigger to the woken task (BENCH_HAVE_IRQ)
+ *
+ * Times are taken with the DWT cycle counter. Where it does not count
+ * (QEMU), SysTick is used instead: the intervals measured are shorter
+ * than one tick, and are still expressed in CPU clock cycles.
+ * The kernel prints the results on USART2 from its idle loop.
+ */
+
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES (256)
+#endif
+
+#define BENCH_PENDSV   0
+#define BENCH_PINGPONG 1
+#define BENCH_SVC      2
+#define BENCH_MUTEX    3
+#define BENCH_IRQ      4
+#define BENCH_DONE     5
+
+struct bench_stat {
+    uint32_t n;
+    uint32_t samples[BENCH_SAMPLES];
+};
+
+/* Variables used by the benchmark tasks. Kernels with memory
+ * protection open this section to all the tasks, the others link it
+ * with .bss: the variables must be zero at startup.
+ */
+#define BENCH_SHARED __attribute__((section(".bss.task_shared")))
+
+/* Kernel side, privileged */
+void bench_init(void);
+uint32_t bench_clock(void);
+void bench_report_poll(void);
+
+/* Tasks */
+void bench_driver(void *arg);
+void bench_partner(void *arg);
+uint32_t bench_elapsed(uint32_t t0, uint32_t t1);
+
+/* Provided by each kernel */
+uint32_t bench_now(void);
+void bench_yield(void);
+void bench_idle(void);
+#ifdef BENCH_HAVE_MUTEX
+void bench_lock(void);
+void bench_unlock(void);
+#endif
+#ifdef BENCH_HAVE_IRQ
+void bench_irq_trigger(void);   /* Sets bench_t0, then fires EXTI13 */
+int bench_irq_wait(void);
+int bench_irq_armed(void);      /* A task is blocked in bench_irq_wait() */
+#endif
+
+extern volatile uint32_t bench_t0;
+extern volatile uint32_t *bench_clock_reg;
+extern volatile uint32_t bench_pendsv_in, bench_pendsv_out;
+
+/* Time stamps at the boundaries of isr_pendsv. Only r2 and r3 are
+ * used: r0 and r1 belong to the context save/restore helpers.
+ */
+#define BENCH_PENDSV_STAMP(var)                         \
+    asm volatile("movw r2, #:lower16:bench_clock_reg\n" \
+                 "movt r2, #:upper16:bench_clock_reg\n" \
+                 "ldr r2, [r2]\n"                       \
+                 "ldr r3, [r2]\n"                       \
+                 "movw r2, #:lower16:" #var "\n"        \
+                 "movt r2, #:upper16:" #var "\n"        \
+                 "str r3, [r2]"                         \
+                 ::: "r2", "r3", "memory")
+#define BENCH_PENDSV_ENTER() BENCH_PENDSV_STAMP(bench_pendsv_in)
+#define BENCH_PENDSV_EXIT()  BENCH_PENDSV_STAMP(bench_pendsv_out)
+
+#endif
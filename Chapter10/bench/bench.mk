@@ -0,0 +1,39 @@
+# Benchmark build: the kernel runs the scenarios in ../bench instead of
+# the demo tasks, and prints min/avg/percentiles/max cycles on USART2
+# (115200 8N1). The initial stack is moved to the end of the first
+# 96K of SRAM, so the same image runs on QEMU's STM32L475 board model.
+#
+#   make bench            builds image-bench.elf
+#   make qemu             runs it in qemu-system-arm, USART2 on stdio
+#
+# Set BENCH_CFLAGS in the kernel Makefile, before including this file,
+# to enable the scenarios the kernel supports (BENCH_HAVE_*).
+#
+BENCH_DIR:=$(dir $(lastword $(MAKEFILE_LIST)))
+BENCH_OBJS:=$(OBJS:.o=.bench.o) bench.bench.o
+BENCH_CFLAGS+=-DBENCH -DBENCH_NAME=\"$(notdir $(CURDIR))\" -I. -I$(BENCH_DIR)
+BENCH_LDFLAGS:=$(subst image.map,image-bench.map,$(LDFLAGS)) \
+	-Wl,--defsym=_end_stack=0x20018000
+
+QEMU:=qemu-system-arm
+QEMU_FLAGS:=-M b-l475e-iot01a -display none -serial null -serial stdio \
+	-icount shift=0
+
+bench: image-bench.elf
+
+%.bench.o: %.c
+	$(CC) $(CFLAGS) $(BENCH_CFLAGS) -c $< -o $@
+
+%.bench.o: %.S
+	$(CC) $(ASFLAGS) $(BENCH_CFLAGS) -c $< -o $@
+
+bench.bench.o: $(BENCH_DIR)bench.c $(BENCH_DIR)bench.h
+	$(CC) $(CFLAGS) $(BENCH_CFLAGS) -c $< -o $@
+
+image-bench.elf: $(BENCH_OBJS) $(LSCRIPT)
+	$(LD) $(BENCH_LDFLAGS) $(BENCH_OBJS) -o $@
+
+qemu: image-bench.elf
+	$(QEMU) $(QEMU_FLAGS) -kernel $<
+
+.PHONY: bench qemu
@@ -33,6 +33,9 @@
 #include "timer.h"
 #include "led.h"
 #include "button.h"
+#ifdef BENCH
+#include "bench.h"
+#endif
 
 volatile int timer_elapsed = 0;
 volatile uint32_t tim2_ticks = 0;
@@ -57,8 +60,19 @@ static struct task_block TASKS[MAX_TASKS];
 static int n_tasks = 1;
 static int running_task_id = 0;
 
-extern uint32_t stack_space;
-#define STACK_SIZE (256)
+/* Task stacks are carved from the .task_stacks area (target.ld) */
+extern uint8_t _start_task_stacks, _end_task_stacks;
+static uint8_t *stack_brk = &_start_task_stacks;
+#define STACK_MIN (256)
+
+static uint32_t *stack_alloc(uint32_t size)
+{
+    uint8_t *stack = stack_brk;
+    if (size > (uint32_t)(&_end_task_stacks - stack_brk))
+        return NULL;
+    stack_brk += size;
+    return (uint32_t *)stack;
+}
 
 
 
@@ -117,12 +131,18 @@ static void task_stack_init(struct task_block *t)
 }
 
 
-struct task_block *task_create(char *name, void (*start)(void *arg), void *arg)
+struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
+        uint32_t stack_size)
 {
     struct task_block *t;
     int i;
+    uint32_t *stack;
 
-    if (n_tasks >= MAX_TASKS)
+    if ((n_tasks >= MAX_TASKS) || (stack_size < STACK_MIN))
+        return NULL;
+    stack_size = (stack_size + 7) & ~7;
+    stack = stack_alloc(stack_size);
+    if (stack == NULL)
         return NULL;
     t = &TASKS[n_tasks];
     t->id = n_tasks++;
@@ -134,7 +154,7 @@ struct task_block *task_create(char *name, void (*start)(void *arg), void *arg)
     t->state = TASK_WAITING;
     t->start = start;
     t->arg = arg;
-    t->sp = (uint8_t *)((&stack_space) + n_tasks * STACK_SIZE); 
+    t->sp = (uint8_t *)stack + stack_size;
     task_stack_init(t);
     return t;
 }
@@ -167,6 +187,24 @@ void task_test1(void *arg)
     }
 }
 
+#ifdef BENCH
+/* Kernel side of the benchmark scenarios (../bench) */
+uint32_t bench_now(void)
+{
+    return bench_clock();
+}
+
+void bench_yield(void)
+{
+    schedule();
+}
+
+void bench_idle(void)
+{
+    schedule();
+}
+#endif
+
 static void __attribute__((naked)) store_context(void)
 {
     asm volatile("mrs r0, msp");
@@ -185,6 +223,9 @@ static void __attribute__((naked)) restore_context(void)
 
 void __attribute__((naked)) isr_pendsv(void)
 {
+#ifdef BENCH
+    BENCH_PENDSV_ENTER();
+#endif
     store_context();
     asm volatile("mrs %0, msp" : "=r"(TASKS[running_task_id].sp));
     TASKS[running_task_id].state = TASK_WAITING;
@@ -195,6 +236,9 @@ void __attribute__((naked)) isr_pendsv(void)
     asm volatile("msr msp, %0" ::"r"(TASKS[running_task_id].sp));
     restore_context();
     asm volatile("mov lr, %0" ::"r"(0xFFFFFFF9));
+#ifdef BENCH
+    BENCH_PENDSV_EXIT();
+#endif
     asm volatile("bx lr");
 
 }
@@ -206,10 +250,19 @@ void main(void) {
     kernel.name[0] = 0;
     kernel.id = 0;
     kernel.state = TASK_RUNNING;
-    task_create("test0",task_test0, NULL);
-    task_create("test1",task_test1, NULL);
+#ifdef BENCH
+    bench_init();
+    task_create("bench", bench_driver, NULL, 1024);
+    task_create("partner", bench_partner, NULL, 1024);
+#else
+    task_create("test0",task_test0, NULL, 512);
+    task_create("test1",task_test1, NULL, 512);
+#endif
 
     while(1) {
+#ifdef BENCH
+        bench_report_poll();
+#endif
         schedule();
     }
 }
@@ -28,11 +28,13 @@
  * SOFTWARE.
  */
 
-extern unsigned int _stored_data;
-extern unsigned int _start_data;
-extern unsigned int _end_data;
-extern unsigned int _start_bss;
-extern unsigned int _end_bss;
+/* Written by the linker script: {load address, start, end} for each
+ * section to copy, {start, end} for each one to zero
+ */
+extern unsigned int _start_copy_table;
+extern unsigned int _end_copy_table;
+extern unsigned int _start_zero_table;
+extern unsigned int _end_zero_table;
 extern unsigned int _end_stack;
 extern unsigned int _start_heap;
 
@@ -50,23 +52,91 @@ extern void isr_exti15_10(void);
 extern void isr_pendsv(void);
 extern void isr_systick(void);
 
+/* Reset-to-main time in CPU cycles, from the DWT cycle counter (it
+ * reads 0 where there is none, e.g. in QEMU)
+ */
+#define DEMCR       (*(volatile unsigned int *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile unsigned int *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile unsigned int *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+volatile unsigned int startup_cycles;
+
+/* Copy [dst, end) from src: eight words per LDM/STM pair, then the
+ * remaining words one at a time. Naked, so the loop is the same at -O0.
+ */
+static void __attribute__((naked, used)) init_copy(unsigned int *dst,
+        const unsigned int *src, unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r11}\n"
+        "1:\n"
+        "add r3, r0, #32\n"
+        "cmp r3, r2\n"
+        "bhi 2f\n"
+        "ldmia r1!, {r4-r11}\n"
+        "stmia r0!, {r4-r11}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r2\n"
+        "bhs 3f\n"
+        "ldr r3, [r1], #4\n"
+        "str r3, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r11}\n"
+        "bx lr\n"
+    );
+}
+
+/* Zero [dst, end): eight words per STM, then one at a time */
+static void __attribute__((naked, used)) init_zero(unsigned int *dst,
+        unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r9}\n"
+        "mov r2, #0\n"
+        "mov r3, #0\n"
+        "mov r4, #0\n"
+        "mov r5, #0\n"
+        "mov r6, #0\n"
+        "mov r7, #0\n"
+        "mov r8, #0\n"
+        "mov r9, #0\n"
+        "1:\n"
+        "add r12, r0, #32\n"
+        "cmp r12, r1\n"
+        "bhi 2f\n"
+        "stmia r0!, {r2-r9}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r1\n"
+        "bhs 3f\n"
+        "str r2, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r9}\n"
+        "bx lr\n"
+    );
+}
+
 void isr_reset(void) {
-    register unsigned int *src, *dst;
-    src = (unsigned int *) &_stored_data;
-    dst = (unsigned int *) &_start_data;
-    /* Copy the .data section from flash to RAM. */
-    while (dst < (unsigned int *)&_end_data) {
-        *dst = *src;
-        dst++;
-        src++;
-    }
+    register unsigned int *t, *dst;
 
-    /* Initialize the BSS section to 0 */
-    dst = &_start_bss;
-    while (dst < (unsigned int *)&_end_bss) {
-        *dst = 0U;
-        dst++;
-    }
+    /* Count the cycles from here to main() */
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    /* Copy the .data sections from flash to RAM */
+    for (t = &_start_copy_table; t < &_end_copy_table; t += 3)
+        init_copy((unsigned int *)t[1], (const unsigned int *)t[0],
+                (unsigned int *)t[2]);
+
+    /* Initialize the .bss sections to 0 (.noinit is not in the table) */
+    for (t = &_start_zero_table; t < &_end_zero_table; t += 2)
+        init_zero((unsigned int *)t[0], (unsigned int *)t[1]);
 
     /* Paint the stack. */
     avail_mem = &_end_stack - &_start_heap;
@@ -80,6 +150,8 @@ void isr_reset(void) {
         }
     }
 #endif
+    startup_cycles = DWT_CYCCNT;
+
     /* Run the program! */
     main();
 }
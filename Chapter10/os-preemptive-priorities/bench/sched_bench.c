@@ -0,0 +1,143 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+/* Host benchmark for the scheduling decision of isr_pendsv().
+ *
+ * Runs the ready-queue code in tasklist.h with N tasks spread over the
+ * MAX_PRIO priorities and reports the time per pick for:
+ *   pick    round-robin among the ready tasks (timeslice expiry)
+ *   block   the running task waits, the next one is picked and the
+ *           oldest waiting task is made ready again (sleep/wakeup)
+ *
+ * Usage:
+ *   sched_bench [-n picks] [ntasks...]      (default: 8 64 256)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "tasklist.h"
+
+static struct task_block *t_cur;
+
+/* Same steps as isr_pendsv(), without the context save/restore */
+static inline void pendsv_pick(void)
+{
+    if (t_cur->state == TASK_RUNNING)
+        t_cur->state = TASK_READY;
+    t_cur = tasklist_next_ready(t_cur);
+    t_cur->state = TASK_RUNNING;
+}
+
+static void sched_setup(struct task_block *tasks, int n)
+{
+    int i;
+    memset(tasks, 0, n * sizeof(struct task_block));
+    memset(tasklist_active, 0, sizeof(tasklist_active));
+    tasklist_waiting = NULL;
+    ready_prio_mask = 0;
+    for (i = 0; i < n; i++) {
+        tasks[i].id = i;
+        tasks[i].priority = i % MAX_PRIO;
+        tasks[i].base_priority = tasks[i].priority;
+        tasks[i].state = TASK_READY;
+        tasklist_add_active(&tasks[i]);
+    }
+    t_cur = &tasks[0];
+    t_cur->state = TASK_RUNNING;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench_pick(struct task_block *tasks, int n, unsigned long picks)
+{
+    unsigned long i;
+    double t0;
+    sched_setup(tasks, n);
+    t0 = now_ns();
+    for (i = 0; i < picks; i++)
+        pendsv_pick();
+    return (now_ns() - t0) / picks;
+}
+
+static double bench_block(struct task_block *tasks, int n, unsigned long picks)
+{
+    unsigned long i;
+    double t0;
+    sched_setup(tasks, n);
+    t0 = now_ns();
+    for (i = 0; i < picks; i++) {
+        task_waiting(t_cur);
+        pendsv_pick();
+        task_ready(tasklist_waiting);
+    }
+    return (now_ns() - t0) / picks;
+}
+
+int main(int argc, char *argv[])
+{
+    static const int def_tasks[] = { 8, 64, 256 };
+    unsigned long picks = 10000000;
+    struct task_block *tasks;
+    int i, n;
+
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        picks = strtoul(argv[2], NULL, 0);
+        argc -= 2;
+        argv += 2;
+    }
+    if (picks == 0) {
+        fprintf(stderr, "Usage: sched_bench [-n picks] [ntasks...]\n");
+        return 1;
+    }
+    printf("%8s %12s %12s\n", "tasks", "pick ns", "block ns");
+    for (i = 0; i < ((argc > 1) ? argc - 1 : 3); i++) {
+        n = (argc > 1) ? atoi(argv[i + 1]) : def_tasks[i];
+        if (n < 2) {
+            fprintf(stderr, "Invalid task count: %s\n", argv[i + 1]);
+            return 1;
+        }
+        tasks = malloc(n * sizeof(struct task_block));
+        if (!tasks) {
+            perror("malloc");
+            return 1;
+        }
+        printf("%8d %12.2f", n, bench_pick(tasks, n, picks));
+        printf(" %12.2f\n", bench_block(tasks, n, picks));
+        free(tasks);
+    }
+    return 0;
+}
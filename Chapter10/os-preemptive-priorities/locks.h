@@ -37,11 +37,26 @@ struct semaphore {
 };
 
 typedef struct semaphore semaphore;
-typedef semaphore mutex;
 
 int sem_trywait(semaphore *s);
 int sem_dopost(semaphore *s);
 
+/* Mutex with priority inheritance.
+ * 'owner' is claimed atomically by mutex_tryacquire(); the waiters are
+ * queued by priority (FIFO among equal priorities) and the lock is
+ * handed off directly to the first one on unlock.
+ */
+struct task_block;
+struct mutex {
+    struct task_block *owner;
+    struct task_block *waiters;
+    struct mutex *next_held;
+};
+
+typedef struct mutex mutex;
+
+int mutex_tryacquire(mutex *m, struct task_block *t);
+
 static inline int sem_init(semaphore *s, int val)
 {
     int i;
@@ -51,7 +66,12 @@ static inline int sem_init(semaphore *s, int val)
     return 0;
 }
 
-#define mutex_init(m) sem_init(m, 1)
-#define mutex_trylock(m) sem_trywait(m)
+static inline int mutex_init(mutex *m)
+{
+    m->owner = 0;
+    m->waiters = 0;
+    m->next_held = 0;
+    return 0;
+}
 
 #endif
@@ -34,149 +34,251 @@
 #include "timer.h"
 #include "led.h"
 #include "button.h"
+#include "task.h"
 #include "locks.h"
+#include "tasklist.h"
+#ifdef BENCH
+#include "bench.h"
+#endif
 
 mutex m;
 
-
-#define TASK_WAITING 0
-#define TASK_READY   1
-#define TASK_RUNNING 2
-#define TASK_NAME_MAXLEN 16
-struct task_block {
-    char name[TASK_NAME_MAXLEN];
-    int id;
-	int state;
-	void (*start)(void *arg);
-	void *arg;
-    uint8_t *sp;
-    uint32_t wakeup_time;
-    uint8_t priority;
-    struct task_block *next;
-};
-
+#ifndef MAX_TASKS
 #define MAX_TASKS 16
-#define MAX_PRIO  4
+#endif
 static struct task_block TASKS[MAX_TASKS];
 #define kernel TASKS[0]
 static int n_tasks = 1;
 static struct task_block *t_cur = &TASKS[0];
-extern uint32_t stack_space;
-#define STACK_SIZE (256)
+
+/* Task stacks are carved from the .task_stacks area (target.ld) */
+extern uint8_t _start_task_stacks, _end_task_stacks;
+static uint8_t *stack_brk = &_start_task_stacks;
+#define STACK_MIN (256)
+
+static uint32_t *stack_alloc(uint32_t size)
+{
+    uint8_t *stack = stack_brk;
+    if (size > (uint32_t)(&_end_task_stacks - stack_brk))
+        return NULL;
+    stack_brk += size;
+    return (uint32_t *)stack;
+}
 
 #define SCB_ICSR (*((volatile uint32_t *)0xE000ED04))
 #define schedule()  SCB_ICSR |= (1 << 28)
 
 #define TIMESLICE (20)
 
-struct task_block *tasklist_active[MAX_PRIO] = { };
-struct task_block *tasklist_waiting = NULL;
-
-static void tasklist_add(struct task_block **list, struct task_block *el)
-{
-    el->next = *list;
-    *list = el;
-}
 
-static void tasklist_add_active(struct task_block *el)
+/* Mutex/semaphore */
+int sem_wait(semaphore *s)
 {
-    tasklist_add(&tasklist_active[el->priority], el);
+    int i;
+    if (s == NULL)
+        return -1;
+    if (sem_trywait(s) == 0)
+        return 0;
+    for (i = 0; i < MAX_LISTENERS; i++) {
+        if (!s->listeners[i])
+            s->listeners[i] = t_cur->id;
+        if (s->listeners[i] == t_cur->id)
+            break;
+    }
+    task_waiting(t_cur);
+    schedule();
+    return sem_wait(s);
 }
 
-static int tasklist_del(struct task_block **list, struct task_block *delme)
+int sem_post(semaphore *s)
 {
-    struct task_block *t = *list;
-    struct task_block *p = NULL;
-    while (t) {
-        if (t == delme) {
-            if (p == NULL)
-                *list = t->next;
-            else
-                p->next = t->next;
-            return 0;
+    int i;
+    if (s == NULL)
+        return -1;
+    if (sem_dopost(s) > 0) {
+        for (i = 0; i < MAX_LISTENERS; i++) {
+            if (s->listeners[i]) {
+                task_ready(&TASKS[s->listeners[i]]);
+                s->listeners[i] = 0;
+            }
         }
-        p = t;
-        t = t->next;
+        schedule();
     }
-    return -1;
+    return 0;
 }
 
-static int tasklist_del_active(struct task_block *el)
+/* Priority-inheritance mutex */
+
+#ifdef MUTEX_HANDOFF_STATS
+#define DEMCR       (*(volatile uint32_t *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile uint32_t *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile uint32_t *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+/* Cycles between mutex_unlock() handing the lock off and the new owner
+ * resuming, when the new owner preempts the unlocking task right away.
+ * Inspect from gdb with 'p handoff_stats'.
+ */
+struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+} handoff_stats = { 0, 0xFFFFFFFF, 0, 0 };
+static uint32_t handoff_start;
+static struct task_block *handoff_to;
+#endif
+
+/* Wait queues are sorted by priority, FIFO among equal priorities */
+static void waitqueue_add(struct task_block **q, struct task_block *t)
 {
-    return tasklist_del(&tasklist_active[el->priority], el);
+    while (*q && ((*q)->priority >= t->priority))
+        q = &(*q)->wait_next;
+    t->wait_next = *q;
+    *q = t;
 }
 
-
-static int idx;
-static inline struct task_block *tasklist_next_ready(struct task_block *t)
+static void waitqueue_del(struct task_block **q, struct task_block *t)
 {
-    for (idx = MAX_PRIO - 1; idx >= 0; idx--) {
-        if ((idx == t->priority) && 
-                (t->next != NULL) && 
-                (t->next->state == TASK_READY))
-            return t->next;
-        if (tasklist_active[idx])
-            return tasklist_active[idx];
-    }
-    return t;
+    while (*q && (*q != t))
+        q = &(*q)->wait_next;
+    if (*q)
+        *q = t->wait_next;
+    t->wait_next = NULL;
 }
 
-static void task_waiting(struct task_block *t)
+/* Priority a task is entitled to, given the waiters on the mutexes it holds */
+static uint8_t task_inherited_priority(struct task_block *t)
 {
-    if (tasklist_del_active(t) == 0) {
-        tasklist_add(&tasklist_waiting, t);
-        t->state = TASK_WAITING;
+    uint8_t prio = t->base_priority;
+    mutex *m;
+    for (m = t->held; m; m = m->next_held) {
+        if (m->waiters && (m->waiters->priority > prio))
+            prio = m->waiters->priority;
     }
+    return prio;
 }
 
-static void task_ready(struct task_block *t)
+/* Change the priority of a task, and propagate the change along the
+ * chain of mutex owners it is (transitively) blocked on.
+ * Called with interrupts disabled.
+ */
+static void task_set_priority(struct task_block *t, uint8_t prio)
 {
-    if (tasklist_del(&tasklist_waiting, t) == 0) {
-        tasklist_add_active(t);
-        t->state = TASK_READY;
+    mutex *m;
+    while (t && (t->priority != prio)) {
+        if (t->state == TASK_WAITING) {
+            t->priority = prio;
+        } else {
+            tasklist_del_active(t);
+            t->priority = prio;
+            tasklist_add_active(t);
+        }
+        m = t->waiting_on;
+        if (!m)
+            break;
+        waitqueue_del(&m->waiters, t);
+        waitqueue_add(&m->waiters, t);
+        t = m->owner;
+        prio = task_inherited_priority(t);
     }
 }
 
+int mutex_trylock(mutex *m)
+{
+    if (m == NULL)
+        return -1;
+    if (mutex_tryacquire(m, t_cur) != 0)
+        return -1;
+    IRQ_DISABLE();
+    m->next_held = t_cur->held;
+    t_cur->held = m;
+    IRQ_ENABLE();
+    return 0;
+}
 
-/* Mutex/semaphore */
-int sem_wait(semaphore *s)
+int mutex_lock(mutex *m)
 {
-    int i;
-    if (s == NULL)
+    if (m == NULL)
         return -1;
-    if (sem_trywait(s) == 0)
+    if (mutex_trylock(m) == 0)
+        return 0;
+    IRQ_DISABLE();
+    if (mutex_tryacquire(m, t_cur) == 0) {
+        m->next_held = t_cur->held;
+        t_cur->held = m;
+        IRQ_ENABLE();
         return 0;
-    for (i = 0; i < MAX_LISTENERS; i++) {
-        if (!s->listeners[i])
-            s->listeners[i] = t_cur->id;
-        if (s->listeners[i] == t_cur->id)
-            break;
     }
+    t_cur->waiting_on = m;
+    waitqueue_add(&m->waiters, t_cur);
+    if (m->owner->priority < t_cur->priority)
+        task_set_priority(m->owner, t_cur->priority);
     task_waiting(t_cur);
     schedule();
-    return sem_wait(s);
+    IRQ_ENABLE();
+    /* Resumed by mutex_unlock(), which made us the owner */
+#ifdef MUTEX_HANDOFF_STATS
+    if (handoff_to == t_cur) {
+        uint32_t cycles = DWT_CYCCNT - handoff_start;
+        handoff_to = NULL;
+        handoff_stats.count++;
+        handoff_stats.total += cycles;
+        if (cycles < handoff_stats.min)
+            handoff_stats.min = cycles;
+        if (cycles > handoff_stats.max)
+            handoff_stats.max = cycles;
+    }
+#endif
+    return 0;
 }
 
-int sem_post(semaphore *s)
+int mutex_unlock(mutex *m)
 {
-    int i;
-    if (s == NULL)
+    struct task_block *next;
+    mutex **h;
+    if ((m == NULL) || (m->owner != t_cur))
         return -1;
-    if (sem_dopost(s) > 0) {
-        for (i = 0; i < MAX_LISTENERS; i++) {
-            if (s->listeners[i]) {
-                task_ready(&TASKS[s->listeners[i]]);
-                s->listeners[i] = 0;
-            }
+    IRQ_DISABLE();
+    for (h = &t_cur->held; *h; h = &(*h)->next_held) {
+        if (*h == m) {
+            *h = m->next_held;
+            break;
+        }
+    }
+    m->next_held = NULL;
+    next = m->waiters;
+    if (next) {
+        /* Hand the lock off to the highest priority waiter */
+        m->waiters = next->wait_next;
+        next->wait_next = NULL;
+        next->waiting_on = NULL;
+        m->owner = next;
+        m->next_held = next->held;
+        next->held = m;
+        task_ready(next);
+        task_set_priority(next, task_inherited_priority(next));
+    } else {
+        DMB();
+        m->owner = NULL;
+    }
+    /* Drop the priority inherited through this mutex */
+    task_set_priority(t_cur, task_inherited_priority(t_cur));
+    if (next) {
+#ifdef MUTEX_HANDOFF_STATS
+        /* Otherwise the figure would include our own run time */
+        if (next->priority > t_cur->priority) {
+            handoff_to = next;
+            handoff_start = DWT_CYCCNT;
         }
+#endif
         schedule();
     }
+    IRQ_ENABLE();
     return 0;
 }
 
-#define mutex_lock(x) sem_wait(x)
-#define mutex_unlock(x) sem_post(x)
-
 void isr_systick(void)
 {
     if ((++jiffies % TIMESLICE) == 0)
@@ -188,6 +290,9 @@ struct stack_frame {
 };
 
 struct extra_frame {
+#ifdef KERNEL_FPU
+    uint32_t exc_return;
+#endif
     uint32_t r4, r5, r6, r7, r8, r9, r10, r11;
 };
 
@@ -206,15 +311,107 @@ static void task_stack_init(struct task_block *t)
     tf->lr = (uint32_t) task_terminated;
     tf->xpsr =  (1 << 24);
     t->sp -= sizeof(struct extra_frame);
+#ifdef KERNEL_FPU
+    /* Thread mode, MSP, no FP context yet */
+    ((struct extra_frame *)(t->sp))->exc_return = 0xFFFFFFF9;
+#endif
+}
+
+
+/* Stack usage profiling.
+ *
+ * Task stacks are painted with STACK_PAINT at creation. In idle time the
+ * kernel checks a few words at a time, from the bottom of each stack up,
+ * looking for the lowest word that has been overwritten. Usage can only
+ * grow, so each pass stops at the watermark found by the previous one.
+ */
+#define STACK_PAINT      (0xDEADC0DE)
+#define STACK_SCAN_WORDS (16)
+
+static void task_stack_paint(struct task_block *t)
+{
+    uint32_t i;
+    for (i = 0; i < t->stack_words; i++)
+        t->stack_bottom[i] = STACK_PAINT;
+    t->stack_free = t->stack_words;
+}
+
+static int scan_id = 1;
+static uint32_t scan_pos = 0;
+
+static void stack_scan_step(void)
+{
+    struct task_block *t;
+    int i;
+
+    if (scan_id >= n_tasks) {
+        if (n_tasks < 2)
+            return;
+        scan_id = 1;
+    }
+    t = &TASKS[scan_id];
+    for (i = 0; i < STACK_SCAN_WORDS; i++) {
+        if (scan_pos >= t->stack_free)
+            break;
+        if (t->stack_bottom[scan_pos] != STACK_PAINT) {
+            t->stack_free = scan_pos;
+            break;
+        }
+        scan_pos++;
+    }
+    if (i < STACK_SCAN_WORDS) {
+        /* Done with this task */
+        scan_pos = 0;
+        scan_id++;
+    }
 }
 
+/* Peak stack usage of a task, and the margin left, in bytes */
+int task_stack_usage(int id, uint32_t *peak, uint32_t *margin)
+{
+    if ((id < 1) || (id >= n_tasks))
+        return -1;
+    *peak = (TASKS[id].stack_words - TASKS[id].stack_free) * sizeof(uint32_t);
+    *margin = TASKS[id].stack_free * sizeof(uint32_t);
+    return 0;
+}
+
+/* Stack report (task.h), refreshed from the idle loop */
+#define STACK_REPORT_MS  (1000)
+struct stack_report stack_report[MAX_TASKS];
+volatile uint32_t stack_report_low = 0;
+static uint32_t stack_report_time = 0;
+
+static void stack_report_update(void)
+{
+    uint32_t low = 0;
+    int i;
+
+    if ((jiffies - stack_report_time) < STACK_REPORT_MS)
+        return;
+    stack_report_time = jiffies;
+    for (i = 1; i < n_tasks; i++) {
+        stack_report[i].name = TASKS[i].name;
+        task_stack_usage(i, &stack_report[i].peak, &stack_report[i].margin);
+        if (stack_report[i].margin < STACK_MARGIN_LOW)
+            low++;
+    }
+    stack_report_low = low;
+}
 
-struct task_block *task_create(char *name, void (*start)(void *arg), void *arg, int prio)
+struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
+        int prio, uint32_t stack_size)
 {
     struct task_block *t;
     int i;
+    uint32_t *stack;
 
-    if (n_tasks >= MAX_TASKS)
+    if ((n_tasks >= MAX_TASKS) || (prio < 0) || (prio >= MAX_PRIO) ||
+            (stack_size < STACK_MIN))
+        return NULL;
+    stack_size = (stack_size + 7) & ~7;
+    stack = stack_alloc(stack_size);
+    if (stack == NULL)
         return NULL;
     t = &TASKS[n_tasks];
     t->id = n_tasks++;
@@ -228,7 +425,14 @@ struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
     t->arg = arg;
     t->wakeup_time = 0;
     t->priority = prio;
-    t->sp = (uint8_t *)((&stack_space) + n_tasks * STACK_SIZE); 
+    t->base_priority = prio;
+    t->wait_next = NULL;
+    t->waiting_on = NULL;
+    t->held = NULL;
+    t->stack_bottom = stack;
+    t->stack_words = stack_size / sizeof(uint32_t);
+    t->sp = (uint8_t *)(stack + t->stack_words);
+    task_stack_paint(t);
     task_stack_init(t);
     tasklist_add_active(t);
     return t;
@@ -264,6 +468,52 @@ void button_wakeup(void)
     }
 }
 
+#ifdef BENCH
+/* Kernel side of the benchmark scenarios (../bench) */
+static mutex bench_m;
+
+uint32_t bench_now(void)
+{
+    return bench_clock();
+}
+
+void bench_yield(void)
+{
+    schedule();
+}
+
+void bench_idle(void)
+{
+    sleep_ms(1000);
+}
+
+void bench_lock(void)
+{
+    mutex_lock(&bench_m);
+}
+
+void bench_unlock(void)
+{
+    mutex_unlock(&bench_m);
+}
+
+void bench_irq_trigger(void)
+{
+    bench_t0 = bench_clock();
+    button_sw_trigger();
+}
+
+int bench_irq_wait(void)
+{
+    return button_read();
+}
+
+int bench_irq_armed(void)
+{
+    return button_task != NULL;
+}
+#endif
+
 void task_test0(void *arg)
 {
     while(1) {
@@ -301,6 +551,64 @@ void task_test2(void *arg)
     }
 }
 
+#ifdef MUTEX_HANDOFF_STATS
+/* Contention scenario: 'holder' sleeps with the mutex held, the two
+ * contenders wake up meanwhile and block on it. Every unlock then hands
+ * the lock off to a higher priority task.
+ */
+void task_holder(void *arg)
+{
+    while(1) {
+        mutex_lock(&m);
+        blue_led_on();
+        sleep_ms(5);
+        blue_led_off();
+        mutex_unlock(&m);
+        sleep_ms(2);
+    }
+}
+
+void task_contender(void *arg)
+{
+    int period = (int)arg;
+    while(1) {
+        sleep_ms(period);
+        mutex_lock(&m);
+        red_led_toggle();
+        mutex_unlock(&m);
+    }
+}
+#endif
+
+#ifdef KERNEL_FPU
+/* Software part of the task frame: EXC_RETURN, passed in r1, then
+ * r4-r11, then s16-s31 only when the task has an FP context
+ * (EXC_RETURN bit 4 clear). s0-s15 and FPSCR are in the hardware
+ * frame, saved lazily by the FPU when the handler touches the FPU.
+ * restore_context() returns the EXC_RETURN of the next task in r1.
+ */
+static void __attribute__((naked)) store_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vstmdbeq r0!, {s16-s31}");
+    asm volatile("stmdb r0!, {r1, r4-r11}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+
+static void __attribute__((naked)) restore_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("ldmia r0!, {r1, r4-r11}");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vldmiaeq r0!, {s16-s31}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+#else
 static void __attribute__((naked)) store_context(void)
 {
     asm volatile("mrs r0, msp");
@@ -316,10 +624,17 @@ static void __attribute__((naked)) restore_context(void)
     asm volatile("msr msp, r0");
     asm volatile("bx lr");
 }
+#endif
 
 
 void __attribute__((naked)) isr_pendsv(void)
 {
+#ifdef BENCH
+    BENCH_PENDSV_ENTER();
+#endif
+#ifdef KERNEL_FPU
+    asm volatile("mov r1, lr");
+#endif
     store_context();
     asm volatile("mrs %0, msp" : "=r"(t_cur->sp));
     if (t_cur->state == TASK_RUNNING) {
@@ -329,7 +644,14 @@ void __attribute__((naked)) isr_pendsv(void)
     t_cur->state = TASK_RUNNING;
     asm volatile("msr msp, %0" ::"r"(t_cur->sp));
     restore_context();
+#ifdef KERNEL_FPU
+    asm volatile("mov lr, r1");
+#else
     asm volatile("mov lr, %0" ::"r"(0xFFFFFFF9));
+#endif
+#ifdef BENCH
+    BENCH_PENDSV_EXIT();
+#endif
     asm volatile("bx lr");
 }
 
@@ -346,10 +668,27 @@ void main(void) {
     kernel.state = TASK_RUNNING;
     kernel.wakeup_time = 0;
     kernel.priority = 0;
+    kernel.base_priority = 0;
+#ifdef MUTEX_HANDOFF_STATS
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
     tasklist_add_active(&kernel);
-    task_create("test0",task_test0, NULL, 1);
-    task_create("test1",task_test1, NULL, 1);
-    task_create("test2",task_test2, NULL, 3);
+#ifdef BENCH
+    bench_init();
+    mutex_init(&bench_m);
+    task_create("bench", bench_driver, NULL, 1, 1024);
+    task_create("partner", bench_partner, NULL, 1, 1024);
+#elif defined(MUTEX_HANDOFF_STATS)
+    task_create("holder", task_holder, NULL, 1, 512);
+    task_create("cont2", task_contender, (void *)3, 2, 512);
+    task_create("cont3", task_contender, (void *)4, 3, 512);
+#else
+    task_create("test0",task_test0, NULL, 1, 1024);
+    task_create("test1",task_test1, NULL, 1, 512);
+    task_create("test2",task_test2, NULL, 3, 512);
+#endif
     mutex_init(&m);
 
 
@@ -362,7 +701,14 @@ void main(void) {
                 break;
             }
             t = t->next;
+            if (t == tasklist_waiting)
+                break;
         }
+        stack_scan_step();
+        stack_report_update();
+#ifdef BENCH
+        bench_report_poll();
+#endif
         WFI();
     }
 }
@@ -182,6 +182,8 @@
 #define WFI() __asm__ volatile ("wfi")
 #define WFE() __asm__ volatile ("wfe")
 #define SEV() __asm__ volatile ("sev")
+#define IRQ_DISABLE() __asm__ volatile ("cpsid i")
+#define IRQ_ENABLE() __asm__ volatile ("cpsie i")
 
 /* Master clock setting */
 void clock_pll_on(int powersave);
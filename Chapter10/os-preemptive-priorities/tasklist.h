@@ -0,0 +1,143 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef TASKLIST_H_INCLUDED
+#define TASKLIST_H_INCLUDED
+#include <stdint.h>
+#include <stddef.h>
+#include "locks.h"
+
+#define TASK_WAITING 0
+#define TASK_READY   1
+#define TASK_RUNNING 2
+#define TASK_NAME_MAXLEN 16
+struct task_block {
+    char name[TASK_NAME_MAXLEN];
+    int id;
+	int state;
+	void (*start)(void *arg);
+	void *arg;
+    uint8_t *sp;
+    uint32_t wakeup_time;
+    uint8_t priority;
+    uint8_t base_priority;
+    struct task_block *next, *prev;
+    struct task_block *wait_next;
+    mutex *waiting_on;
+    mutex *held;
+    uint32_t *stack_bottom;
+    uint32_t stack_words;
+    uint32_t stack_free;      /* Never used words, at the bottom */
+};
+
+#define MAX_PRIO  32
+
+/* Task lists are circular and doubly linked, so that insertion at the
+ * tail and removal of any element are O(1).
+ *
+ * Bit N in ready_prio_mask is set when tasklist_active[N] is not empty.
+ */
+static struct task_block *tasklist_active[MAX_PRIO] = { };
+static struct task_block *tasklist_waiting = NULL;
+static uint32_t ready_prio_mask = 0;
+
+static void tasklist_add(struct task_block **list, struct task_block *el)
+{
+    struct task_block *head = *list;
+    if (head == NULL) {
+        el->next = el;
+        el->prev = el;
+        *list = el;
+        return;
+    }
+    el->next = head;
+    el->prev = head->prev;
+    head->prev->next = el;
+    head->prev = el;
+}
+
+static void tasklist_del(struct task_block **list, struct task_block *delme)
+{
+    if (delme->next == delme) {
+        *list = NULL;
+    } else {
+        delme->prev->next = delme->next;
+        delme->next->prev = delme->prev;
+        if (*list == delme)
+            *list = delme->next;
+    }
+    delme->next = NULL;
+    delme->prev = NULL;
+}
+
+static void tasklist_add_active(struct task_block *el)
+{
+    tasklist_add(&tasklist_active[el->priority], el);
+    ready_prio_mask |= (1U << el->priority);
+}
+
+static void tasklist_del_active(struct task_block *el)
+{
+    tasklist_del(&tasklist_active[el->priority], el);
+    if (tasklist_active[el->priority] == NULL)
+        ready_prio_mask &= ~(1U << el->priority);
+}
+
+static inline struct task_block *tasklist_next_ready(struct task_block *t)
+{
+    int prio;
+    if (ready_prio_mask == 0)
+        return t;
+    /* Highest priority with at least one ready task (CLZ on Cortex-M3) */
+    prio = 31 - __builtin_clz(ready_prio_mask);
+    /* Round-robin among tasks of the same priority */
+    if ((t->state != TASK_WAITING) && (t->priority == prio))
+        return t->next;
+    return tasklist_active[prio];
+}
+
+static void task_waiting(struct task_block *t)
+{
+    if (t->state != TASK_WAITING) {
+        tasklist_del_active(t);
+        tasklist_add(&tasklist_waiting, t);
+        t->state = TASK_WAITING;
+    }
+}
+
+static void task_ready(struct task_block *t)
+{
+    if (t->state == TASK_WAITING) {
+        tasklist_del(&tasklist_waiting, t);
+        tasklist_add_active(t);
+        t->state = TASK_READY;
+    }
+}
+
+#endif
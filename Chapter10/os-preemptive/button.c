@@ -55,6 +55,14 @@ void button_start_read(void)
     nvic_irq_enable(NVIC_EXTI15_10_IRQN);
 }
 
+/* Raise the button interrupt from software, as if it was pressed.
+ * Only effective after button_start_read().
+ */
+void button_sw_trigger(void)
+{
+    EXTI_SWIER |= (1 << BUTTON_PIN);
+}
+
 void isr_exti15_10(void)
 {
     nvic_irq_disable(NVIC_EXTI15_10_IRQN);
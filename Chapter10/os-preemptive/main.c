@@ -34,6 +34,10 @@
 #include "timer.h"
 #include "led.h"
 #include "button.h"
+#include "task.h"
+#ifdef BENCH
+#include "bench.h"
+#endif
 
 
 #define TASK_WAITING 0
@@ -49,6 +53,10 @@ struct task_block {
     uint8_t *sp;
     uint32_t wakeup_time;
     struct task_block *next;
+    struct task_block *sleep_next;
+    uint32_t *stack_bottom;
+    uint32_t stack_words;
+    uint32_t stack_free;      /* Never used words, at the bottom */
 };
 
 #define MAX_TASKS 16
@@ -60,6 +68,9 @@ static struct task_block *t_cur = &TASKS[0];
 struct task_block *tasklist_active = NULL;
 struct task_block *tasklist_waiting = NULL;
 
+/* Sleeping tasks, sorted by wakeup_time (earliest first) */
+struct task_block *tasklist_sleeping = NULL;
+
 static void tasklist_add(struct task_block **list, struct task_block *el)
 {
     el->next = *list;
@@ -107,8 +118,56 @@ static void task_ready(struct task_block *t)
     }
 }
 
-extern uint32_t stack_space;
-#define STACK_SIZE (256)
+/* Wrap-safe comparison between jiffies values */
+#define time_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+static void sleeplist_add(struct task_block *t)
+{
+    struct task_block **p = &tasklist_sleeping;
+    while (*p && !time_before(t->wakeup_time, (*p)->wakeup_time))
+        p = &(*p)->sleep_next;
+    t->sleep_next = *p;
+    *p = t;
+}
+
+/* Wake up all the tasks whose deadline has expired.
+ * Only the head of the sorted list is checked on each tick.
+ */
+static int sleeplist_expire(void)
+{
+    int woken = 0;
+    struct task_block *t;
+    while ((t = tasklist_sleeping) != NULL) {
+        if (time_before(jiffies, t->wakeup_time))
+            break;
+        tasklist_sleeping = t->sleep_next;
+        t->sleep_next = NULL;
+        t->wakeup_time = 0;
+        task_ready(t);
+        woken++;
+    }
+    return woken;
+}
+
+/* True when the kernel is the only task that can run */
+static int tasks_idle(void)
+{
+    return (tasklist_active == &kernel) && (kernel.next == NULL);
+}
+
+/* Task stacks are carved from the .task_stacks area (target.ld) */
+extern uint8_t _start_task_stacks, _end_task_stacks;
+static uint8_t *stack_brk = &_start_task_stacks;
+#define STACK_MIN (256)
+
+static uint32_t *stack_alloc(uint32_t size)
+{
+    uint8_t *stack = stack_brk;
+    if (size > (uint32_t)(&_end_task_stacks - stack_brk))
+        return NULL;
+    stack_brk += size;
+    return (uint32_t *)stack;
+}
 
 #define SCB_ICSR (*((volatile uint32_t *)0xE000ED04))
 #define schedule()  SCB_ICSR |= (1 << 28)
@@ -116,7 +175,9 @@ extern uint32_t stack_space;
 #define TIMESLICE (20)
 void isr_systick(void)
 {
-    if ((++jiffies % TIMESLICE) == 0)
+    uint32_t elapsed = systick_tick();
+    if ((sleeplist_expire() > 0) || (elapsed > 1) ||
+            ((jiffies % TIMESLICE) == 0))
         schedule();
 }
 
@@ -125,6 +186,9 @@ struct stack_frame {
 };
 
 struct extra_frame {
+#ifdef KERNEL_FPU
+    uint32_t exc_return;
+#endif
     uint32_t r4, r5, r6, r7, r8, r9, r10, r11;
 };
 
@@ -143,15 +207,106 @@ static void task_stack_init(struct task_block *t)
     tf->lr = (uint32_t) task_terminated;
     tf->xpsr =  (1 << 24);
     t->sp -= sizeof(struct extra_frame);
+#ifdef KERNEL_FPU
+    /* Thread mode, MSP, no FP context yet */
+    ((struct extra_frame *)(t->sp))->exc_return = 0xFFFFFFF9;
+#endif
+}
+
+
+/* Stack usage profiling.
+ *
+ * Task stacks are painted with STACK_PAINT at creation. In idle time the
+ * kernel checks a few words at a time, from the bottom of each stack up,
+ * looking for the lowest word that has been overwritten. Usage can only
+ * grow, so each pass stops at the watermark found by the previous one.
+ */
+#define STACK_PAINT      (0xDEADC0DE)
+#define STACK_SCAN_WORDS (16)
+
+static void task_stack_paint(struct task_block *t)
+{
+    uint32_t i;
+    for (i = 0; i < t->stack_words; i++)
+        t->stack_bottom[i] = STACK_PAINT;
+    t->stack_free = t->stack_words;
+}
+
+static int scan_id = 1;
+static uint32_t scan_pos = 0;
+
+static void stack_scan_step(void)
+{
+    struct task_block *t;
+    int i;
+
+    if (scan_id >= n_tasks) {
+        if (n_tasks < 2)
+            return;
+        scan_id = 1;
+    }
+    t = &TASKS[scan_id];
+    for (i = 0; i < STACK_SCAN_WORDS; i++) {
+        if (scan_pos >= t->stack_free)
+            break;
+        if (t->stack_bottom[scan_pos] != STACK_PAINT) {
+            t->stack_free = scan_pos;
+            break;
+        }
+        scan_pos++;
+    }
+    if (i < STACK_SCAN_WORDS) {
+        /* Done with this task */
+        scan_pos = 0;
+        scan_id++;
+    }
 }
 
+/* Peak stack usage of a task, and the margin left, in bytes */
+int task_stack_usage(int id, uint32_t *peak, uint32_t *margin)
+{
+    if ((id < 1) || (id >= n_tasks))
+        return -1;
+    *peak = (TASKS[id].stack_words - TASKS[id].stack_free) * sizeof(uint32_t);
+    *margin = TASKS[id].stack_free * sizeof(uint32_t);
+    return 0;
+}
+
+/* Stack report (task.h), refreshed from the idle loop */
+#define STACK_REPORT_MS  (1000)
+struct stack_report stack_report[MAX_TASKS];
+volatile uint32_t stack_report_low = 0;
+static uint32_t stack_report_time = 0;
+
+static void stack_report_update(void)
+{
+    uint32_t low = 0;
+    int i;
+
+    if ((jiffies - stack_report_time) < STACK_REPORT_MS)
+        return;
+    stack_report_time = jiffies;
+    for (i = 1; i < n_tasks; i++) {
+        stack_report[i].name = TASKS[i].name;
+        task_stack_usage(i, &stack_report[i].peak, &stack_report[i].margin);
+        if (stack_report[i].margin < STACK_MARGIN_LOW)
+            low++;
+    }
+    stack_report_low = low;
+}
 
-struct task_block *task_create(char *name, void (*start)(void *arg), void *arg)
+struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
+        uint32_t stack_size)
 {
     struct task_block *t;
     int i;
+    uint32_t *stack;
 
-    if (n_tasks >= MAX_TASKS)
+    if ((n_tasks >= MAX_TASKS) || (stack_size < STACK_MIN))
+        return NULL;
+    stack_size = (stack_size + 7) & ~7;
+    stack = stack_alloc(stack_size);
+    if (stack == NULL)
         return NULL;
     t = &TASKS[n_tasks];
     t->id = n_tasks++;
@@ -164,7 +319,10 @@ struct task_block *task_create(char *name, void (*start)(void *arg), void *arg)
     t->start = start;
     t->arg = arg;
     t->wakeup_time = 0;
-    t->sp = (uint8_t *)((&stack_space) + n_tasks * STACK_SIZE); 
+    t->stack_bottom = stack;
+    t->stack_words = stack_size / sizeof(uint32_t);
+    t->sp = (uint8_t *)(stack + t->stack_words);
+    task_stack_paint(t);
     task_stack_init(t);
     tasklist_add(&tasklist_active, t);
     return t;
@@ -174,19 +332,26 @@ void sleep_ms(int ms)
 {
     if (ms < 2)
         return;
+    IRQ_DISABLE();
     t_cur->wakeup_time = jiffies + ms;
+    sleeplist_add(t_cur);
     task_waiting(t_cur);
+    IRQ_ENABLE();
     schedule();
 }
 
 struct task_block *button_task = NULL;
 int button_read(void)
 {
-    if (button_task)
+    IRQ_DISABLE();
+    if (button_task) {
+        IRQ_ENABLE();
         return 0;
+    }
     button_task = t_cur;
     task_waiting(t_cur);
     button_start_read();
+    IRQ_ENABLE();
     schedule();
     return 1;
 }
@@ -200,6 +365,40 @@ void button_wakeup(void)
     }
 }
 
+#ifdef BENCH
+/* Kernel side of the benchmark scenarios (../bench) */
+uint32_t bench_now(void)
+{
+    return bench_clock();
+}
+
+void bench_yield(void)
+{
+    schedule();
+}
+
+void bench_idle(void)
+{
+    sleep_ms(1000);
+}
+
+void bench_irq_trigger(void)
+{
+    bench_t0 = bench_clock();
+    button_sw_trigger();
+}
+
+int bench_irq_wait(void)
+{
+    return button_read();
+}
+
+int bench_irq_armed(void)
+{
+    return button_task != NULL;
+}
+#endif
+
 void task_test0(void *arg)
 {
     blue_led_on();
@@ -232,6 +431,35 @@ void task_test2(void *arg)
     }
 }
 
+#ifdef KERNEL_FPU
+/* Software part of the task frame: EXC_RETURN, passed in r1, then
+ * r4-r11, then s16-s31 only when the task has an FP context
+ * (EXC_RETURN bit 4 clear). s0-s15 and FPSCR are in the hardware
+ * frame, saved lazily by the FPU when the handler touches the FPU.
+ * restore_context() returns the EXC_RETURN of the next task in r1.
+ */
+static void __attribute__((naked)) store_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vstmdbeq r0!, {s16-s31}");
+    asm volatile("stmdb r0!, {r1, r4-r11}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+
+static void __attribute__((naked)) restore_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("ldmia r0!, {r1, r4-r11}");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vldmiaeq r0!, {s16-s31}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+#else
 static void __attribute__((naked)) store_context(void)
 {
     asm volatile("mrs r0, msp");
@@ -247,10 +475,17 @@ static void __attribute__((naked)) restore_context(void)
     asm volatile("msr msp, r0");
     asm volatile("bx lr");
 }
+#endif
 
 
 void __attribute__((naked)) isr_pendsv(void)
 {
+#ifdef BENCH
+    BENCH_PENDSV_ENTER();
+#endif
+#ifdef KERNEL_FPU
+    asm volatile("mov r1, lr");
+#endif
     store_context();
     asm volatile("mrs %0, msp" : "=r"(t_cur->sp));
     if (t_cur->state == TASK_RUNNING) {
@@ -260,7 +495,14 @@ void __attribute__((naked)) isr_pendsv(void)
     t_cur->state = TASK_RUNNING;
     asm volatile("msr msp, %0" ::"r"(t_cur->sp));
     restore_context();
+#ifdef KERNEL_FPU
+    asm volatile("mov lr, r1");
+#else
     asm volatile("mov lr, %0" ::"r"(0xFFFFFFF9));
+#endif
+#ifdef BENCH
+    BENCH_PENDSV_EXIT();
+#endif
     asm volatile("bx lr");
 }
 
@@ -277,19 +519,41 @@ void main(void) {
     kernel.state = TASK_RUNNING;
     kernel.wakeup_time = 0;
     tasklist_add(&tasklist_active, &kernel);
-    task_create("test0",task_test0, NULL);
-    task_create("test1",task_test1, NULL);
-    task_create("test2",task_test2, NULL);
+#ifdef BENCH
+    bench_init();
+    task_create("bench", bench_driver, NULL, 1024);
+    task_create("partner", bench_partner, NULL, 1024);
+#else
+    task_create("test0",task_test0, NULL, 1024);
+    task_create("test1",task_test1, NULL, 512);
+    task_create("test2",task_test2, NULL, 512);
+#endif
 
     while(1) {
-        struct task_block *t = tasklist_waiting;
-        while (t) {
-            if (t->wakeup_time && (t->wakeup_time < jiffies)) {
-                t->wakeup_time = 0;
-                task_ready(t);
-            }
-            t = t->next;
+        stack_scan_step();
+        stack_report_update();
+#ifdef BENCH
+        bench_report_poll();
+        if (!tasks_idle()) {
+            /* Give the CPU back to the benchmark tasks now, rather
+             * than at the next tick: the kernel is in the round-robin.
+             */
+            schedule();
+            continue;
+        }
+#endif
+        IRQ_DISABLE();
+        if (tasks_idle()) {
+            /* Nothing to run: skip the periodic ticks until the
+             * next deadline, if any.
+             */
+            if (tasklist_sleeping)
+                systick_tickless_enter(tasklist_sleeping->wakeup_time - jiffies);
+            else
+                systick_tickless_enter(0xFFFFFFFF);
         }
         WFI();
+        systick_tickless_exit();
+        IRQ_ENABLE();
     }
 }
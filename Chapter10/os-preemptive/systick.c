@@ -41,10 +41,129 @@ volatile uint32_t cpu_freq = 120000000;
 volatile unsigned int jiffies = 0;
 
 
+#define SYSTICK_CSR_ENABLE      (1 << 0)
+#define SYSTICK_CSR_COUNTFLAG   (1 << 16)
+#define SYSTICK_MAX_RELOAD      (0x00FFFFFF)
+
+#define SCB_ICSR (*((volatile uint32_t *)0xE000ED04))
+#define SCB_ICSR_PENDSTSET      (1 << 26)
+
+/* Shortest period programmed: leaves time to see the counter reload */
+#define SYSTICK_MIN_CYCLES      (256)
+
+/* The current SysTick period: its reload value, the cycles from the
+ * last millisecond counted in jiffies to its start, and the number of
+ * milliseconds it adds to jiffies when it expires. Each period ends on
+ * a millisecond boundary. 1 ms periods start on one, but the first
+ * period after a tickless wake-up only realigns to the next boundary,
+ * and a tickless period starts in the middle of a millisecond.
+ */
+static uint32_t systick_period_reload;
+static uint32_t systick_period_offset = 0;
+static uint32_t systick_period_ms = 1;
+
 void systick_enable(void)
 {
     SYSTICK_RVR = ((cpu_freq / 1000) - 1);
     SYSTICK_CVR = 0;
+    systick_period_reload = SYSTICK_RVR;
     SYSTICK_CSR |= 0x07;
 }
 
+/* Called from isr_systick: account for the period that just expired.
+ * The next one, already running, is a 1 ms period.
+ * Returns the number of milliseconds added to jiffies.
+ */
+uint32_t systick_tick(void)
+{
+    uint32_t elapsed = systick_period_ms;
+    /* Clear COUNTFLAG: set again, it means a tick not accounted for */
+    (void)SYSTICK_CSR;
+    systick_period_reload = (cpu_freq / 1000) - 1;
+    systick_period_offset = 0;
+    systick_period_ms = 1;
+    jiffies += elapsed;
+    return elapsed;
+}
+
+/* Cycles since the last millisecond counted in jiffies. The counter
+ * must be stopped. A period lasts RVR + 1 cycles: the reload from RVR
+ * is one of them.
+ */
+static uint32_t systick_since_last_ms(void)
+{
+    return systick_period_offset + (systick_period_reload + 1 - SYSTICK_CVR);
+}
+
+/* Start a period of 'cycles' now, and re-enable the counter. The
+ * counter loads RVR at its first clock: once CVR reads back non-zero,
+ * RVR already holds the 1 ms reload for the periods that follow.
+ */
+static void systick_period_start(uint32_t csr, uint32_t cycles,
+        uint32_t offset, uint32_t ms)
+{
+    SYSTICK_RVR = cycles - 1;
+    SYSTICK_CVR = 0;
+    SYSTICK_CSR = csr | SYSTICK_CSR_ENABLE;
+    while (SYSTICK_CVR == 0)
+        ;
+    SYSTICK_RVR = (cpu_freq / 1000) - 1;
+    systick_period_reload = cycles - 1;
+    systick_period_offset = offset;
+    systick_period_ms = ms;
+}
+
+/* Stretch the current SysTick period so that the next interrupt fires
+ * 'ms' milliseconds after the last tick. Must be called with interrupts
+ * disabled, right before WFI.
+ */
+void systick_tickless_enter(uint32_t ms)
+{
+    uint32_t cycles_per_ms = cpu_freq / 1000;
+    uint32_t max_ms = (SYSTICK_MAX_RELOAD + 1) / cycles_per_ms;
+    uint32_t csr, elapsed;
+
+    if (ms > max_ms)
+        ms = max_ms;
+    if (ms < 2)
+        return;
+    /* Reading CSR clears COUNTFLAG: sample it once */
+    csr = SYSTICK_CSR;
+    SYSTICK_CSR = csr & ~SYSTICK_CSR_ENABLE;
+    elapsed = systick_since_last_ms();
+    if ((csr & SYSTICK_CSR_COUNTFLAG) || (SCB_ICSR & SCB_ICSR_PENDSTSET) ||
+            (elapsed + SYSTICK_MIN_CYCLES > ms * cycles_per_ms)) {
+        /* A tick is already due, or too close: do not stretch */
+        SYSTICK_CSR = csr | SYSTICK_CSR_ENABLE;
+        return;
+    }
+    systick_period_start(csr, ms * cycles_per_ms - elapsed, elapsed, ms);
+}
+
+/* Called with interrupts disabled after waking up from WFI.
+ * If the wake-up source was not SysTick, correct jiffies with the
+ * time spent sleeping, and realign the ticks to the millisecond.
+ */
+void systick_tickless_exit(void)
+{
+    uint32_t cycles_per_ms = cpu_freq / 1000;
+    uint32_t csr, elapsed, offset, ms = 1;
+
+    if (systick_period_ms == 1)
+        return;
+    csr = SYSTICK_CSR;
+    SYSTICK_CSR = csr & ~SYSTICK_CSR_ENABLE;
+    if ((csr & SYSTICK_CSR_COUNTFLAG) ||
+            (SCB_ICSR & SCB_ICSR_PENDSTSET)) {
+        /* Period expired: isr_systick will account for it */
+        SYSTICK_CSR = csr | SYSTICK_CSR_ENABLE;
+        return;
+    }
+    elapsed = systick_since_last_ms();
+    jiffies += elapsed / cycles_per_ms;
+    /* Keep the phase: next tick fires at the end of the current ms */
+    offset = elapsed % cycles_per_ms;
+    if (cycles_per_ms - offset < SYSTICK_MIN_CYCLES)
+        ms = 2;
+    systick_period_start(csr, ms * cycles_per_ms - offset, offset, ms);
+}
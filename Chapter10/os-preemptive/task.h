@@ -0,0 +1,54 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef TASK_H_INCLUDED
+#define TASK_H_INCLUDED
+#include <stdint.h>
+
+/* Stack usage of task 'id', from the watermark that the idle loop
+ * finds in its painted stack: peak usage since the task started, and
+ * margin never used, in bytes. Returns -1 if there is no such task.
+ */
+int task_stack_usage(int id, uint32_t *peak, uint32_t *margin);
+
+/* Stack report, refreshed by the idle loop about once per second.
+ * Indexed by task id (0 is the kernel, not painted). Read it from gdb
+ * with 'p stack_report'. stack_report_low counts the tasks with less
+ * than STACK_MARGIN_LOW bytes of margin.
+ */
+#define STACK_MARGIN_LOW (64)
+struct stack_report {
+    const char *name;
+    uint32_t peak;
+    uint32_t margin;
+};
+extern struct stack_report stack_report[];
+extern volatile uint32_t stack_report_low;
+
+#endif
@@ -31,6 +31,7 @@
 #define BUTTON_H_INCLUDED
 void button_setup(void (*callback)(void));
 void button_start_read(void);
+void button_sw_trigger(void);
 int button_is_pressed(void);
 
 #endif
@@ -29,6 +29,8 @@
  */
 #include <stdint.h>
 #include "system.h"
+#include "syscall.h"
+#include "led.h"
 
 void led_setup(void)
 {
@@ -102,3 +104,21 @@ void green_led_toggle(void)
     else
         green_led_on();
 }
+
+static void (*const led_ops[3][3])(void) = {
+    [LED_RED]   = { red_led_on, red_led_off, red_led_toggle },
+    [LED_GREEN] = { green_led_on, green_led_off, green_led_toggle },
+    [LED_BLUE]  = { blue_led_on, blue_led_off, blue_led_toggle },
+};
+
+static int led_ioctl(uint32_t req, uint32_t led)
+{
+    if ((req > LED_TOGGLE) || (led > LED_BLUE))
+        return -1;
+    led_ops[led][req]();
+    return 0;
+}
+
+const struct dev_ops led_dev_ops = {
+    .ioctl = led_ioctl,
+};
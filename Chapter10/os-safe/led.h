@@ -29,7 +29,7 @@
  */
 #ifndef GPIO_H_INCLUDED
 #define GPIO_H_INCLUDED
-int led_setup(void);
+void led_setup(void);
 void blue_led_on(void);
 void blue_led_off(void);
 void blue_led_toggle(void);
@@ -39,4 +39,13 @@ void red_led_toggle(void);
 void green_led_on(void);
 void green_led_off(void);
 void green_led_toggle(void);
+
+/* LED device (DEV_LED): ioctl(request, led) */
+#define LED_ON      0
+#define LED_OFF     1
+#define LED_TOGGLE  2
+#define LED_RED     0
+#define LED_GREEN   1
+#define LED_BLUE    2
+extern const struct dev_ops led_dev_ops;
 #endif
@@ -34,10 +34,15 @@
 #include "timer.h"
 #include "led.h"
 #include "button.h"
+#include "task.h"
 #include "locks.h"
 #include "mpu.h"
+#include "syscall.h"
+#ifdef BENCH
+#include "bench.h"
+#endif
 
-mutex m;
+mutex m TASK_SHARED;
 
 
 #define TASK_WAITING 0
@@ -54,6 +59,15 @@ struct task_block {
     uint32_t wakeup_time;
     uint8_t priority;
     struct task_block *next;
+    struct task_block *sleep_next;
+    uint8_t *data;            /* Private block, TASK_DATA_SIZE bytes */
+    uint8_t *heap_start;
+    uint8_t *heap_brk;
+    uint8_t *heap_end;
+    uint32_t mpu_regs[2 * MPU_TASK_REGIONS];
+    uint32_t *stack_bottom;
+    uint32_t stack_words;
+    uint32_t stack_free;      /* Never used words, at the bottom */
 };
 
 #define MAX_TASKS 16
@@ -62,22 +76,57 @@ static struct task_block TASKS[MAX_TASKS];
 #define kernel TASKS[0]
 static int n_tasks = 1;
 static struct task_block *t_cur = &TASKS[0];
-extern uint32_t stack_space;
-#define STACK_SIZE (256)
-
-
-/* System calls */
-#define SYS_SCHEDULE 0
-#define SYS_BUTTON_READ 1
-#define SYS_BLUELED_ON 2
-#define SYS_BLUELED_OFF 3
-#define SYS_BLUELED_TOGGLE 4
-#define SYS_REDLED_ON 5
-#define SYS_REDLED_OFF 6
-#define SYS_REDLED_TOGGLE 7
-#define SYS_GREENLED_ON 8
-#define SYS_GREENLED_OFF 9
-#define SYS_GREENLED_TOGGLE 10
+
+/* Task stacks are carved from the .task_stacks area (target.ld), in
+ * blocks of STACK_BLOCK bytes, tracked by stack_map. Each stack is
+ * also an MPU region: its size is rounded up to a power of two, and
+ * it starts at a multiple of its size.
+ */
+extern uint8_t _start_task_stacks, _end_task_stacks;
+#define STACK_BLOCK      (256)
+#define STACK_MAX_BLOCKS (128)
+static uint32_t stack_map[STACK_MAX_BLOCKS / 32];
+
+#define stack_block_used(b) (stack_map[(b) >> 5] & (1UL << ((b) & 0x1F)))
+#define stack_block_take(b) (stack_map[(b) >> 5] |= (1UL << ((b) & 0x1F)))
+
+static uint32_t stack_round(uint32_t size)
+{
+    uint32_t r = STACK_BLOCK;
+    while ((r < size) && (r != 0))
+        r <<= 1;
+    return r;
+}
+
+static uint32_t *stack_alloc(uint32_t size)
+{
+    uint32_t n_blocks = (&_end_task_stacks - &_start_task_stacks) / STACK_BLOCK;
+    uint32_t need = size / STACK_BLOCK;
+    uint32_t b, i;
+
+    if ((need == 0) || (need > n_blocks))
+        return NULL;
+    if (n_blocks > STACK_MAX_BLOCKS)
+        n_blocks = STACK_MAX_BLOCKS;
+    /* First free run of blocks, aligned to its size */
+    for (b = 0; b + need <= n_blocks; b += need) {
+        for (i = 0; i < need; i++) {
+            if (stack_block_used(b + i))
+                break;
+        }
+        if (i == need) {
+            for (i = 0; i < need; i++)
+                stack_block_take(b + i);
+            return (uint32_t *)(&_start_task_stacks + b * STACK_BLOCK);
+        }
+    }
+    return NULL;
+}
+extern uint8_t _start_task_heaps, _end_task_heaps, _task_heap_size;
+#define TASK_HEAP_SIZE ((uint32_t)&_task_heap_size)
+extern uint8_t _start_task_data, _end_task_data, _task_data_size;
+#define TASK_DATA_SIZE ((uint32_t)&_task_data_size)
+
 
 #define SCB_ICSR (*((volatile uint32_t *)0xE000ED04))
 #define schedule()  SCB_ICSR |= (1 << 28)
@@ -152,18 +201,71 @@ static void task_ready(struct task_block *t)
     }
 }
 
-static int syscall(int arg0)
+/* Sleeping tasks, sorted by wakeup_time (earliest first) */
+struct task_block *tasklist_sleeping = NULL;
+
+/* Wrap-safe comparison between jiffies values */
+#define time_before(a, b) ((int32_t)((a) - (b)) < 0)
+
+static void sleeplist_add(struct task_block *t)
 {
-    SVC();
-    return 0;
+    struct task_block **p = &tasklist_sleeping;
+    while (*p && !time_before(t->wakeup_time, (*p)->wakeup_time))
+        p = &(*p)->sleep_next;
+    t->sleep_next = *p;
+    *p = t;
 }
 
+/* Wake up all the tasks whose deadline has expired.
+ * Only the head of the sorted list is checked on each tick.
+ */
+static int sleeplist_expire(void)
+{
+    int woken = 0;
+    struct task_block *t;
+    while ((t = tasklist_sleeping) != NULL) {
+        if (time_before(jiffies, t->wakeup_time))
+            break;
+        tasklist_sleeping = t->sleep_next;
+        t->sleep_next = NULL;
+        t->wakeup_time = 0;
+        task_ready(t);
+        woken++;
+    }
+    return woken;
+}
 
-/* Mutex/semaphore */
-int sem_wait(semaphore *s)
+/* True when the kernel is the only task that can run */
+static int tasks_idle(void)
 {
     int i;
-    if (s == NULL)
+    if ((tasklist_active[0] != &kernel) || (kernel.next != NULL))
+        return 0;
+    for (i = 1; i < MAX_PRIO; i++) {
+        if (tasklist_active[i])
+            return 0;
+    }
+    return 1;
+}
+
+int task_access_ok(const void *buf, uint32_t len, int write)
+{
+    if (t_cur->id == 0)
+        return 1;
+    return mpu_task_access_ok(t_cur->mpu_regs, (uint32_t)buf, len, write);
+}
+
+
+/* Mutex/semaphore.
+ * The task lists are kernel only: waiting and waking up go through
+ * system calls. The semaphore must be writable by the caller, usually
+ * a TASK_SHARED variable.
+ */
+static int sys_sem_wait(uint32_t arg, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    semaphore *s = (semaphore *)arg;
+    int i;
+    if ((s == NULL) || !task_access_ok(s, sizeof(*s), 1))
         return -1;
     if (sem_trywait(s) == 0)
         return 0;
@@ -173,34 +275,50 @@ int sem_wait(semaphore *s)
         if (s->listeners[i] == t_cur->id)
             break;
     }
-    task_waiting(t_cur);
-    syscall(SYS_SCHEDULE);
-    return sem_wait(s);
+    /* No free slot: just yield, and try again */
+    if (i < MAX_LISTENERS)
+        task_waiting(t_cur);
+    return 1;
 }
 
-int sem_post(semaphore *s)
+static int sys_sem_post(uint32_t arg, uint32_t a1, uint32_t a2, uint32_t a3)
 {
+    semaphore *s = (semaphore *)arg;
     int i;
-    if (s == NULL)
+    if ((s == NULL) || !task_access_ok(s, sizeof(*s), 1))
         return -1;
     if (sem_dopost(s) > 0) {
         for (i = 0; i < MAX_LISTENERS; i++) {
-            if (s->listeners[i]) {
+            /* Task ids come from task memory: check them */
+            if (s->listeners[i] && (s->listeners[i] < n_tasks))
                 task_ready(&TASKS[s->listeners[i]]);
-                s->listeners[i] = 0;
-            }
+            s->listeners[i] = 0;
         }
-        syscall(SYS_SCHEDULE);
     }
     return 0;
 }
 
+int sem_wait(semaphore *s)
+{
+    int ret;
+    while ((ret = syscall1(SYS_SEM_WAIT, s)) > 0)
+        ;
+    return ret;
+}
+
+int sem_post(semaphore *s)
+{
+    return syscall1(SYS_SEM_POST, s);
+}
+
 #define mutex_lock(x) sem_wait(x)
 #define mutex_unlock(x) sem_post(x)
 
 void isr_systick(void)
 {
-    if ((++jiffies % TIMESLICE) == 0)
+    uint32_t elapsed = systick_tick();
+    if ((sleeplist_expire() > 0) || (elapsed > 1) ||
+            ((jiffies % TIMESLICE) == 0))
         schedule();
 }
 
@@ -209,6 +327,9 @@ struct stack_frame {
 };
 
 struct extra_frame {
+#ifdef KERNEL_FPU
+    uint32_t exc_return;
+#endif
     uint32_t r4, r5, r6, r7, r8, r9, r10, r11;
 };
 
@@ -227,16 +348,149 @@ static void task_stack_init(struct task_block *t)
     tf->lr = (uint32_t) task_terminated;
     tf->xpsr =  (1 << 24);
     t->sp -= sizeof(struct extra_frame);
+#ifdef KERNEL_FPU
+    /* Thread mode, PSP, no FP context yet */
+    ((struct extra_frame *)(t->sp))->exc_return = 0xFFFFFFFD;
+#endif
+}
+
+/* Each task owns a fixed arena of TASK_HEAP_SIZE bytes. The MPU only
+ * opens the arena of the running task, so a task writing past its
+ * own heap faults instead of corrupting the others.
+ */
+static void task_heap_init(struct task_block *t)
+{
+    t->heap_start = &_start_task_heaps + t->id * TASK_HEAP_SIZE;
+    t->heap_end = t->heap_start + TASK_HEAP_SIZE;
+    if (t->heap_end > &_end_task_heaps)
+        t->heap_start = t->heap_end = &_end_task_heaps;
+    t->heap_brk = t->heap_start;
+}
+
+/* Private data block of each task, next to its stack and heap */
+static void task_data_init(struct task_block *t)
+{
+    uint32_t i;
+    t->data = &_start_task_data + t->id * TASK_DATA_SIZE;
+    if (t->data + TASK_DATA_SIZE > &_end_task_data) {
+        t->data = NULL;
+        return;
+    }
+    for (i = 0; i < TASK_DATA_SIZE; i++)
+        t->data[i] = 0;
+}
+
+/* Move the heap break of the running task. Returns the previous break,
+ * or (void *)-1 (ENOMEM) if the request does not fit in the arena.
+ */
+static void *task_sbrk(int incr)
+{
+    struct task_block *t = t_cur;
+    uint8_t *old_brk = t->heap_brk;
+
+    incr = (incr + 3) & ~3;
+    if ((incr > t->heap_end - old_brk) || (incr < t->heap_start - old_brk))
+        return (void *)-1;
+    t->heap_brk += incr;
+    return old_brk;
+}
+
+/* Stack usage profiling.
+ *
+ * Task stacks are painted with STACK_PAINT at creation. In idle time the
+ * kernel checks a few words at a time, from the bottom of each stack up,
+ * looking for the lowest word that has been overwritten. Usage can only
+ * grow, so each pass stops at the watermark found by the previous one.
+ */
+#define STACK_PAINT      (0xDEADC0DE)
+#define STACK_SCAN_WORDS (16)
+
+static void task_stack_paint(struct task_block *t)
+{
+    uint32_t i;
+    for (i = 0; i < t->stack_words; i++)
+        t->stack_bottom[i] = STACK_PAINT;
+    t->stack_free = t->stack_words;
 }
 
+static int scan_id = 1;
+static uint32_t scan_pos = 0;
 
-struct task_block *task_create(char *name, void (*start)(void *arg), void *arg, int prio)
+static void stack_scan_step(void)
 {
     struct task_block *t;
     int i;
 
+    if (scan_id >= n_tasks) {
+        if (n_tasks < 2)
+            return;
+        scan_id = 1;
+    }
+    t = &TASKS[scan_id];
+    for (i = 0; i < STACK_SCAN_WORDS; i++) {
+        if (scan_pos >= t->stack_free)
+            break;
+        if (t->stack_bottom[scan_pos] != STACK_PAINT) {
+            t->stack_free = scan_pos;
+            break;
+        }
+        scan_pos++;
+    }
+    if (i < STACK_SCAN_WORDS) {
+        /* Done with this task */
+        scan_pos = 0;
+        scan_id++;
+    }
+}
+
+/* Peak stack usage of a task, and the margin left, in bytes. The
+ * tasks call task_stack_usage() instead, a system call.
+ */
+static int stack_usage(int id, uint32_t *peak, uint32_t *margin)
+{
+    if ((id < 1) || (id >= n_tasks))
+        return -1;
+    *peak = (TASKS[id].stack_words - TASKS[id].stack_free) * sizeof(uint32_t);
+    *margin = TASKS[id].stack_free * sizeof(uint32_t);
+    return 0;
+}
+
+/* Stack report (task.h), refreshed from the idle loop */
+#define STACK_REPORT_MS  (1000)
+struct stack_report stack_report[MAX_TASKS];
+volatile uint32_t stack_report_low = 0;
+static uint32_t stack_report_time = 0;
+
+static void stack_report_update(void)
+{
+    uint32_t low = 0;
+    int i;
+
+    if ((jiffies - stack_report_time) < STACK_REPORT_MS)
+        return;
+    stack_report_time = jiffies;
+    for (i = 1; i < n_tasks; i++) {
+        stack_report[i].name = TASKS[i].name;
+        stack_usage(i, &stack_report[i].peak, &stack_report[i].margin);
+        if (stack_report[i].margin < STACK_MARGIN_LOW)
+            low++;
+    }
+    stack_report_low = low;
+}
+
+struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
+        int prio, uint32_t stack_size)
+{
+    struct task_block *t;
+    int i;
+    uint32_t *stack;
+
     if (n_tasks >= MAX_TASKS)
         return NULL;
+    stack_size = stack_round(stack_size);
+    stack = stack_alloc(stack_size);
+    if (stack == NULL)
+        return NULL;
     t = &TASKS[n_tasks];
     t->id = n_tasks++;
     for (i = 0; i < TASK_NAME_MAXLEN; i++) {
@@ -249,32 +503,134 @@ struct task_block *task_create(char *name, void (*start)(void *arg), void *arg,
     t->arg = arg;
     t->wakeup_time = 0;
     t->priority = prio;
-    t->sp = (uint8_t *)((&stack_space) + n_tasks * STACK_SIZE); 
+    t->stack_bottom = stack;
+    t->stack_words = stack_size / sizeof(uint32_t);
+    t->sp = (uint8_t *)(stack + t->stack_words);
+    task_stack_paint(t);
     task_stack_init(t);
+    task_data_init(t);
+    task_heap_init(t);
+    mpu_task_regions_init(t->mpu_regs, t->stack_bottom, stack_size,
+            t->data, t->data ? TASK_DATA_SIZE : 0,
+            t->heap_start, t->heap_end - t->heap_start);
     tasklist_add_active(t);
     return t;
 }
 
-void sleep_ms(int ms)
+/* Shared memory: let task 't' access a buffer it does not own, e.g. a
+ * block in the heap of another task, to hand it over without copying.
+ * Takes effect the next time 't' is scheduled.
+ */
+int task_mem_grant(struct task_block *t, void *buf, uint32_t size, int access)
+{
+    int ret;
+    if ((t == NULL) || (t->id == 0))
+        return -1;
+    IRQ_DISABLE();
+    ret = mpu_task_grant(t->mpu_regs, buf, size, access);
+    IRQ_ENABLE();
+    return ret;
+}
+
+int task_mem_revoke(struct task_block *t, void *buf)
+{
+    int ret;
+    if ((t == NULL) || (t->id == 0))
+        return -1;
+    IRQ_DISABLE();
+    ret = mpu_task_revoke(t->mpu_regs, buf);
+    IRQ_ENABLE();
+    return ret;
+}
+
+/* Kernel side of the system calls, run in handler mode by
+ * svc_dispatch() with the arguments of the caller.
+ */
+static int sys_schedule(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return 0;
+}
+
+static int sys_sleep(uint32_t ms, uint32_t a1, uint32_t a2, uint32_t a3)
 {
-    if (ms < 2)
-        return;
     t_cur->wakeup_time = jiffies + ms;
+    sleeplist_add(t_cur);
     task_waiting(t_cur);
-    syscall(SYS_SCHEDULE);
+    return 0;
 }
 
 struct task_block *button_task = NULL;
-int button_read(void)
+static int sys_button_read(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
 {
     if (button_task)
         return 0;
     button_task = t_cur;
     task_waiting(t_cur);
-    syscall(SYS_BUTTON_READ);
+    button_start_read();
     return 1;
 }
 
+static int sys_sbrk(uint32_t incr, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return (int)task_sbrk((int)incr);
+}
+
+static int sys_task_data(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return (int)t_cur->data;
+}
+
+static int sys_jiffies(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return (int)jiffies;
+}
+
+static int sys_stack_usage(uint32_t id, uint32_t peak, uint32_t margin, uint32_t a3)
+{
+    uint32_t *p = (uint32_t *)peak, *m = (uint32_t *)margin;
+    if (!task_access_ok(p, sizeof(*p), 1) || !task_access_ok(m, sizeof(*m), 1))
+        return -1;
+    return stack_usage((int)id, p, m);
+}
+
+/* Task side of the heap: what malloc() calls to grow its pool */
+void *_sbrk(int incr)
+{
+    return (void *)syscall1(SYS_SBRK, incr);
+}
+
+/* Private data block of the calling task (TASK_DATA_SIZE bytes), or
+ * NULL if there is none.
+ */
+void *task_data(void)
+{
+    return (void *)syscall0(SYS_TASK_DATA);
+}
+
+/* Task side of the stack report (task.h) */
+int task_stack_usage(int id, uint32_t *peak, uint32_t *margin)
+{
+    return syscall(SYS_STACK_USAGE, id, peak, margin, 0);
+}
+
+/* The kernel tick counter, which the tasks cannot read directly */
+unsigned int task_jiffies(void)
+{
+    return (unsigned int)syscall0(SYS_JIFFIES);
+}
+
+void sleep_ms(int ms)
+{
+    if (ms < 2)
+        return;
+    syscall1(SYS_SLEEP, ms);
+}
+
+int button_read(void)
+{
+    return syscall0(SYS_BUTTON_READ);
+}
+
 void button_wakeup(void)
 {
     if (button_task) {
@@ -284,13 +640,78 @@ void button_wakeup(void)
     }
 }
 
+#ifdef BENCH
+/* Kernel side of the benchmark scenarios (../bench). Tasks cannot
+ * read the DWT or SysTick registers, nor trigger the EXTI line: both
+ * go through system calls.
+ */
+static mutex bench_m TASK_SHARED;
+
+static int sys_bench_clock(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return (int)bench_clock();
+}
+
+static int sys_bench_irq(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    bench_t0 = bench_clock();
+    button_sw_trigger();
+    return 0;
+}
+
+static int sys_bench_armed(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    return button_task != NULL;
+}
+
+uint32_t bench_now(void)
+{
+    return (uint32_t)syscall0(SYS_BENCH_CLOCK);
+}
+
+void bench_yield(void)
+{
+    syscall0(SYS_SCHEDULE);
+}
+
+void bench_idle(void)
+{
+    sleep_ms(1000);
+}
+
+void bench_lock(void)
+{
+    mutex_lock(&bench_m);
+}
+
+void bench_unlock(void)
+{
+    mutex_unlock(&bench_m);
+}
+
+void bench_irq_trigger(void)
+{
+    syscall0(SYS_BENCH_IRQ);
+}
+
+int bench_irq_wait(void)
+{
+    return button_read();
+}
+
+int bench_irq_armed(void)
+{
+    return syscall0(SYS_BENCH_ARMED);
+}
+#endif
+
 void task_test0(void *arg)
 {
     while(1) {
-        syscall(SYS_BLUELED_ON);
+        sys_ioctl(DEV_LED, LED_ON, LED_BLUE);
         mutex_lock(&m);
         sleep_ms(500);
-        syscall(SYS_BLUELED_OFF);
+        sys_ioctl(DEV_LED, LED_OFF, LED_BLUE);
         mutex_unlock(&m);
         sleep_ms(1000);
     }
@@ -298,28 +719,80 @@ void task_test0(void *arg)
 
 void task_test1(void *arg)
 {
-    syscall(SYS_REDLED_ON);
+    sys_ioctl(DEV_LED, LED_ON, LED_RED);
     while(1) {
         sleep_ms(50);
         mutex_lock(&m);
-        syscall(SYS_REDLED_TOGGLE);
+        sys_ioctl(DEV_LED, LED_TOGGLE, LED_RED);
         mutex_unlock(&m);
     }
 }
 
 void task_test2(void *arg)
 {
-    uint32_t toggle_time = 0;
-    syscall(SYS_GREENLED_OFF);
+    /* Kept in the private data block of the task */
+    uint32_t *toggle_time = task_data();
+    sys_ioctl(DEV_LED, LED_OFF, LED_GREEN);
     while(1) {
         button_read();
-        if ((jiffies - toggle_time) > 120) {
-            syscall(SYS_GREENLED_TOGGLE);
-            toggle_time = jiffies;
+        if ((task_jiffies() - *toggle_time) > 120) {
+            sys_ioctl(DEV_LED, LED_TOGGLE, LED_GREEN);
+            *toggle_time = task_jiffies();
         }
     }
 }
 
+#ifdef KERNEL_FPU
+/* Software part of the task frame: EXC_RETURN, passed in r1, then
+ * r4-r11, then s16-s31 only when the task has an FP context
+ * (EXC_RETURN bit 4 clear). s0-s15 and FPSCR are in the hardware
+ * frame, saved lazily by the FPU when the handler touches the FPU.
+ * restore_*_context() return the EXC_RETURN of the next task in r1.
+ */
+static void __attribute__((naked)) store_kernel_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vstmdbeq r0!, {s16-s31}");
+    asm volatile("stmdb r0!, {r1, r4-r11}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+
+static void __attribute__((naked)) restore_kernel_context(void)
+{
+    asm volatile("mrs r0, msp");
+    asm volatile("ldmia r0!, {r1, r4-r11}");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vldmiaeq r0!, {s16-s31}");
+    asm volatile("msr msp, r0");
+    asm volatile("bx lr");
+}
+
+static void __attribute__((naked)) store_user_context(void)
+{
+    asm volatile("mrs r0, psp");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vstmdbeq r0!, {s16-s31}");
+    asm volatile("stmdb r0!, {r1, r4-r11}");
+    asm volatile("msr psp, r0");
+    asm volatile("bx lr");
+}
+
+static void __attribute__((naked)) restore_user_context(void)
+{
+    asm volatile("mrs r0, psp");
+    asm volatile("ldmia r0!, {r1, r4-r11}");
+    asm volatile("tst r1, #0x10\n"
+                 "it eq\n"
+                 "vldmiaeq r0!, {s16-s31}");
+    asm volatile("msr psp, r0");
+    asm volatile("bx lr");
+}
+#else
 static void __attribute__((naked)) store_kernel_context(void)
 {
     asm volatile("mrs r0, msp");
@@ -351,14 +824,24 @@ static void __attribute__((naked)) restore_user_context(void)
     asm volatile("msr psp, r0");
     asm volatile("bx lr");
 }
+#endif
 
 
 void __attribute__((naked)) isr_pendsv(void)
 {
+#ifdef BENCH
+    BENCH_PENDSV_ENTER();
+#endif
     if (t_cur->id == 0) {
+#ifdef KERNEL_FPU
+        asm volatile("mov r1, lr");
+#endif
         store_kernel_context();
         asm volatile("mrs %0, msp" : "=r"(t_cur->sp));
     } else {
+#ifdef KERNEL_FPU
+        asm volatile("mov r1, lr");
+#endif
         store_user_context();
         asm volatile("mrs %0, psp" : "=r"(t_cur->sp));
     }
@@ -367,85 +850,55 @@ void __attribute__((naked)) isr_pendsv(void)
     }
     t_cur = tasklist_next_ready(t_cur);
     t_cur->state = TASK_RUNNING;
+    /* r1 holds the EXC_RETURN of the next task (KERNEL_FPU) until the
+     * end: the MPU is programmed first, and CONTROL is written from
+     * another register.
+     */
     if (t_cur->id == 0) {
         asm volatile("msr msp, %0" ::"r"(t_cur->sp));
         restore_kernel_context();
+#ifndef KERNEL_FPU
         asm volatile("mov lr, %0" ::"r"(0xFFFFFFF9));
-        asm volatile("msr CONTROL, %0" ::"r"(0x00));
-    } else {
-        asm volatile("msr psp, %0" ::"r"(t_cur->sp));
-        restore_user_context();
-        mpu_task_stack_permit(((uint8_t *)((&stack_space)) + (t_cur->id << 10)));
-        asm volatile("mov lr, %0" ::"r"(0xFFFFFFFD));
-        asm volatile("msr CONTROL, %0" ::"r"(0x01));
-    }
-    asm volatile("bx lr");
-}
-
-void __attribute__((naked)) isr_svc(int arg)
-{
-    store_user_context();
-    asm volatile("mrs %0, psp" : "=r"(t_cur->sp));
-    if (t_cur->state == TASK_RUNNING) {
-        t_cur->state = TASK_READY;
-    }
-    switch(arg) {
-        case SYS_BUTTON_READ:
-            button_start_read();
-            /* fall through */
-        case SYS_SCHEDULE:
-            t_cur = tasklist_next_ready(t_cur);
-            t_cur->state = TASK_RUNNING;
-            break;
-        case SYS_BLUELED_ON:
-            blue_led_on();
-            break;
-        case SYS_BLUELED_OFF:
-            blue_led_off();
-            break;
-        case SYS_BLUELED_TOGGLE:
-            blue_led_toggle();
-            break;
-        case SYS_GREENLED_ON:
-            green_led_on();
-            break;
-        case SYS_GREENLED_OFF:
-            green_led_off();
-            break;
-        case SYS_GREENLED_TOGGLE:
-            green_led_toggle();
-            break;
-        case SYS_REDLED_ON:
-            red_led_on();
-            break;
-        case SYS_REDLED_OFF:
-            red_led_off();
-            break;
-        case SYS_REDLED_TOGGLE:
-            red_led_toggle();
-            break;
-    }
-    if (t_cur->id == 0) {
-        asm volatile("msr msp, %0" ::"r"(t_cur->sp));
-        restore_kernel_context();
-        asm volatile("mov lr, %0" ::"r"(0xFFFFFFF9));
-        asm volatile("msr CONTROL, %0" ::"r"(0x00));
+#endif
+        asm volatile("msr CONTROL, %0" ::"r"(0x00) : "r1");
     } else {
         asm volatile("msr psp, %0" ::"r"(t_cur->sp));
+        mpu_task_switch(t_cur->mpu_regs);
         restore_user_context();
-        mpu_task_stack_permit(((uint8_t *)((&stack_space)) + (t_cur->id << 10)));
+#ifndef KERNEL_FPU
         asm volatile("mov lr, %0" ::"r"(0xFFFFFFFD));
-        asm volatile("msr CONTROL, %0" ::"r"(0x01));
+#endif
+        asm volatile("msr CONTROL, %0" ::"r"(0x01) : "r1");
     }
+#ifdef KERNEL_FPU
+    asm volatile("mov lr, r1");
+#endif
+#ifdef BENCH
+    BENCH_PENDSV_EXIT();
+#endif
     asm volatile("bx lr");
-    
 }
 
-
 void main(void) {
     clock_pll_on(0);
     led_setup();
     mpu_enable();
+    syscall_init();
+    syscall_register(SYS_SCHEDULE, sys_schedule, SYSCALL_RESCHEDULE);
+    syscall_register(SYS_SLEEP, sys_sleep, SYSCALL_RESCHEDULE);
+    syscall_register(SYS_BUTTON_READ, sys_button_read, SYSCALL_RESCHEDULE);
+    syscall_register(SYS_SBRK, sys_sbrk, 0);
+    syscall_register(SYS_SEM_WAIT, sys_sem_wait, SYSCALL_RESCHEDULE);
+    syscall_register(SYS_SEM_POST, sys_sem_post, SYSCALL_RESCHEDULE);
+    syscall_register(SYS_TASK_DATA, sys_task_data, 0);
+    syscall_register(SYS_JIFFIES, sys_jiffies, 0);
+    syscall_register(SYS_STACK_USAGE, sys_stack_usage, 0);
+#ifdef BENCH
+    syscall_register(SYS_BENCH_CLOCK, sys_bench_clock, 0);
+    syscall_register(SYS_BENCH_IRQ, sys_bench_irq, 0);
+    syscall_register(SYS_BENCH_ARMED, sys_bench_armed, 0);
+#endif
+    dev_register(DEV_LED, &led_dev_ops);
     button_setup(button_wakeup);
     systick_enable();
     kernel.name[0] = 0;
@@ -454,9 +907,16 @@ void main(void) {
     kernel.wakeup_time = 0;
     kernel.priority = 0;
     tasklist_add_active(&kernel);
-    task_create("test0",task_test0, NULL, 1);
-    task_create("test1",task_test1, NULL, 1);
-    task_create("test2",task_test2, NULL, 3);
+#ifdef BENCH
+    bench_init();
+    mutex_init(&bench_m);
+    task_create("bench", bench_driver, NULL, 1, 1024);
+    task_create("partner", bench_partner, NULL, 1, 1024);
+#else
+    task_create("test0",task_test0, NULL, 1, 1024);
+    task_create("test1",task_test1, NULL, 1, 512);
+    task_create("test2",task_test2, NULL, 3, 512);
+#endif
     mutex_init(&m);
 
     while(jiffies < 20)
@@ -464,14 +924,23 @@ void main(void) {
 
 
     while(1) {
-        struct task_block *t = tasklist_waiting;
-        while (t) {
-            if (t->wakeup_time && (t->wakeup_time < jiffies)) {
-                t->wakeup_time = 0;
-                task_ready(t);
-            }
-            t = t->next;
+        stack_scan_step();
+        stack_report_update();
+#ifdef BENCH
+        bench_report_poll();
+#endif
+        IRQ_DISABLE();
+        if (tasks_idle()) {
+            /* Nothing to run: skip the periodic ticks until the
+             * next deadline, if any.
+             */
+            if (tasklist_sleeping)
+                systick_tickless_enter(tasklist_sleeping->wakeup_time - jiffies);
+            else
+                systick_tickless_enter(0xFFFFFFFF);
         }
         WFI();
+        systick_tickless_exit();
+        IRQ_ENABLE();
     }
 }
@@ -28,10 +28,12 @@
  * SOFTWARE.
  */
 #include <stdint.h>
+#include <stddef.h>
 #include "system.h"
+#include "mpu.h"
 
 #define MPU_BASE (0xE000ED90)
-extern uint32_t _end_stack;
+extern uint32_t _start_task_shared, _task_shared_size;
 
 /* FAULT enable register SHCSR */
 #define SHCSR (*(volatile uint32_t *)(0xE000ED24))
@@ -46,6 +48,27 @@ extern uint32_t _end_stack;
 #define MPU_RBAR (*(volatile uint32_t *)(MPU_BASE + 0x0c))
 #define MPU_RASR (*(volatile uint32_t *)(MPU_BASE + 0x10))
 
+#define MPU_CTRL_ENABLE     (1 << 0)
+#define MPU_CTRL_PRIVDEFENA (1 << 2)
+
+/* RBAR: region number valid, selects the region written by RASR */
+#define RBAR_VALID      (1 << 4)
+#define RBAR_ADDR_MASK  (0xFFFFFFE0)
+#define MPU_TASK_REGION (3)
+#define MPU_TASK_FIXED  (3)     /* stack, data, heap */
+
+/* Region 0: flash, read-only for the tasks */
+#define FLASH_BASE      (0x00000000)
+#define FLASH_USER_SIZE (256 * 1024)
+
+/* Region 1: SRAM1 and SRAM2, kernel only */
+#define SRAM_BASE       (0x20000000)
+#define SRAM_SIZE       (256 * 1024)
+
+/* Region 2: the .task_shared area (target.ld), open to all the tasks */
+#define SHARED_BASE     ((uint32_t)&_start_task_shared)
+#define SHARED_SIZE     ((uint32_t)&_task_shared_size)
+
 /* Some use-case specific values for RASR */
 #define RASR_ENABLED    (1)
 #define RASR_KERNEL_RW  (1 << 24)
@@ -85,9 +108,6 @@ extern uint32_t _end_stack;
 #define MPUSIZE_2G      (0x1e << 1)
 #define MPUSIZE_4G      (0x1f << 1)
 
-/* Kernel stack */
-#define KERNEL_STACK_SIZE (1024 * 32)
-
 static void mpu_set_region(int region, uint32_t start, uint32_t attr)
 {
     MPU_RNR = region;
@@ -95,14 +115,181 @@ static void mpu_set_region(int region, uint32_t start, uint32_t attr)
     MPU_RASR = attr;
 }
 
-void mpu_task_stack_permit(void *start)
+/* SIZE field of RASR for a power-of-two region of 'size' bytes */
+static uint32_t mpu_size(uint32_t size)
 {
-    uint32_t attr = 
-        RASR_ENABLED | MPUSIZE_1K | RASR_SCB | RASR_USER_RW;
-    MPU_CTRL = 0;
-    DMB();
-    mpu_set_region(3, (uint32_t)start, attr);
-    MPU_CTRL = 1;
+    return (uint32_t)(30 - __builtin_clz(size)) << 1;
+}
+
+#ifdef MPU_SWITCH_STATS
+#define DEMCR       (*(volatile uint32_t *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile uint32_t *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile uint32_t *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+/* Cycles spent in mpu_task_switch() on the way back to a task.
+ * Inspect from gdb with 'p mpu_switch_stats'.
+ */
+struct {
+    uint32_t count;
+    uint32_t skipped;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+} mpu_switch_stats = { 0, 0, 0xFFFFFFFF, 0, 0 };
+#endif
+
+/* Precompute the RBAR/RASR pairs of the task regions, once at task
+ * creation: the stack, the private data and the heap arena unless they
+ * are empty, and no grants.
+ */
+void mpu_task_regions_init(uint32_t *regs, void *stack, uint32_t stack_size,
+        void *data, uint32_t data_size, void *heap, uint32_t heap_size)
+{
+    int i;
+    regs[0] = (uint32_t)stack | RBAR_VALID | MPU_TASK_REGION;
+    regs[1] = RASR_ENABLED | mpu_size(stack_size) | RASR_SCB | RASR_USER_RW;
+    regs[2] = (uint32_t)data | RBAR_VALID | (MPU_TASK_REGION + 1);
+    regs[3] = 0;
+    if (data_size > 0)
+        regs[3] = RASR_ENABLED | mpu_size(data_size) | RASR_SCB |
+            RASR_USER_RW | RASR_NOEXEC;
+    regs[4] = (uint32_t)heap | RBAR_VALID | (MPU_TASK_REGION + 2);
+    regs[5] = 0;
+    if (heap_size > 0)
+        regs[5] = RASR_ENABLED | mpu_size(heap_size) | RASR_SCB |
+            RASR_USER_RW | RASR_NOEXEC;
+    for (i = MPU_TASK_FIXED; i < MPU_TASK_REGIONS; i++) {
+        regs[2 * i] = RBAR_VALID | (MPU_TASK_REGION + i);
+        regs[2 * i + 1] = 0;
+    }
+}
+
+/* Regions currently loaded */
+static const uint32_t *mpu_task_cur;
+
+/* Give a task access to a buffer it does not own. The buffer is a
+ * single region: its size must be a power of two, at least 32 bytes,
+ * and its start a multiple of its size.
+ * Returns the grant slot, or -1.
+ */
+int mpu_task_grant(uint32_t *regs, void *buf, uint32_t size, int access)
+{
+    uint32_t base = (uint32_t)buf;
+    int i;
+
+    if ((size < 32) || ((size & (size - 1)) != 0) || ((base & (size - 1)) != 0))
+        return -1;
+    for (i = MPU_TASK_FIXED; i < MPU_TASK_REGIONS; i++) {
+        if (regs[2 * i + 1] == 0) {
+            regs[2 * i] = base | RBAR_VALID | (MPU_TASK_REGION + i);
+            regs[2 * i + 1] = RASR_ENABLED | mpu_size(size) | RASR_SCB |
+                RASR_NOEXEC | ((access == MPU_GRANT_RW) ? RASR_USER_RW : RASR_USER_RO);
+            mpu_task_cur = NULL;
+            return i - MPU_TASK_FIXED;
+        }
+    }
+    return -1;
+}
+
+/* Remove the grant of the buffer starting at 'buf' */
+int mpu_task_revoke(uint32_t *regs, void *buf)
+{
+    int i;
+    for (i = MPU_TASK_FIXED; i < MPU_TASK_REGIONS; i++) {
+        if ((regs[2 * i + 1] != 0) &&
+                ((regs[2 * i] & RBAR_ADDR_MASK) == (uint32_t)buf)) {
+            regs[2 * i + 1] = 0;
+            mpu_task_cur = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Would the MPU let the task access [start, start + len)?
+ * Used by the kernel to validate buffers passed to system calls.
+ * A buffer must lie entirely within one region.
+ */
+int mpu_task_access_ok(const uint32_t *regs, uint32_t start, uint32_t len,
+        int write)
+{
+    uint32_t end = start + len;
+    uint32_t base, size, ap;
+    int i;
+
+    if (end < start)
+        return 0;
+    /* Higher regions first, as they take priority */
+    for (i = MPU_TASK_REGIONS - 1; i >= 0; i--) {
+        if ((regs[2 * i + 1] & RASR_ENABLED) == 0)
+            continue;
+        base = regs[2 * i] & RBAR_ADDR_MASK;
+        size = 2UL << ((regs[2 * i + 1] >> 1) & 0x1F);
+        if ((start >= base) && (end <= base + size)) {
+            ap = regs[2 * i + 1] & (7 << 24);
+            return (ap == RASR_USER_RW) || (!write && (ap == RASR_USER_RO));
+        }
+    }
+    /* Fixed regions: the shared area, and the flash for reading */
+    if ((start >= SHARED_BASE) && (end <= SHARED_BASE + SHARED_SIZE))
+        return 1;
+    if (!write && (end <= FLASH_BASE + FLASH_USER_SIZE))
+        return 1;
+    return 0;
+}
+
+/* Load the regions of the task about to run */
+void mpu_task_switch(const uint32_t *regs)
+{
+#ifdef MPU_SWITCH_STATS
+    uint32_t start = DWT_CYCCNT, cycles;
+#endif
+#ifdef MPU_NO_REGION_CACHE
+    /* Reference for the stats: one region at a time, MPU disabled */
+    int i;
+    for (i = 0; i < 2 * MPU_TASK_REGIONS; i += 2) {
+        MPU_CTRL = 0;
+        DMB();
+        MPU_RBAR = regs[i];
+        MPU_RASR = regs[i + 1];
+        MPU_CTRL = MPU_CTRL_ENABLE | MPU_CTRL_PRIVDEFENA;
+    }
+#else
+    int i;
+    if (regs == mpu_task_cur) {
+#ifdef MPU_SWITCH_STATS
+        mpu_switch_stats.skipped++;
+#endif
+        return;
+    }
+    /* RBAR, RASR and their aliases RBAR_A1/RASR_A1 are contiguous, so
+     * each STM rewrites two regions. The handler never relies on the
+     * task regions, so the MPU stays enabled.
+     */
+    for (i = 0; i + 1 < MPU_TASK_REGIONS; i += 2) {
+        asm volatile("ldmia %0, {r0-r3}\n"
+                     "stmia %1, {r0-r3}\n"
+                     :: "r"(regs + 2 * i), "r"(&MPU_RBAR)
+                     : "r0", "r1", "r2", "r3", "memory");
+    }
+    if (i < MPU_TASK_REGIONS) {
+        MPU_RBAR = regs[2 * i];
+        MPU_RASR = regs[2 * i + 1];
+    }
+    DSB();
+    mpu_task_cur = regs;
+#endif
+#ifdef MPU_SWITCH_STATS
+    cycles = DWT_CYCCNT - start;
+    mpu_switch_stats.count++;
+    mpu_switch_stats.total += cycles;
+    if (cycles < mpu_switch_stats.min)
+        mpu_switch_stats.min = cycles;
+    if (cycles > mpu_switch_stats.max)
+        mpu_switch_stats.max = cycles;
+#endif
 }
 
 
@@ -111,6 +298,7 @@ int mpu_enable(void)
     volatile uint32_t type;
     volatile uint32_t start;
     volatile uint32_t attr;
+    int i;
 
     type = MPU_TYPE;
     if (type == 0) {
@@ -123,35 +311,42 @@ int mpu_enable(void)
     MPU_CTRL = 0;
 
     /* Set flash area as system-wide read-only, executable */
-    start = 0;
-    attr = RASR_ENABLED | MPUSIZE_256K | RASR_SCB | RASR_RDONLY;
+    start = FLASH_BASE;
+    attr = RASR_ENABLED | mpu_size(FLASH_USER_SIZE) | RASR_SCB | RASR_RDONLY;
     mpu_set_region(0, start, attr);
 
-    /* Set SRAM as read-write, not executable */
-    start = 0x20000000;
-    attr = RASR_ENABLED | MPUSIZE_128K | RASR_SCB | RASR_USER_RW | RASR_NOEXEC;
+    /* SRAM: read-write for the kernel only, not executable. Kernel
+     * state (task blocks, system call table, .data and .bss) is out of
+     * reach of the tasks. The peripherals and the system registers are
+     * not mapped: only the kernel reaches them, via the default memory
+     * map (PRIVDEFENA).
+     */
+    start = SRAM_BASE;
+    attr = RASR_ENABLED | mpu_size(SRAM_SIZE) | RASR_SCB | RASR_KERNEL_RW | RASR_NOEXEC;
     mpu_set_region(1, start, attr);
 
-    /* Reserve SRAM for kernel use */
-    start = (uint32_t)(&_end_stack) - (KERNEL_STACK_SIZE);
-    attr = RASR_ENABLED | MPUSIZE_64K | RASR_SCB | RASR_KERNEL_RW | RASR_NOEXEC;
+    /* Variables shared by all the tasks (TASK_SHARED). Regions 3 to 7
+     * open the stack, data and heap of the running task.
+     */
+    start = SHARED_BASE;
+    attr = RASR_ENABLED | mpu_size(SHARED_SIZE) | RASR_SCB | RASR_USER_RW | RASR_NOEXEC;
     mpu_set_region(2, start, attr);
 
-    /* Peripherals region */
-    start = 0x40000000;
-    attr = RASR_ENABLED | MPUSIZE_1G | RASR_SB | RASR_KERNEL_RW | RASR_NOEXEC;
-    mpu_set_region(4, start, attr);
-
-    /* Set System register area */
-    start = 0xE0000000;
-    attr = RASR_ENABLED | MPUSIZE_256M | RASR_SB | RASR_KERNEL_RW | RASR_NOEXEC;
-    mpu_set_region(5, start, attr);
+    /* Task regions, loaded on context switch */
+    for (i = MPU_TASK_REGION; i < MPU_TASK_REGION + MPU_TASK_REGIONS; i++)
+        mpu_set_region(i, 0, 0);
     
+#ifdef MPU_SWITCH_STATS
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
+
     /* Enable MEMFAULT */
     SHCSR |= MEMFAULT_ENABLE;
 
-    /* Enable the MPU, no background region */
-    MPU_CTRL = 1;
+    /* Enable the MPU, background region for the kernel only */
+    MPU_CTRL = MPU_CTRL_ENABLE | MPU_CTRL_PRIVDEFENA;
     return 0;
 
 }
@@ -30,7 +30,24 @@
 #ifndef MPU_H_INCLUDED
 #define MPU_H_INCLUDED
 
+/* Each task owns MPU regions 3 to 7, kept as precomputed RBAR/RASR
+ * pairs in its task_block: its stack, its private data block, its heap
+ * arena and up to MPU_TASK_GRANTS shared buffers.
+ */
+#define MPU_TASK_REGIONS 5
+#define MPU_TASK_GRANTS  (MPU_TASK_REGIONS - 3)
+
+/* Access to a shared buffer */
+#define MPU_GRANT_RO 0
+#define MPU_GRANT_RW 1
+
 int mpu_enable(void);
-void mpu_task_stack_permit(void *start);
+void mpu_task_regions_init(uint32_t *regs, void *stack, uint32_t stack_size,
+        void *data, uint32_t data_size, void *heap, uint32_t heap_size);
+int mpu_task_grant(uint32_t *regs, void *buf, uint32_t size, int access);
+int mpu_task_revoke(uint32_t *regs, void *buf);
+int mpu_task_access_ok(const uint32_t *regs, uint32_t start, uint32_t len,
+        int write);
+void mpu_task_switch(const uint32_t *regs);
 
 #endif
@@ -0,0 +1,125 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "system.h"
+#include "syscall.h"
+
+#define SCB_ICSR (*((volatile uint32_t *)0xE000ED04))
+#define schedule()  SCB_ICSR |= (1 << 28)
+
+struct svc_frame {
+    uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr;
+};
+
+static struct {
+    syscall_fn fn;
+    uint32_t flags;
+} syscall_table[MAX_SYSCALLS];
+
+static const struct dev_ops *devs[MAX_DEVS];
+
+int syscall_register(int n, syscall_fn fn, uint32_t flags)
+{
+    if ((n < 0) || (n >= MAX_SYSCALLS))
+        return -1;
+    syscall_table[n].fn = fn;
+    syscall_table[n].flags = flags;
+    return 0;
+}
+
+int dev_register(int dev, const struct dev_ops *ops)
+{
+    if ((dev < 0) || (dev >= MAX_DEVS))
+        return -1;
+    devs[dev] = ops;
+    return 0;
+}
+
+static int sys_dev_read(uint32_t dev, uint32_t buf, uint32_t len, uint32_t unused)
+{
+    if ((dev >= MAX_DEVS) || !devs[dev] || !devs[dev]->read)
+        return -1;
+    if (!task_access_ok((void *)buf, len, 1))
+        return -1;
+    return devs[dev]->read((void *)buf, len);
+}
+
+static int sys_dev_write(uint32_t dev, uint32_t buf, uint32_t len, uint32_t unused)
+{
+    if ((dev >= MAX_DEVS) || !devs[dev] || !devs[dev]->write)
+        return -1;
+    if (!task_access_ok((void *)buf, len, 0))
+        return -1;
+    return devs[dev]->write((const void *)buf, len);
+}
+
+static int sys_dev_ioctl(uint32_t dev, uint32_t req, uint32_t arg, uint32_t unused)
+{
+    if ((dev >= MAX_DEVS) || !devs[dev] || !devs[dev]->ioctl)
+        return -1;
+    return devs[dev]->ioctl(req, arg);
+}
+
+void syscall_init(void)
+{
+    syscall_register(SYS_READ, sys_dev_read, 0);
+    syscall_register(SYS_WRITE, sys_dev_write, 0);
+    syscall_register(SYS_IOCTL, sys_dev_ioctl, 0);
+}
+
+/* Called by isr_svc with the frame stacked by the exception entry.
+ * The call number is the immediate of the SVC instruction, just
+ * before the stacked return address. The result replaces r0.
+ */
+void svc_dispatch(struct svc_frame *f)
+{
+    uint8_t n = ((uint8_t *)f->pc)[-2];
+
+    if ((n >= MAX_SYSCALLS) || (syscall_table[n].fn == NULL)) {
+        f->r0 = (uint32_t)-1;
+        return;
+    }
+    f->r0 = (uint32_t)syscall_table[n].fn(f->r0, f->r1, f->r2, f->r3);
+    if (syscall_table[n].flags & SYSCALL_RESCHEDULE)
+        schedule();
+}
+
+/* r4-r11 are not touched here: svc_dispatch is a normal C function,
+ * and any context switch is left to PendSV, which runs right after.
+ */
+void __attribute__((naked)) isr_svc(void)
+{
+    asm volatile("tst lr, #4\n"
+                 "ite eq\n"
+                 "mrseq r0, msp\n"
+                 "mrsne r0, psp\n"
+                 "b svc_dispatch\n");
+}
@@ -0,0 +1,105 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef SYSCALL_H_INCLUDED
+#define SYSCALL_H_INCLUDED
+#include <stdint.h>
+
+/* System call numbers: the immediate of the SVC instruction */
+#define SYS_SCHEDULE     0
+#define SYS_SLEEP        1
+#define SYS_BUTTON_READ  2
+#define SYS_READ         3
+#define SYS_WRITE        4
+#define SYS_IOCTL        5
+#define SYS_SBRK         6
+#define SYS_SEM_WAIT     7
+#define SYS_SEM_POST     8
+#define SYS_TASK_DATA    9
+#define SYS_JIFFIES      10
+#define SYS_STACK_USAGE  11
+/* Benchmark build only (make bench) */
+#define SYS_BENCH_CLOCK  12
+#define SYS_BENCH_IRQ    13
+#define SYS_BENCH_ARMED  14
+#define MAX_SYSCALLS     16
+
+/* The call may block or wake up other tasks: run the scheduler
+ * (PendSV) on the way out. All the other calls return directly to
+ * the caller, without a context switch.
+ */
+#define SYSCALL_RESCHEDULE (1 << 0)
+
+typedef int (*syscall_fn)(uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+void syscall_init(void);
+int syscall_register(int n, syscall_fn fn, uint32_t flags);
+
+/* Tasks can only access their own stack, data and heap, and the
+ * variables marked TASK_SHARED, e.g. the semaphores they use to
+ * synchronize. These are zeroed at startup, and cannot have an
+ * initializer. All the other variables are kernel only.
+ */
+#define TASK_SHARED __attribute__((section(".bss.task_shared")))
+
+/* Task side: arguments in r0-r3, result in r0 */
+#define syscall(n, a0, a1, a2, a3) ({                                   \
+    register uint32_t __r0 asm("r0") = (uint32_t)(a0);                  \
+    register uint32_t __r1 asm("r1") = (uint32_t)(a1);                  \
+    register uint32_t __r2 asm("r2") = (uint32_t)(a2);                  \
+    register uint32_t __r3 asm("r3") = (uint32_t)(a3);                  \
+    asm volatile("svc %[num]" : "+r"(__r0)                              \
+            : "r"(__r1), "r"(__r2), "r"(__r3), [num] "i"(n) : "memory"); \
+    (int)__r0;                                                          \
+})
+#define syscall0(n)           syscall(n, 0, 0, 0, 0)
+#define syscall1(n, a0)       syscall(n, a0, 0, 0, 0)
+
+/* Devices, reached by unprivileged tasks through read/write/ioctl */
+#define DEV_LED   0
+#define MAX_DEVS  4
+
+struct dev_ops {
+    int (*read)(void *buf, uint32_t len);
+    int (*write)(const void *buf, uint32_t len);
+    int (*ioctl)(uint32_t req, uint32_t arg);
+};
+
+int dev_register(int dev, const struct dev_ops *ops);
+
+#define sys_read(dev, buf, len)   syscall(SYS_READ, dev, buf, len, 0)
+#define sys_write(dev, buf, len)  syscall(SYS_WRITE, dev, buf, len, 0)
+#define sys_ioctl(dev, req, arg)  syscall(SYS_IOCTL, dev, req, arg, 0)
+
+/* Provided by the kernel: nonzero if the running task may access
+ * [buf, buf + len), for writing if 'write' is set.
+ */
+int task_access_ok(const void *buf, uint32_t len, int write);
+
+#endif
@@ -179,9 +179,12 @@
 
 /* Assembly helpers */
 #define DMB() __asm__ volatile ("dmb")
+#define DSB() __asm__ volatile ("dsb")
 #define WFI() __asm__ volatile ("wfi")
 #define WFE() __asm__ volatile ("wfe")
 #define SEV() __asm__ volatile ("sev")
+#define IRQ_DISABLE() __asm__ volatile ("cpsid i")
+#define IRQ_ENABLE() __asm__ volatile ("cpsie i")
 #define SVC() __asm__ volatile ("svc 0")
 
 /* Master clock setting */
@@ -29,6 +29,10 @@
  */
 #ifndef SYSTICK_H_INCLUDED
 #define SYSTICK_H_INCLUDED
+#include <stdint.h>
 extern volatile unsigned int jiffies;
 void systick_enable(void);
+uint32_t systick_tick(void);
+void systick_tickless_enter(uint32_t ms);
+void systick_tickless_exit(void);
 #endif
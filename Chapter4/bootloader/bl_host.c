@@ -0,0 +1,271 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+/* Linux build of the update engine (make host), on a file-backed
+ * flash (flash_host.c). Each command is one step in the life of the
+ * device:
+ *
+ *   ./bl-host flash.bin boot              reset: select, install, start
+ *   ./bl-host flash.bin stage app.img     the app receives an update
+ *   ./bl-host flash.bin confirm           the app confirms its image
+ *   ./bl-host flash.bin status
+ *   ./bl-host flash.bin info            the service table descriptor
+ *
+ * and, without a flash file:
+ *
+ *   ./bl-host digest <file>...          CRC32 and SHA-256, in the
+ *                                       formats of crc32 and sha256sum
+ *   ./bl-host bench [MB]                CRC32 and SHA-256 throughput
+ *
+ * e.g. boot after staging v2 without confirming: v2 runs on trial, and
+ * the next boot rolls back to v1.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define BOOTLOADER
+#include "utils.h"
+#include "flash.h"
+#include "update.h"
+#include "crc32.h"
+#include "sha256.h"
+
+#define STAGE_CHUNK (256)
+
+static const char *slot_name(uint32_t slot)
+{
+    if (slot == SLOT_A_ADDR)
+        return "A";
+    if (slot == SLOT_B_ADDR)
+        return "B";
+    return "?";
+}
+
+/* What the bootloader wrote to the shared log */
+static void log_dump(void)
+{
+    const struct utils_log *log = utils_interface.log;
+    uint32_t i = 0;
+
+    if (log->head > log->size)
+        i = log->head - log->size;
+    for (; i < log->head; i++)
+        putchar(log->data[i % log->size]);
+}
+
+static int cmd_boot(void)
+{
+    uint32_t addr = update_boot();
+    uint32_t slot, version;
+
+    log_dump();
+    if (addr == 0) {
+        printf("boot: no image\n");
+        return 1;
+    }
+    if (update_installed(&slot, &version) < 0)
+        printf("boot: factory image at 0x%08x\n", addr);
+    else
+        printf("boot: slot %s v%u at 0x%08x%s\n", slot_name(slot), version,
+                addr, update_slot_flag(slot, SLOT_CONFIRMED) ? "" : " (trial)");
+    return 0;
+}
+
+static int cmd_stage(const char *path)
+{
+    uint8_t buf[STAGE_CHUNK];
+    FILE *f = fopen(path, "rb");
+    size_t len;
+    int ret = 0;
+
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    if (utils_open() < 0) {
+        printf("stage: open failed\n");
+        fclose(f);
+        return 1;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        if (utils_write(buf, len) != (int)len) {
+            ret = -1;
+            break;
+        }
+    }
+    fclose(f);
+    if ((ret < 0) || (utils_close() < 0)) {
+        printf("stage: %s rejected\n", path);
+        return 1;
+    }
+    printf("stage: %s committed\n", path);
+    return 0;
+}
+
+static int cmd_status(void)
+{
+    static const char *flags[] = { "committed", "trial", "confirmed", "bad" };
+    static const uint32_t slots[UPDATE_SLOTS] = { SLOT_A_ADDR, SLOT_B_ADDR };
+    const struct img_hdr *h;
+    uint32_t slot, version;
+    int i, j;
+
+    for (i = 0; i < UPDATE_SLOTS; i++) {
+        h = update_slot_header(slots[i]);
+        printf("slot %s:", slot_name(slots[i]));
+        if (!h)
+            printf(" empty");
+        else
+            printf(" v%u, %u bytes, crc %08x", h->version, h->size, h->crc);
+        if (h && (h->flags & IMG_F_LZ4))
+            printf(", lz4 %u bytes", h->zsize);
+        for (j = 0; j < 4; j++) {
+            if (update_slot_flag(slots[i], j))
+                printf(", %s", flags[j]);
+        }
+        printf("\n");
+    }
+    if (update_installed(&slot, &version) == 0)
+        printf("installed: slot %s v%u\n", slot_name(slot), version);
+    else
+        printf("installed: none\n");
+    return 0;
+}
+
+static int cmd_digest(int n, char *paths[])
+{
+    uint8_t buf[4096], digest[SHA256_DIGEST_SIZE];
+    struct sha256_ctx sha;
+    uint32_t crc;
+    size_t len;
+    FILE *f;
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        f = fopen(paths[i], "rb");
+        if (!f) {
+            perror(paths[i]);
+            return 1;
+        }
+        crc = 0;
+        sha256_init(&sha);
+        /* Odd-sized reads, to exercise the unaligned paths */
+        while ((len = fread(buf, 1, sizeof(buf) - 3, f)) > 0) {
+            crc = crc32_update(crc, buf, len);
+            sha256_update(&sha, buf, len);
+        }
+        fclose(f);
+        sha256_final(&sha, digest);
+        printf("%08x  %s\n", crc, paths[i]);
+        for (j = 0; j < SHA256_DIGEST_SIZE; j++)
+            printf("%02x", digest[j]);
+        printf("  %s\n", paths[i]);
+    }
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Host figures, for comparison with VERIFY_BENCH on the target */
+static int cmd_bench(int mb)
+{
+    uint32_t size = (uint32_t)mb << 20;
+    uint8_t *buf = malloc(size);
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    struct sha256_ctx sha;
+    volatile uint32_t sink;
+    double t;
+    uint32_t i;
+
+    if (!buf || (mb <= 0))
+        return 1;
+    for (i = 0; i < size; i++)
+        buf[i] = i * 2654435761u >> 24;
+    t = now();
+    sink = crc32_sw(0, buf, size);
+    t = now() - t;
+    printf("crc32  %8.3f ms/MB  %8.1f MB/s\n", t * 1e3 / mb, mb / t);
+    t = now();
+    sha256_init(&sha);
+    sha256_update(&sha, buf, size);
+    sha256_final(&sha, digest);
+    t = now() - t;
+    printf("sha256 %8.3f ms/MB  %8.1f MB/s\n", t * 1e3 / mb, mb / t);
+    (void)sink;
+    free(buf);
+    return 0;
+}
+
+static int cmd_info(void)
+{
+    const struct utils_table *u = &utils_interface;
+
+    printf("services: magic %08x, ABI %u.%u, %u bytes, caps %08x\n",
+            u->magic, u->abi_version >> 16, u->abi_version & 0xFFFF,
+            u->size, u->caps);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc > 2) && (strcmp(argv[1], "digest") == 0))
+        return cmd_digest(argc - 2, argv + 2);
+    if ((argc > 1) && (strcmp(argv[1], "bench") == 0))
+        return cmd_bench(argc > 2 ? atoi(argv[2]) : 64);
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s flash.bin boot|stage <image>|confirm|status|info\n"
+                "       %s digest <file>...\n"
+                "       %s bench [MB]\n", argv[0], argv[0], argv[0]);
+        return 2;
+    }
+    if (flash_host_open(argv[1]) < 0) {
+        perror(argv[1]);
+        return 2;
+    }
+    if (strcmp(argv[2], "boot") == 0)
+        return cmd_boot();
+    if ((strcmp(argv[2], "stage") == 0) && (argc > 3))
+        return cmd_stage(argv[3]);
+    if (strcmp(argv[2], "confirm") == 0)
+        return utils_confirm() < 0;
+    if (strcmp(argv[2], "status") == 0)
+        return cmd_status();
+    if (strcmp(argv[2], "info") == 0)
+        return cmd_info();
+    fprintf(stderr, "%s: unknown command\n", argv[2]);
+    return 2;
+}
@@ -0,0 +1,136 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "crc32.h"
+
+/* crc32_table[0] is the classic byte-wise table. crc32_table[k] gives
+ * the contribution of a byte followed by k zero bytes, so eight
+ * lookups fold a whole double word into the CRC at once.
+ */
+extern const uint32_t crc32_table[8][256];
+
+#define T crc32_table
+
+uint32_t crc32_sw(uint32_t crc, const void *buf, uint32_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t lo, hi;
+
+    crc = ~crc;
+    while (len && ((uint32_t)(uintptr_t)p & 3)) {
+        crc = T[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+    /* Little endian: the first byte of the word is in the low bits */
+    while (len >= 8) {
+        lo = *(const uint32_t *)p ^ crc;
+        hi = *(const uint32_t *)(p + 4);
+        crc = T[7][lo & 0xFF] ^ T[6][(lo >> 8) & 0xFF] ^
+              T[5][(lo >> 16) & 0xFF] ^ T[4][lo >> 24] ^
+              T[3][hi & 0xFF] ^ T[2][(hi >> 8) & 0xFF] ^
+              T[1][(hi >> 16) & 0xFF] ^ T[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = T[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef CRC32_HW
+
+#define RCC_AHB1ENR (*(volatile uint32_t *)(0x40021048))
+#define RCC_AHB1ENR_CRCEN (1 << 12)
+
+#define CRC_BASE    (0x40023000)
+#define CRC_DR      (*(volatile uint32_t *)(CRC_BASE + 0x00))
+#define CRC_DR8     (*(volatile uint8_t *)(CRC_BASE + 0x00))
+#define CRC_CR      (*(volatile uint32_t *)(CRC_BASE + 0x08))
+#define CRC_INIT    (*(volatile uint32_t *)(CRC_BASE + 0x10))
+#define CRC_POL     (*(volatile uint32_t *)(CRC_BASE + 0x14))
+
+#define CRC_CR_RESET       (1 << 0)
+#define CRC_CR_REV_IN_BYTE (1 << 5)
+#define CRC_CR_REV_IN_WORD (3 << 5)
+#define CRC_CR_REV_OUT     (1 << 7)
+
+#define CRC32_POLY_NORMAL  (0x04C11DB7)
+
+static inline uint32_t rbit(uint32_t x)
+{
+    uint32_t r;
+    asm volatile ("rbit %0, %1" : "=r"(r) : "r"(x));
+    return r;
+}
+
+/* The unit shifts MSB first with the normal polynomial. Reversing the
+ * input bits of each word makes it consume the bytes in memory order,
+ * LSB first, and reversing the output gives the reflected CRC. The
+ * running value is loaded back through CRC_INIT, which holds the raw,
+ * non reflected register.
+ */
+uint32_t crc32_hw(uint32_t crc, const void *buf, uint32_t len)
+{
+    const uint8_t *p = buf;
+
+    RCC_AHB1ENR |= RCC_AHB1ENR_CRCEN;
+    CRC_POL = CRC32_POLY_NORMAL;
+    CRC_INIT = rbit(~crc);
+    CRC_CR = CRC_CR_REV_IN_WORD | CRC_CR_REV_OUT | CRC_CR_RESET;
+    while (len && ((uint32_t)(uintptr_t)p & 3)) {
+        CRC_CR = CRC_CR_REV_IN_BYTE | CRC_CR_REV_OUT;
+        CRC_DR8 = *p++;
+        len--;
+    }
+    CRC_CR = CRC_CR_REV_IN_WORD | CRC_CR_REV_OUT;
+    while (len >= 4) {
+        CRC_DR = *(const uint32_t *)p;
+        p += 4;
+        len -= 4;
+    }
+    CRC_CR = CRC_CR_REV_IN_BYTE | CRC_CR_REV_OUT;
+    while (len--)
+        CRC_DR8 = *p++;
+    return ~CRC_DR;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *buf, uint32_t len)
+{
+    return crc32_hw(crc, buf, len);
+}
+
+#else
+
+uint32_t crc32_update(uint32_t crc, const void *buf, uint32_t len)
+{
+    return crc32_sw(crc, buf, len);
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef CRC32_H
+#define CRC32_H
+#include <stdint.h>
+
+/* CRC-32 (IEEE 802.3, reflected, as zlib and 'crc32' on the host).
+ * Start with crc = 0, pass the result back in to continue.
+ *
+ * crc32_update() uses the CRC calculation unit in builds with
+ * CRC32_HW defined, the slice-by-8 tables otherwise.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, uint32_t len);
+
+/* Table driven, eight bytes per step (crc32_table.c, 8KB of flash) */
+uint32_t crc32_sw(uint32_t crc, const void *buf, uint32_t len);
+
+#ifdef CRC32_HW
+/* CRC calculation unit: one word per write, same results as crc32_sw() */
+uint32_t crc32_hw(uint32_t crc, const void *buf, uint32_t len);
+#endif
+
+#endif
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+#
+# Embedded System Architecture - Second Edition
+#
+# Generate crc32_table.c: the eight 256-entry tables used by the
+# slice-by-8 CRC32 in crc32.c.
+#
+# Usage:
+#   ./crc32_table.py > crc32_table.c
+#
+# MIT License
+#
+POLY = 0xEDB88320
+
+
+def tables():
+    t = [[0] * 256 for _ in range(8)]
+    for n in range(256):
+        c = n
+        for _ in range(8):
+            c = (c >> 1) ^ (POLY if c & 1 else 0)
+        t[0][n] = c
+    for k in range(1, 8):
+        for n in range(256):
+            c = t[k - 1][n]
+            t[k][n] = (c >> 8) ^ t[0][c & 0xFF]
+    return t
+
+
+def main():
+    with open(__file__.replace("crc32_table.py", "crc32.c")) as f:
+        header = f.read().split("*/", 1)[0] + "*/\n"
+    print(header)
+    print("/* Generated by crc32_table.py, do not edit */")
+    print("#include <stdint.h>")
+    print()
+    print("const uint32_t crc32_table[8][256] = {")
+    for k, t in enumerate(tables()):
+        print("    {")
+        for i in range(0, 256, 4):
+            print("        " + ", ".join("0x%08X" % v for v in t[i:i + 4]) + ",")
+        print("    }," if k < 7 else "    }")
+    print("};")
+
+
+if __name__ == "__main__":
+    main()
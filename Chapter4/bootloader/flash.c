@@ -0,0 +1,156 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include "flash.h"
+
+#define FLASH_BASE  (0x40022000)
+#define FLASH_ACR   (*(volatile uint32_t *)(FLASH_BASE + 0x00))
+#define FLASH_KEYR  (*(volatile uint32_t *)(FLASH_BASE + 0x08))
+#define FLASH_SR    (*(volatile uint32_t *)(FLASH_BASE + 0x10))
+#define FLASH_CR    (*(volatile uint32_t *)(FLASH_BASE + 0x14))
+
+#define FLASH_KEY1  (0x45670123)
+#define FLASH_KEY2  (0xCDEF89AB)
+
+#define FLASH_ACR_ICEN   (1 << 9)
+#define FLASH_ACR_DCEN   (1 << 10)
+#define FLASH_ACR_ICRST  (1 << 11)
+#define FLASH_ACR_DCRST  (1 << 12)
+
+#define FLASH_SR_EOP     (1 << 0)
+#define FLASH_SR_BSY     (1 << 16)
+/* OPERR, PROGERR, WRPERR, PGAERR, SIZERR, PGSERR, MISSERR, FASTERR,
+ * RDERR, OPTVERR
+ */
+#define FLASH_SR_ERRORS  (0xC3FA)
+
+#define FLASH_CR_PG      (1 << 0)
+#define FLASH_CR_PER     (1 << 1)
+#define FLASH_CR_PNB_SHIFT (3)
+#define FLASH_CR_PNB_MASK  (0xFF << FLASH_CR_PNB_SHIFT)
+#define FLASH_CR_BKER    (1 << 11)
+#define FLASH_CR_STRT    (1 << 16)
+#define FLASH_CR_LOCK    (1 << 31)
+
+/* Flash memory as seen by the programming interface */
+#define FLASH_PROG_BASE  (0x08000000)
+
+static void flash_unlock(void)
+{
+    if (FLASH_CR & FLASH_CR_LOCK) {
+        FLASH_KEYR = FLASH_KEY1;
+        FLASH_KEYR = FLASH_KEY2;
+    }
+}
+
+static void flash_lock(void)
+{
+    FLASH_CR |= FLASH_CR_LOCK;
+}
+
+/* Wait for the end of the operation, clear and return the errors */
+static int flash_wait(void)
+{
+    uint32_t err;
+    while (FLASH_SR & FLASH_SR_BSY)
+        ;
+    err = FLASH_SR & FLASH_SR_ERRORS;
+    FLASH_SR = err | FLASH_SR_EOP;
+    return err ? -1 : 0;
+}
+
+/* Drop the lines of the caches that may hold the old contents */
+static void flash_cache_reset(void)
+{
+    uint32_t acr = FLASH_ACR;
+    FLASH_ACR = acr & ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+    FLASH_ACR |= FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+    FLASH_ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+    FLASH_ACR = acr;
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Erase the pages in [addr, addr + len), both page aligned */
+int flash_erase(uint32_t addr, uint32_t len)
+{
+    uint32_t end = addr + len;
+    uint32_t page, reg;
+    int ret = 0;
+
+    if ((addr % FLASH_PAGE_SIZE) || (len % FLASH_PAGE_SIZE) ||
+            (end > FLASH_SIZE))
+        return -1;
+    flash_unlock();
+    for (; (addr < end) && (ret == 0); addr += FLASH_PAGE_SIZE) {
+        page = (addr % FLASH_BANK_SIZE) / FLASH_PAGE_SIZE;
+        reg = FLASH_CR & ~(FLASH_CR_PNB_MASK | FLASH_CR_BKER);
+        if (addr >= FLASH_BANK_SIZE)
+            reg |= FLASH_CR_BKER;
+        FLASH_CR = reg | (page << FLASH_CR_PNB_SHIFT) | FLASH_CR_PER;
+        FLASH_CR |= FLASH_CR_STRT;
+        ret = flash_wait();
+        FLASH_CR &= ~FLASH_CR_PER;
+    }
+    flash_lock();
+    flash_cache_reset();
+    return ret;
+}
+
+/* Program len bytes at addr, both multiple of FLASH_WRITE_SIZE.
+ * data may be unaligned, and may be in flash itself.
+ */
+int flash_write(uint32_t addr, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+    volatile uint32_t *dst = (volatile uint32_t *)(FLASH_PROG_BASE + addr);
+    uint32_t i;
+    int ret = 0;
+
+    if ((addr % FLASH_WRITE_SIZE) || (len % FLASH_WRITE_SIZE) ||
+            (addr + len > FLASH_SIZE))
+        return -1;
+    flash_unlock();
+    FLASH_CR |= FLASH_CR_PG;
+    for (i = 0; (i < len) && (ret == 0); i += FLASH_WRITE_SIZE) {
+        dst[0] = get_le32(src + i);
+        dst[1] = get_le32(src + i + 4);
+        ret = flash_wait();
+        dst += 2;
+    }
+    FLASH_CR &= ~FLASH_CR_PG;
+    flash_lock();
+    flash_cache_reset();
+    return ret;
+}
@@ -0,0 +1,60 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+#ifndef FLASH_H
+#define FLASH_H
+#include <stdint.h>
+
+/* STM32L4R5, 2MB in dual bank mode (DBANK=1): two banks of 256 pages
+ * of 4KB. Addresses are offsets from the start of the flash, which is
+ * also where it is mapped when booting from it.
+ */
+#define FLASH_SIZE        (0x00200000)
+#define FLASH_BANK_SIZE   (0x00100000)
+#define FLASH_PAGE_SIZE   (0x1000)
+
+/* Programming unit: one double word. Each one can only be written once
+ * after an erase (ECC).
+ */
+#define FLASH_WRITE_SIZE  (8)
+
+int flash_erase(uint32_t addr, uint32_t len);
+int flash_write(uint32_t addr, const void *data, uint32_t len);
+
+#ifdef HOST_FLASH
+/* Linux build: the flash is a file mapped in memory (flash_host.c) */
+extern uint8_t *flash_host_base;
+int flash_host_open(const char *path);
+#define FLASH_PTR(addr) ((const uint8_t *)(flash_host_base + (uint32_t)(addr)))
+#else
+#define FLASH_PTR(addr) ((const uint8_t *)(addr))
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+/* File-backed model of the STM32L4 flash, for the Linux build.
+ *
+ * The file is created erased (0xFF) if it does not exist. Like the
+ * real device, a double word can only be programmed once after an
+ * erase.
+ *
+ * FLASHSIM_FAIL_AFTER=n in the environment simulates a power loss:
+ * the process exits when the n-th erase or program operation starts.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flash.h"
+
+uint8_t *flash_host_base;
+static long ops_left = -1;
+
+int flash_host_open(const char *path)
+{
+    struct stat st;
+    const char *fail;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    if ((fstat(fd, &st) < 0) || (st.st_size > FLASH_SIZE)) {
+        close(fd);
+        return -1;
+    }
+    if (ftruncate(fd, FLASH_SIZE) < 0) {
+        close(fd);
+        return -1;
+    }
+    flash_host_base = mmap(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (flash_host_base == MAP_FAILED)
+        return -1;
+    /* New or extended file: the added part is erased flash */
+    memset(flash_host_base + st.st_size, 0xFF, FLASH_SIZE - st.st_size);
+    fail = getenv("FLASHSIM_FAIL_AFTER");
+    if (fail)
+        ops_left = strtol(fail, NULL, 0);
+    return 0;
+}
+
+static void flash_host_op(void)
+{
+    if (ops_left < 0)
+        return;
+    if (ops_left-- == 0) {
+        fprintf(stderr, "flashsim: power loss\n");
+        msync(flash_host_base, FLASH_SIZE, MS_SYNC);
+        exit(3);
+    }
+}
+
+int flash_erase(uint32_t addr, uint32_t len)
+{
+    if ((addr % FLASH_PAGE_SIZE) || (len % FLASH_PAGE_SIZE) ||
+            (addr + len > FLASH_SIZE))
+        return -1;
+    for (; len > 0; addr += FLASH_PAGE_SIZE, len -= FLASH_PAGE_SIZE) {
+        flash_host_op();
+        memset(flash_host_base + addr, 0xFF, FLASH_PAGE_SIZE);
+    }
+    return 0;
+}
+
+int flash_write(uint32_t addr, const void *data, uint32_t len)
+{
+    const uint8_t *src = data;
+    uint32_t i, j;
+
+    if ((addr % FLASH_WRITE_SIZE) || (len % FLASH_WRITE_SIZE) ||
+            (addr + len > FLASH_SIZE))
+        return -1;
+    flash_host_op();
+    for (i = 0; i < len; i += FLASH_WRITE_SIZE) {
+        for (j = 0; j < FLASH_WRITE_SIZE; j++) {
+            if (flash_host_base[addr + i + j] != 0xFF) {
+                /* PROGERR: double word not erased */
+                return -1;
+            }
+        }
+        memmove(flash_host_base + addr + i, src + i, FLASH_WRITE_SIZE);
+    }
+    return 0;
+}
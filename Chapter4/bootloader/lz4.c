@@ -0,0 +1,126 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "flash.h"
+#include "lz4.h"
+
+static struct lz4_out {
+    uint32_t dst;
+    uint32_t pos;           /* Bytes produced */
+    uint32_t flushed;       /* Bytes programmed, win[] holds the rest */
+    int err;
+    uint8_t win[LZ4_WINDOW];
+} out;
+
+static void out_flush(uint32_t len)
+{
+    if (flash_write(out.dst + out.flushed, out.win, len) < 0)
+        out.err = -1;
+    out.flushed += LZ4_WINDOW;
+}
+
+static void out_put(uint8_t b)
+{
+    out.win[out.pos++ - out.flushed] = b;
+    if (out.pos - out.flushed == LZ4_WINDOW)
+        out_flush(LZ4_WINDOW);
+}
+
+static uint8_t out_get(uint32_t i)
+{
+    if (i >= out.flushed)
+        return out.win[i - out.flushed];
+    return *FLASH_PTR(out.dst + i);
+}
+
+/* Length nibble of 15: extended by bytes up to the first one below 255 */
+static int get_len(const uint8_t **src, const uint8_t *end, uint32_t *len)
+{
+    uint8_t b;
+
+    if (*len != 15)
+        return 0;
+    do {
+        if (*src >= end)
+            return -1;
+        b = *(*src)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz4_unpack(uint32_t dst, const uint8_t *src, uint32_t src_len,
+        uint32_t dst_len)
+{
+    const uint8_t *end = src + src_len;
+    uint32_t len, off, i;
+    uint8_t token;
+
+    out.dst = dst;
+    out.pos = 0;
+    out.flushed = 0;
+    out.err = 0;
+    while (src < end) {
+        /* Sequence: token, literals, offset, match */
+        token = *src++;
+        len = token >> 4;
+        if ((get_len(&src, end, &len) < 0) || (len > (uint32_t)(end - src)) ||
+                (len > dst_len - out.pos))
+            return -1;
+        for (i = 0; i < len; i++)
+            out_put(*src++);
+        if (src == end)
+            break;              /* The last sequence has literals only */
+        if (end - src < 2)
+            return -1;
+        off = src[0] | (src[1] << 8);
+        src += 2;
+        len = token & 0x0F;
+        if ((off == 0) || (off > out.pos) || (get_len(&src, end, &len) < 0))
+            return -1;
+        len += 4;
+        if (len > dst_len - out.pos)
+            return -1;
+        /* May overlap its own output, one byte at a time */
+        for (i = 0; i < len; i++)
+            out_put(out_get(out.pos - off));
+        if (out.err < 0)
+            return -1;
+    }
+    if (out.pos > out.flushed) {
+        len = out.pos - out.flushed;
+        while ((len % FLASH_WRITE_SIZE) != 0)
+            out.win[len++] = 0xFF;
+        out_flush(len);
+    }
+    if ((out.err < 0) || (out.pos != dst_len))
+        return -1;
+    return 0;
+}
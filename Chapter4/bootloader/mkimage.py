@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+#
+# Embedded System Architecture - Second Edition
+#
+# Build an update image for the bootloader A/B slots: a 72-byte
+# header (struct img_hdr in update.h) followed by the application
+# binary. The application writes it through utils_open(),
+# utils_write() and utils_close().
+#
+# The header carries the CRC32 of the binary and, unless --no-sha256
+# is given, its SHA-256 digest. Both come from zlib and hashlib, the
+# reference the bootloader is checked against (bl-host digest).
+#
+# With --lz4 the binary is stored as an LZ4 block, which the
+# bootloader unpacks into EXEC when it installs the image. Binaries
+# that do not compress are stored raw.
+#
+# Usage:
+#   ./mkimage.py --version 2 app.bin app.img
+#   ./mkimage.py --version 2 --lz4 app.bin app.img
+#
+# MIT License
+#
+import argparse
+import hashlib
+import struct
+import zlib
+
+IMG_MAGIC = 0x474D4941
+IMG_HDR_SIZE = 72
+EXEC_ADDR = 0x00010000
+IMG_F_SHA256 = 1 << 0
+IMG_F_LZ4 = 1 << 1
+
+# LZ4 block format limits
+MIN_MATCH = 4
+LAST_LITERALS = 5       # The block ends with at least 5 literals
+MATCH_LIMIT = 12        # and no match starts in its last 12 bytes
+MAX_OFFSET = 0xFFFF
+
+
+def lz4_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def lz4_sequence(out, literals, offset=0, match=0):
+    ml = match - MIN_MATCH if offset else 0
+    out.append((min(len(literals), 15) << 4) | min(ml, 15))
+    if len(literals) >= 15:
+        lz4_length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            lz4_length(out, ml - 15)
+
+
+def lz4_compress(data):
+    """Greedy LZ4 block compressor: last position of each 4-byte string"""
+    out = bytearray()
+    last = {}
+    anchor = i = 0
+    end = len(data)
+    while i < end - MATCH_LIMIT:
+        key = data[i:i + MIN_MATCH]
+        ref = last.get(key)
+        last[key] = i
+        if ref is None or i - ref > MAX_OFFSET:
+            i += 1
+            continue
+        n = MIN_MATCH
+        while i + n < end - LAST_LITERALS and data[ref + n] == data[i + n]:
+            n += 1
+        lz4_sequence(out, data[anchor:i], i - ref, n)
+        i += n
+        anchor = i
+    lz4_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def make_header(payload, version, load_addr, sha256, stored=None):
+    flags = IMG_F_SHA256 if sha256 else 0
+    zsize = zcrc = 0
+    if stored is not None:
+        flags |= IMG_F_LZ4
+        zsize, zcrc = len(stored), zlib.crc32(stored)
+    fields = struct.pack("<7I", IMG_MAGIC, IMG_HDR_SIZE, version,
+                         len(payload), zlib.crc32(payload), flags, load_addr)
+    if sha256:
+        fields += hashlib.sha256(payload).digest()
+    else:
+        fields += b"\0" * 32
+    fields += struct.pack("<2I", zsize, zcrc)
+    return fields + struct.pack("<I", zlib.crc32(fields))
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--version", type=int, required=True)
+    ap.add_argument("--load-addr", type=lambda x: int(x, 0),
+                    default=EXEC_ADDR)
+    ap.add_argument("--no-sha256", action="store_true")
+    ap.add_argument("--lz4", action="store_true")
+    ap.add_argument("input")
+    ap.add_argument("output")
+    args = ap.parse_args()
+    with open(args.input, "rb") as f:
+        payload = f.read()
+    stored = lz4_compress(payload) if args.lz4 else None
+    if stored is not None and len(stored) >= len(payload):
+        print("%s: LZ4 does not shrink %d bytes, storing raw" %
+              (args.output, len(payload)))
+        stored = None
+    hdr = make_header(payload, args.version, args.load_addr,
+                      not args.no_sha256, stored)
+    assert len(hdr) == IMG_HDR_SIZE
+    with open(args.output, "wb") as f:
+        f.write(hdr + (payload if stored is None else stored))
+    if stored is not None:
+        print("%s: %d -> %d bytes (%.1f%%)" % (args.output, len(payload),
+              len(stored), 100.0 * len(stored) / len(payload)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+#define ROR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define S0(x) (ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define S1(x) (ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define s0(x) (ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define s1(x) (ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+        ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* The message schedule is kept in a 16-word ring, to save stack */
+static void sha256_block(uint32_t *h, const uint8_t *blk)
+{
+    uint32_t w[16];
+    uint32_t a, b, c, d, e, f, g, k, t1, t2;
+    int i;
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 64; i++) {
+        if (i < 16)
+            w[i] = get_be32(blk + 4 * i);
+        else
+            w[i & 15] += s1(w[(i - 2) & 15]) + w[(i - 7) & 15] +
+                s0(w[(i - 15) & 15]);
+        t1 = k + S1(e) + CH(e, f, g) + K[i] + w[i & 15];
+        t2 = S0(a) + MAJ(a, b, c);
+        k = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void sha256_init(struct sha256_ctx *ctx)
+{
+    ctx->h[0] = 0x6A09E667;
+    ctx->h[1] = 0xBB67AE85;
+    ctx->h[2] = 0x3C6EF372;
+    ctx->h[3] = 0xA54FF53A;
+    ctx->h[4] = 0x510E527F;
+    ctx->h[5] = 0x9B05688C;
+    ctx->h[6] = 0x1F83D9AB;
+    ctx->h[7] = 0x5BE0CD19;
+    ctx->len_lo = 0;
+    ctx->len_hi = 0;
+    ctx->buf_len = 0;
+}
+
+void sha256_update(struct sha256_ctx *ctx, const void *data, uint32_t len)
+{
+    const uint8_t *p = data;
+
+    if (ctx->len_lo + len < ctx->len_lo)
+        ctx->len_hi++;
+    ctx->len_lo += len;
+    while (len > 0) {
+        /* Whole blocks straight from the input, e.g. from flash */
+        if ((ctx->buf_len == 0) && (len >= SHA256_BLOCK_SIZE)) {
+            sha256_block(ctx->h, p);
+            p += SHA256_BLOCK_SIZE;
+            len -= SHA256_BLOCK_SIZE;
+            continue;
+        }
+        ctx->buf[ctx->buf_len++] = *p++;
+        len--;
+        if (ctx->buf_len == SHA256_BLOCK_SIZE) {
+            sha256_block(ctx->h, ctx->buf);
+            ctx->buf_len = 0;
+        }
+    }
+}
+
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint32_t i;
+
+    /* 0x80, zeros up to 56 mod 64, then the length in bits */
+    ctx->buf[ctx->buf_len++] = 0x80;
+    if (ctx->buf_len > SHA256_BLOCK_SIZE - 8) {
+        while (ctx->buf_len < SHA256_BLOCK_SIZE)
+            ctx->buf[ctx->buf_len++] = 0;
+        sha256_block(ctx->h, ctx->buf);
+        ctx->buf_len = 0;
+    }
+    while (ctx->buf_len < SHA256_BLOCK_SIZE - 8)
+        ctx->buf[ctx->buf_len++] = 0;
+    put_be32(ctx->buf + 56, (ctx->len_hi << 3) | (ctx->len_lo >> 29));
+    put_be32(ctx->buf + 60, ctx->len_lo << 3);
+    sha256_block(ctx->h, ctx->buf);
+    for (i = 0; i < 8; i++)
+        put_be32(digest + 4 * i, ctx->h[i]);
+}
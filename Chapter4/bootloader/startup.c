@@ -31,11 +31,13 @@
 #include <stdint.h>
 #include "utils.h"
 
-extern unsigned int _stored_data;
-extern unsigned int _start_data;
-extern unsigned int _end_data;
-extern unsigned int _start_bss;
-extern unsigned int _end_bss;
+/* Written by the linker script: {load address, start, end} for each
+ * section to copy, {start, end} for each one to zero
+ */
+extern unsigned int _start_copy_table;
+extern unsigned int _end_copy_table;
+extern unsigned int _start_zero_table;
+extern unsigned int _end_zero_table;
 
 
 extern uint32_t *END_STACK;
@@ -43,24 +45,93 @@ extern uint32_t *END_STACK;
 static int zeroed_variable_in_bss;
 static int initialized_variable_in_data = 42;
 void main(void);
+/* Reset-to-main time in CPU cycles, from the DWT cycle counter (it
+ * reads 0 where there is none, e.g. in QEMU)
+ */
+#define DEMCR       (*(volatile unsigned int *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile unsigned int *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile unsigned int *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+volatile unsigned int startup_cycles;
+
+/* Copy [dst, end) from src: eight words per LDM/STM pair, then the
+ * remaining words one at a time. Naked, so the loop is the same at -O0.
+ */
+static void __attribute__((naked, used)) init_copy(unsigned int *dst,
+        const unsigned int *src, unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r11}\n"
+        "1:\n"
+        "add r3, r0, #32\n"
+        "cmp r3, r2\n"
+        "bhi 2f\n"
+        "ldmia r1!, {r4-r11}\n"
+        "stmia r0!, {r4-r11}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r2\n"
+        "bhs 3f\n"
+        "ldr r3, [r1], #4\n"
+        "str r3, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r11}\n"
+        "bx lr\n"
+    );
+}
+
+/* Zero [dst, end): eight words per STM, then one at a time */
+static void __attribute__((naked, used)) init_zero(unsigned int *dst,
+        unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r9}\n"
+        "mov r2, #0\n"
+        "mov r3, #0\n"
+        "mov r4, #0\n"
+        "mov r5, #0\n"
+        "mov r6, #0\n"
+        "mov r7, #0\n"
+        "mov r8, #0\n"
+        "mov r9, #0\n"
+        "1:\n"
+        "add r12, r0, #32\n"
+        "cmp r12, r1\n"
+        "bhi 2f\n"
+        "stmia r0!, {r2-r9}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r1\n"
+        "bhs 3f\n"
+        "str r2, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r9}\n"
+        "bx lr\n"
+    );
+}
+
 void isr_reset(void) {
-    unsigned int *src, *dst;
-
-    /* Copy the .data section from flash to RAM. */
-    src = (unsigned int *) &_stored_data;
-    dst = (unsigned int *) &_start_data;
-    while (dst < (unsigned int *)&_end_data) {
-        *dst = *src;
-        dst++;
-        src++;
-    }
+    unsigned int *t;
 
-    /* Initialize the BSS section to 0 */
-    dst = &_start_bss;
-    while (dst < (unsigned int *)&_end_bss) {
-        *dst = 0U;
-        dst++;
-    }
+    /* Count the cycles from here to main() */
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    /* Copy the .data sections from flash to RAM */
+    for (t = &_start_copy_table; t < &_end_copy_table; t += 3)
+        init_copy((unsigned int *)t[1], (const unsigned int *)t[0],
+                (unsigned int *)t[2]);
+
+    /* Initialize the .bss sections to 0 (.noinit is not in the table) */
+    for (t = &_start_zero_table; t < &_end_zero_table; t += 2)
+        init_zero((unsigned int *)t[0], (unsigned int *)t[1]);
+
+    startup_cycles = DWT_CYCCNT;
 
     /* Run the program! */
     main();
@@ -83,17 +154,20 @@ void isr_svc(void)
 
 void __attribute__((used, noreturn)) main(void) {
 
+    /* Up and running: tell the bootloader to keep this image,
+     * instead of rolling back to the previous one at the next reset.
+     * Older bootloaders have no A/B update, nothing to confirm.
+     */
+    if (utils_abi_ok()) {
+        utils_confirm();
+        if (utils_caps() & UTILS_CAP_LOG)
+            utils_log_write("app: confirmed\n", 15);
+    }
+
     /* Increment test variables at each loop */
     while(1) {
         zeroed_variable_in_bss++;
         initialized_variable_in_data++;
-        if ((zeroed_variable_in_bss % 1000) == 0) {
-            /* Trigger SVC */
-            //asm volatile("svc 0");
-            utils_open();
-            utils_close();
-
-        }
     }
 }
 
@@ -0,0 +1,534 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#define BOOTLOADER
+#include "utils.h"
+#include "flash.h"
+#include "crc32.h"
+#include "sha256.h"
+#include "lz4.h"
+#include "update.h"
+
+#define XFER_OPEN   (0x4F50454E)
+#define XFER_CLOSED (0x434C4F53)
+
+static struct update_xfer {
+    uint32_t state;         /* XFER_OPEN, XFER_CLOSED or garbage */
+    uint32_t slot;
+    uint32_t pos;           /* Stream bytes received, header included */
+    uint32_t rpos;          /* update_read() position in the stream */
+    uint32_t erased;        /* Image bytes erased in the slot so far */
+    uint32_t pend_len;
+    uint8_t hdr[IMG_HDR_SIZE];
+    uint8_t pend[FLASH_WRITE_SIZE];
+} xfer SVC_RAM;
+
+static const uint32_t slots[UPDATE_SLOTS] = { SLOT_A_ADDR, SLOT_B_ADDR };
+
+/* Boot state: records appended each time a slot is copied to EXEC.
+ * The page is erased only when it is full.
+ */
+#define BOOT_RECORD_MAGIC (0xB007AB01)
+#define BOOT_RECORDS      (FLASH_PAGE_SIZE / sizeof(struct boot_record))
+
+struct boot_record {
+    uint32_t magic;
+    uint32_t slot;
+    uint32_t version;
+    uint32_t crc;
+};
+
+static const struct boot_record *boot_record_last(void)
+{
+    const struct boot_record *rec = (const struct boot_record *)FLASH_PTR(BOOT_STATE_ADDR);
+    const struct boot_record *last = NULL;
+    uint32_t i;
+    for (i = 0; i < BOOT_RECORDS; i++) {
+        if (rec[i].magic != BOOT_RECORD_MAGIC)
+            break;
+        last = &rec[i];
+    }
+    return last;
+}
+
+static int boot_record_append(uint32_t slot, uint32_t version, uint32_t crc)
+{
+    const struct boot_record *last = boot_record_last();
+    uint32_t idx = 0;
+    uint32_t rec[4];
+
+    if (last)
+        idx = (last - (const struct boot_record *)FLASH_PTR(BOOT_STATE_ADDR)) + 1;
+    if (idx >= BOOT_RECORDS) {
+        if (flash_erase(BOOT_STATE_ADDR, FLASH_PAGE_SIZE) < 0)
+            return -1;
+        idx = 0;
+    }
+    rec[0] = BOOT_RECORD_MAGIC;
+    rec[1] = slot;
+    rec[2] = version;
+    rec[3] = crc;
+    return flash_write(BOOT_STATE_ADDR + idx * sizeof(struct boot_record),
+            rec, sizeof(rec));
+}
+
+static int img_hdr_valid(const struct img_hdr *h)
+{
+    if ((h->magic != IMG_MAGIC) || (h->hdr_size != IMG_HDR_SIZE))
+        return 0;
+    if (crc32_update(0, h, offsetof(struct img_hdr, hdr_crc)) != h->hdr_crc)
+        return 0;
+#ifdef IMG_REQUIRE_SHA256
+    if (!(h->flags & IMG_F_SHA256))
+        return 0;
+#endif
+    if ((h->size == 0) || (h->size > EXEC_SIZE) || (IMG_STORED_SIZE(h) == 0) ||
+            (IMG_STORED_SIZE(h) > SLOT_SIZE - SLOT_PAYLOAD_OFF))
+        return 0;
+    return h->load_addr == EXEC_ADDR;
+}
+
+int update_verify(uint32_t addr, const struct img_hdr *h)
+{
+    struct sha256_ctx sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int i;
+
+    if (crc32_update(0, FLASH_PTR(addr), h->size) != h->crc)
+        return -1;
+    if (!(h->flags & IMG_F_SHA256))
+        return 0;
+    sha256_init(&sha);
+    sha256_update(&sha, FLASH_PTR(addr), h->size);
+    sha256_final(&sha, digest);
+    for (i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        if (digest[i] != h->sha256[i])
+            return -1;
+    }
+    return 0;
+}
+
+#ifdef VERIFY_BENCH
+/* Cycles to check 1MB of flash with each method, measured at every
+ * boot. Read them with the debugger: (gdb) p verify_bench
+ */
+#define DWT_CTRL    (*(volatile uint32_t *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile uint32_t *)(0xE0001004))
+#define DEMCR       (*(volatile uint32_t *)(0xE000EDFC))
+#define DEMCR_TRCENA      (1 << 24)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+
+#define VERIFY_BENCH_SIZE (0x100000)
+
+static struct verify_bench {
+    uint32_t crc_sw;
+    uint32_t crc_hw;
+    uint32_t sha256;
+    uint32_t result;        /* Keeps the computations alive */
+    uint32_t unpack_bytes;  /* Last LZ4 install: bytes/cycle is */
+    uint32_t unpack_cycles; /* unpack_bytes / unpack_cycles */
+} verify_bench SVC_RAM;
+
+static void verify_bench_run(void)
+{
+    struct sha256_ctx sha;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t t0;
+
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    t0 = DWT_CYCCNT;
+    verify_bench.result = crc32_sw(0, FLASH_PTR(0), VERIFY_BENCH_SIZE);
+    verify_bench.crc_sw = DWT_CYCCNT - t0;
+#ifdef CRC32_HW
+    t0 = DWT_CYCCNT;
+    verify_bench.result ^= crc32_hw(0, FLASH_PTR(0), VERIFY_BENCH_SIZE);
+    verify_bench.crc_hw = DWT_CYCCNT - t0;
+#endif
+    t0 = DWT_CYCCNT;
+    sha256_init(&sha);
+    sha256_update(&sha, FLASH_PTR(0), VERIFY_BENCH_SIZE);
+    sha256_final(&sha, digest);
+    verify_bench.sha256 = DWT_CYCCNT - t0;
+    verify_bench.result ^= digest[0];
+}
+#endif
+
+int update_slot_flag(uint32_t slot, int flag)
+{
+    const uint32_t *w = (const uint32_t *)FLASH_PTR(slot + SLOT_FLAGS_OFF +
+            flag * FLASH_WRITE_SIZE);
+    return (w[0] == SLOT_FLAG_SET) && (w[1] == SLOT_FLAG_SET);
+}
+
+static int slot_flag_set(uint32_t slot, int flag)
+{
+    uint32_t w[2] = { SLOT_FLAG_SET, SLOT_FLAG_SET };
+    if (update_slot_flag(slot, flag))
+        return 0;
+    return flash_write(slot + SLOT_FLAGS_OFF + flag * FLASH_WRITE_SIZE,
+            w, sizeof(w));
+}
+
+/* Header of a committed slot, NULL if the slot holds no valid image */
+const struct img_hdr *update_slot_header(uint32_t slot)
+{
+    const struct img_hdr *h = (const struct img_hdr *)FLASH_PTR(slot);
+    if (!img_hdr_valid(h) || !update_slot_flag(slot, SLOT_COMMITTED))
+        return NULL;
+    return h;
+}
+
+int update_installed(uint32_t *slot, uint32_t *version)
+{
+    const struct boot_record *rec = boot_record_last();
+    if (!rec)
+        return -1;
+    *slot = rec->slot;
+    *version = rec->version;
+    return 0;
+}
+
+/* Copy (or unpack) the image of a slot to EXEC, and verify the copy */
+static int slot_install(uint32_t slot, const struct img_hdr *h)
+{
+    uint32_t erase_len = (h->size + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t write_len = (h->size + FLASH_WRITE_SIZE - 1) & ~(FLASH_WRITE_SIZE - 1);
+    int ret;
+#ifdef VERIFY_BENCH
+    uint32_t t0;
+#endif
+
+    if (flash_erase(EXEC_ADDR, erase_len) < 0)
+        return -1;
+    if (h->flags & IMG_F_LZ4) {
+#ifdef VERIFY_BENCH
+        t0 = DWT_CYCCNT;
+#endif
+        ret = lz4_unpack(EXEC_ADDR, FLASH_PTR(slot + SLOT_PAYLOAD_OFF),
+                h->zsize, h->size);
+#ifdef VERIFY_BENCH
+        verify_bench.unpack_cycles = DWT_CYCCNT - t0;
+        verify_bench.unpack_bytes = h->size;
+#endif
+    } else {
+        ret = flash_write(EXEC_ADDR, FLASH_PTR(slot + SLOT_PAYLOAD_OFF), write_len);
+    }
+    if (ret < 0)
+        return -1;
+    if (update_verify(EXEC_ADDR, h) < 0)
+        return -1;
+    return boot_record_append(slot, h->version, h->crc);
+}
+
+/* Boot decisions, in the log shared with the application */
+static void boot_log(const char *msg, uint32_t val)
+{
+    utils_log_puts("bl: ");
+    utils_log_puts(msg);
+    utils_log_hex(val);
+    utils_log_puts("\n");
+}
+
+/* A vector table with an initial stack pointer in SRAM */
+static int exec_image_present(void)
+{
+    uint32_t sp = *(const uint32_t *)FLASH_PTR(EXEC_ADDR);
+    return (sp & 0xFFF00000) == 0x20000000;
+}
+
+/* The factory image is programmed in EXEC, without a slot. Before the
+ * first update replaces it, save it in the other slot as a confirmed
+ * version 0: a failed trial then has something to roll back to.
+ */
+static int factory_save(uint32_t slot)
+{
+    struct img_hdr h;
+    struct sha256_ctx sha;
+    const uint8_t *exec = FLASH_PTR(EXEC_ADDR);
+    uint8_t *p = (uint8_t *)&h;
+    uint32_t size = EXEC_SIZE;
+    uint32_t i;
+
+    /* Up to the last programmed double word */
+    while ((size > 0) && (exec[size - 1] == 0xFF))
+        size--;
+    size = (size + FLASH_WRITE_SIZE - 1) & ~(FLASH_WRITE_SIZE - 1);
+    if (size == 0)
+        return -1;
+    for (i = 0; i < sizeof(h); i++)
+        p[i] = 0;
+    h.magic = IMG_MAGIC;
+    h.hdr_size = IMG_HDR_SIZE;
+    h.version = 0;
+    h.size = size;
+    h.crc = crc32_update(0, exec, size);
+    h.flags = IMG_F_SHA256;
+    h.load_addr = EXEC_ADDR;
+    sha256_init(&sha);
+    sha256_update(&sha, exec, size);
+    sha256_final(&sha, h.sha256);
+    h.hdr_crc = crc32_update(0, &h, offsetof(struct img_hdr, hdr_crc));
+
+    if (flash_erase(slot, SLOT_PAYLOAD_OFF + size) < 0)
+        return -1;
+    if ((flash_write(slot, &h, IMG_HDR_SIZE) < 0) ||
+            (flash_write(slot + SLOT_PAYLOAD_OFF, exec, size) < 0))
+        return -1;
+    if (update_verify(slot + SLOT_PAYLOAD_OFF, &h) < 0)
+        return -1;
+    if ((slot_flag_set(slot, SLOT_COMMITTED) < 0) ||
+            (slot_flag_set(slot, SLOT_CONFIRMED) < 0))
+        return -1;
+    return 0;
+}
+
+uint32_t update_boot(void)
+{
+    const struct img_hdr *h, *best_hdr;
+    const struct boot_record *rec;
+    uint32_t best, other;
+    int i;
+
+    xfer.state = 0;
+    utils_log_init();
+#ifdef VERIFY_BENCH
+    verify_bench_run();
+#endif
+    for (;;) {
+        best = 0;
+        best_hdr = NULL;
+        for (i = 0; i < UPDATE_SLOTS; i++) {
+            h = update_slot_header(slots[i]);
+            if (!h || update_slot_flag(slots[i], SLOT_BAD))
+                continue;
+            if (update_slot_flag(slots[i], SLOT_TRIAL) &&
+                    !update_slot_flag(slots[i], SLOT_CONFIRMED)) {
+                /* Reset during the trial, without confirmation: roll back */
+                boot_log("rollback from slot ", slots[i]);
+                slot_flag_set(slots[i], SLOT_BAD);
+                continue;
+            }
+            if (!best_hdr || (h->version > best_hdr->version)) {
+                best = slots[i];
+                best_hdr = h;
+            }
+        }
+        if (!best_hdr)
+            break;
+        rec = boot_record_last();
+        if (!rec && exec_image_present()) {
+            other = (best == SLOT_A_ADDR) ? SLOT_B_ADDR : SLOT_A_ADDR;
+            if (!update_slot_header(other)) {
+                if (factory_save(other) < 0)
+                    boot_log("factory image not saved, slot ", other);
+                else
+                    boot_log("factory image saved to slot ", other);
+            }
+        }
+        /* Not installed yet, or EXEC damaged since: copy it (again) */
+        if (!rec || (rec->slot != best) || (rec->version != best_hdr->version) ||
+                (rec->crc != best_hdr->crc) ||
+                (update_verify(EXEC_ADDR, best_hdr) < 0)) {
+            if (slot_install(best, best_hdr) < 0) {
+                boot_log("install failed, slot ", best);
+                slot_flag_set(best, SLOT_BAD);
+                continue;
+            }
+            boot_log("installed slot ", best);
+        }
+        if (!update_slot_flag(best, SLOT_CONFIRMED))
+            slot_flag_set(best, SLOT_TRIAL);
+        boot_log("start version ", best_hdr->version);
+        return EXEC_ADDR;
+    }
+    /* No slot to boot. EXEC still holds the image of the last slot
+     * installed: if that one failed, do not start it again.
+     */
+    rec = boot_record_last();
+    if (rec && update_slot_flag(rec->slot, SLOT_BAD)) {
+        boot_log("no image to roll back to, halt ", rec->slot);
+        return 0;
+    }
+    /* Otherwise whatever is in EXEC, e.g. the factory image */
+    if (exec_image_present()) {
+        boot_log("start factory image at ", EXEC_ADDR);
+        return EXEC_ADDR;
+    }
+    boot_log("no image, halt ", 0);
+    return 0;
+}
+
+/* Start a transfer into the slot that is not installed. Only the
+ * header page is erased here, the others as the image comes in.
+ */
+int update_open(void)
+{
+    const struct boot_record *rec = boot_record_last();
+    uint32_t slot = SLOT_A_ADDR;
+
+    if (rec && (rec->slot == SLOT_A_ADDR))
+        slot = SLOT_B_ADDR;
+    xfer.state = 0;
+    if (flash_erase(slot, FLASH_PAGE_SIZE) < 0)
+        return -1;
+    xfer.slot = slot;
+    xfer.pos = 0;
+    xfer.rpos = 0;
+    xfer.erased = 0;
+    xfer.pend_len = 0;
+    xfer.state = XFER_OPEN;
+    return 0;
+}
+
+static int xfer_flush(void)
+{
+    uint32_t off = xfer.pos - IMG_HDR_SIZE - xfer.pend_len;
+    uint32_t addr = xfer.slot + SLOT_PAYLOAD_OFF;
+
+    if (off + FLASH_WRITE_SIZE > xfer.erased) {
+        if (flash_erase(addr + xfer.erased, FLASH_PAGE_SIZE) < 0)
+            return -1;
+        xfer.erased += FLASH_PAGE_SIZE;
+    }
+    xfer.pend_len = 0;
+    return flash_write(addr + off, xfer.pend, FLASH_WRITE_SIZE);
+}
+
+/* Append to the image being transferred. Returns the number of bytes
+ * accepted, or -1, which aborts the transfer.
+ */
+int update_write(const void *buf, int size)
+{
+    const struct img_hdr *h = (const struct img_hdr *)xfer.hdr;
+    const uint8_t *p = buf;
+    int i;
+
+    if ((xfer.state != XFER_OPEN) || (size < 0))
+        return -1;
+    for (i = 0; i < size; i++) {
+        if (xfer.pos < IMG_HDR_SIZE) {
+            xfer.hdr[xfer.pos++] = p[i];
+            if (xfer.pos < IMG_HDR_SIZE)
+                continue;
+            if (!img_hdr_valid(h) ||
+                    (flash_write(xfer.slot, xfer.hdr, IMG_HDR_SIZE) < 0))
+                goto abort;
+            continue;
+        }
+        if (xfer.pos - IMG_HDR_SIZE >= IMG_STORED_SIZE(h))
+            goto abort;
+        xfer.pend[xfer.pend_len++] = p[i];
+        xfer.pos++;
+        if ((xfer.pend_len == FLASH_WRITE_SIZE) && (xfer_flush() < 0))
+            goto abort;
+    }
+    return size;
+
+abort:
+    xfer.state = 0;
+    return -1;
+}
+
+/* Read back the stream written so far, from the start of the header */
+int update_read(void *buf, int size)
+{
+    uint8_t *p = buf;
+    uint32_t avail, off;
+    int i;
+
+    if (((xfer.state != XFER_OPEN) && (xfer.state != XFER_CLOSED)) ||
+            (size < 0))
+        return -1;
+    avail = xfer.pos - xfer.pend_len;
+    if (xfer.pos < IMG_HDR_SIZE)
+        avail = 0;
+    for (i = 0; (i < size) && (xfer.rpos < avail); i++, xfer.rpos++) {
+        if (xfer.rpos < IMG_HDR_SIZE)
+            off = xfer.rpos;
+        else
+            off = SLOT_PAYLOAD_OFF + xfer.rpos - IMG_HDR_SIZE;
+        p[i] = *FLASH_PTR(xfer.slot + off);
+    }
+    return i;
+}
+
+/* End of the transfer: verify the image, and mark the slot as ready
+ * for the next boot.
+ */
+int update_close(void)
+{
+    const struct img_hdr *h = (const struct img_hdr *)xfer.hdr;
+    uint32_t payload = xfer.slot + SLOT_PAYLOAD_OFF;
+    uint32_t size, i;
+
+    if (xfer.state != XFER_OPEN)
+        return -1;
+    xfer.state = 0;
+    if (xfer.pos < IMG_HDR_SIZE)
+        return -1;
+    size = IMG_STORED_SIZE(h);
+    if (xfer.pos - IMG_HDR_SIZE != size)
+        return -1;
+    if (xfer.pend_len > 0) {
+        for (i = xfer.pend_len; i < FLASH_WRITE_SIZE; i++)
+            xfer.pend[i] = 0xFF;
+        xfer.pos += FLASH_WRITE_SIZE - xfer.pend_len;
+        xfer.pend_len = FLASH_WRITE_SIZE;
+        if (xfer_flush() < 0)
+            return -1;
+        xfer.pos = IMG_HDR_SIZE + size;
+    }
+    /* A compressed image is verified as a whole once unpacked */
+    if (h->flags & IMG_F_LZ4) {
+        if (crc32_update(0, FLASH_PTR(payload), size) != h->zcrc)
+            return -1;
+    } else if (update_verify(payload, h) < 0) {
+        return -1;
+    }
+    if (slot_flag_set(xfer.slot, SLOT_COMMITTED) < 0)
+        return -1;
+    xfer.state = XFER_CLOSED;
+    return 0;
+}
+
+/* Called by the application once it is known to work */
+int update_confirm(void)
+{
+    const struct boot_record *rec = boot_record_last();
+    /* Too late for an image that already failed its trial */
+    if (!rec || update_slot_flag(rec->slot, SLOT_BAD))
+        return -1;
+    return slot_flag_set(rec->slot, SLOT_CONFIRMED);
+}
@@ -0,0 +1,130 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+#ifndef UPDATE_H
+#define UPDATE_H
+#include <stdint.h>
+
+/* Flash layout
+ *
+ *  0x000000  bootloader (32KB)
+ *  0x008000  boot state: log of the images installed in EXEC
+ *  0x009000  application data, through the flash services (utils.h)
+ *  0x010000  EXEC: the application runs from here
+ *  0x080000  slot A: header page + image
+ *  0x100000  slot B: header page + image
+ *
+ * Updates are staged in the slot that is not installed, while the
+ * application is running. At boot, the newest valid slot is copied
+ * to EXEC if it is not there yet, and started on trial. If the
+ * application does not confirm it before the next reset, the slot is
+ * marked bad and the previous one is installed again. The factory
+ * image, found in EXEC at the first update, is saved to the other slot
+ * as a confirmed version 0 for that purpose.
+ */
+#define BOOT_STATE_ADDR  (0x00008000)
+#define EXEC_ADDR        (0x00010000)
+#define EXEC_SIZE        (0x00070000)
+#define SLOT_A_ADDR      (0x00080000)
+#define SLOT_B_ADDR      (0x00100000)
+#define SLOT_SIZE        (0x00080000)
+#define UPDATE_SLOTS     (2)
+
+/* Slot header page: the image header, then the status flags */
+#define SLOT_FLAGS_OFF   (0x800)
+#define SLOT_PAYLOAD_OFF (0x1000)
+
+/* Image header, in front of the binary in the update stream (mkimage.py) */
+#define IMG_MAGIC     (0x474D4941)  /* "AIMG" */
+#define IMG_HDR_SIZE  (72)
+
+struct img_hdr {
+    uint32_t magic;
+    uint32_t hdr_size;
+    uint32_t version;       /* The highest valid version boots */
+    uint32_t size;          /* Bytes of image, as installed in EXEC */
+    uint32_t crc;           /* CRC32 of the image */
+    uint32_t flags;         /* IMG_F_* */
+    uint32_t load_addr;     /* EXEC_ADDR */
+    uint8_t sha256[32];     /* SHA-256 of the image, if IMG_F_SHA256 */
+    uint32_t zsize;         /* IMG_F_LZ4: bytes after the header */
+    uint32_t zcrc;          /* IMG_F_LZ4: CRC32 of those bytes */
+    uint32_t hdr_crc;       /* CRC32 of the fields above */
+};
+
+/* Image flags */
+#define IMG_F_SHA256    (1 << 0)
+#define IMG_F_LZ4       (1 << 1)    /* Stored as an LZ4 block, see lz4.h */
+
+/* Bytes after the header in the stream and in the slot */
+#define IMG_STORED_SIZE(h) (((h)->flags & IMG_F_LZ4) ? (h)->zsize : (h)->size)
+
+/* Images are checked against the header CRC32 when they are received,
+ * after the copy to EXEC, and in EXEC before each start. Compressed
+ * images are received against zcrc, and unpacked to EXEC. When the
+ * IMG_F_SHA256 flag is set, against the SHA-256 digest as well.
+ * Bootloaders built with IMG_REQUIRE_SHA256 (make SIGNED=1) refuse the
+ * images without a digest.
+ */
+int update_verify(uint32_t addr, const struct img_hdr *h);
+
+/* Slot status flags, one double word each in the header page */
+#define SLOT_COMMITTED  0   /* Image received and verified */
+#define SLOT_TRIAL      1   /* Started once, not confirmed yet */
+#define SLOT_CONFIRMED  2   /* Confirmed by the application */
+#define SLOT_BAD        3   /* Failed its trial, or could not be installed */
+#define SLOT_FLAG_SET   (0x5AFE5AFE)
+
+/* The services run on behalf of the application, whose RAM overlaps
+ * the bootloader .data and .bss: their state lives in the .svc_ram
+ * area at the top of SRAM, reserved by both linker scripts.
+ */
+#ifdef HOST_FLASH
+#define SVC_RAM
+#else
+#define SVC_RAM __attribute__((section(".svc_ram")))
+#endif
+
+/* Returns the entry point of the image to start, 0 if there is none */
+uint32_t update_boot(void);
+
+/* Services to the application */
+int update_open(void);
+int update_write(const void *buf, int size);
+int update_read(void *buf, int size);
+int update_close(void);
+int update_confirm(void);
+
+/* Inspection */
+const struct img_hdr *update_slot_header(uint32_t slot);
+int update_slot_flag(uint32_t slot, int flag);
+int update_installed(uint32_t *slot, uint32_t *version);
+
+#endif
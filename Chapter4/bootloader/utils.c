@@ -27,24 +27,141 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
  * SOFTWARE.
  */
+#include <stdint.h>
+#include <stddef.h>
+#define BOOTLOADER
+#include "utils.h"
+#include "update.h"
+#include "flash.h"
+#include "crc32.h"
 
+/* Services exported to the application through utils_interface.
+ * open/write/close stage an update image (mkimage.py format) in the
+ * spare slot; confirm marks the running image as good.
+ */
 int utils_open(void)
 {
-    return 0;
+    return update_open();
 }
 
 int utils_write(const void *buf, int size)
 {
-    (void)buf;
-    (void)size;
-    return -1;
+    return update_write(buf, size);
 }
 
 int utils_read(void *buf, int size)
 {
-    return -1;
+    return update_read(buf, size);
 }
 
-void utils_close(void)
+int utils_close(void)
+{
+    return update_close();
+}
+
+int utils_confirm(void)
+{
+    return update_confirm();
+}
+
+/* Flash services: only within the application data area */
+static int utils_data_range(uint32_t addr, uint32_t len)
+{
+    return (addr >= UTILS_DATA_ADDR) && (len <= UTILS_DATA_SIZE) &&
+        (addr - UTILS_DATA_ADDR <= UTILS_DATA_SIZE - len);
+}
+
+static int utils_flash_erase(uint32_t addr, uint32_t len)
+{
+    if (!utils_data_range(addr, len))
+        return -1;
+    return flash_erase(addr, len);
+}
+
+static int utils_flash_write(uint32_t addr, const void *data, uint32_t len)
+{
+    if (!utils_data_range(addr, len))
+        return -1;
+    return flash_write(addr, data, len);
+}
+
+static struct utils_log shared_log SVC_RAM;
+
+/* Keep the log of the previous runs, unless RAM was lost */
+void utils_log_init(void)
 {
+    if ((shared_log.magic != UTILS_LOG_MAGIC) ||
+            (shared_log.size != UTILS_LOG_SIZE)) {
+        shared_log.magic = UTILS_LOG_MAGIC;
+        shared_log.size = UTILS_LOG_SIZE;
+        shared_log.head = 0;
+    }
 }
+
+int utils_log_write(const char *s, int len)
+{
+    int i;
+
+    if ((shared_log.magic != UTILS_LOG_MAGIC) || (len < 0))
+        return -1;
+    for (i = 0; i < len; i++)
+        shared_log.data[shared_log.head++ % UTILS_LOG_SIZE] = s[i];
+    return len;
+}
+
+void utils_log_puts(const char *s)
+{
+    int len = 0;
+
+    while (s[len])
+        len++;
+    utils_log_write(s, len);
+}
+
+void utils_log_hex(uint32_t val)
+{
+    static const char digits[] = "0123456789abcdef";
+    char buf[8];
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        buf[i] = digits[val & 0x0F];
+        val >>= 4;
+    }
+    utils_log_write(buf, sizeof(buf));
+}
+
+#define UTILS_CAPS_HW   0
+#ifdef CRC32_HW
+#undef UTILS_CAPS_HW
+#define UTILS_CAPS_HW   UTILS_CAP_CRC32_HW
+#endif
+
+#define UTILS_CAPS_SHA  0
+#ifdef IMG_REQUIRE_SHA256
+#undef UTILS_CAPS_SHA
+#define UTILS_CAPS_SHA  UTILS_CAP_SHA256
+#endif
+
+/* The original table is at the same offsets */
+_Static_assert(offsetof(struct utils_table, confirm) == 4 * sizeof(void *),
+        "utils_interface: original entries moved");
+
+__attribute__((section(".utils"),used))
+const struct utils_table utils_interface = {
+    .open = utils_open,
+    .write = utils_write,
+    .read = utils_read,
+    .close = utils_close,
+    .confirm = utils_confirm,
+    .magic = UTILS_MAGIC,
+    .abi_version = UTILS_ABI_VERSION,
+    .size = sizeof(struct utils_table),
+    .caps = UTILS_CAP_UPDATE | UTILS_CAP_FLASH | UTILS_CAP_CRC32 |
+        UTILS_CAP_LOG | UTILS_CAP_LZ4 | UTILS_CAPS_HW | UTILS_CAPS_SHA,
+    .flash_erase = utils_flash_erase,
+    .flash_write = utils_flash_write,
+    .crc32 = crc32_update,
+    .log_write = utils_log_write,
+    .log = &shared_log,
+};
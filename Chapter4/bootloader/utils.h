@@ -27,47 +27,163 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
  * SOFTWARE.
  */
-
-
 #ifndef UTILS_H
 #define UTILS_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* Services exported by the bootloader to the application, through the
+ * table at 0x400 in the bootloader flash.
+ *
+ * The first four entries are the original interface, at the same
+ * offsets: applications built against it keep working. 'confirm'
+ * came with the A/B update, and since ABI 1.0 the table continues
+ * with a descriptor (magic, version, size of the table, capabilities)
+ * and with the newer services.
+ *
+ * Compatibility rules:
+ *  - entries are only ever appended, and 'size' grows accordingly.
+ *    Before using an entry, check that it is within 'size'
+ *    (UTILS_HAS() below);
+ *  - the minor version counts the additions, the major version only
+ *    changes if an existing entry changes, which then means a new
+ *    table;
+ *  - a bootloader older than ABI 1.0 has no magic at 0x414, and may
+ *    have no 'confirm' at 0x410: call it only if utils_abi_ok().
+ */
+#define UTILS_MAGIC       (0x53564342)  /* "BCVS" */
+#define UTILS_ABI_MAJOR   (1)
+#define UTILS_ABI_MINOR   (0)
+#define UTILS_ABI_VERSION ((UTILS_ABI_MAJOR << 16) | UTILS_ABI_MINOR)
+
+/* Capabilities of this bootloader build */
+#define UTILS_CAP_UPDATE    (1 << 0)    /* open/write/read/close/confirm */
+#define UTILS_CAP_FLASH     (1 << 1)    /* flash_erase/flash_write */
+#define UTILS_CAP_CRC32     (1 << 2)
+#define UTILS_CAP_LOG       (1 << 3)
+#define UTILS_CAP_CRC32_HW  (1 << 4)    /* crc32 uses the CRC unit */
+#define UTILS_CAP_LZ4       (1 << 5)    /* Accepts IMG_F_LZ4 images */
+#define UTILS_CAP_SHA256    (1 << 6)    /* Requires IMG_F_SHA256 images */
+
+/* Flash area for the application data, the only one that the flash
+ * services accept. Addresses are offsets from the start of the flash.
+ */
+#define UTILS_DATA_ADDR   (0x00009000)
+#define UTILS_DATA_SIZE   (0x00007000)
+
+/* Log shared by the bootloader and the application. It survives the
+ * resets (not the power cycles): 'head' counts the bytes ever written,
+ * the next one goes to data[head % UTILS_LOG_SIZE].
+ */
+#define UTILS_LOG_MAGIC   (0x21474F4C)  /* "LOG!" */
+#define UTILS_LOG_SIZE    (512)
+
+struct utils_log {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t head;
+    char data[UTILS_LOG_SIZE];
+};
+
+struct utils_table {
+    /* Original table */
+    int (*open)(void);
+    int (*write)(const void *buf, int size);
+    int (*read)(void *buf, int size);
+    int (*close)(void);
+    int (*confirm)(void);
+    /* ABI 1.0 */
+    uint32_t magic;
+    uint32_t abi_version;
+    uint32_t size;              /* sizeof(struct utils_table) */
+    uint32_t caps;              /* UTILS_CAP_* */
+    int (*flash_erase)(uint32_t addr, uint32_t len);
+    int (*flash_write)(uint32_t addr, const void *data, uint32_t len);
+    uint32_t (*crc32)(uint32_t crc, const void *buf, uint32_t len);
+    int (*log_write)(const char *s, int len);
+    struct utils_log *log;
+};
 
 #ifdef BOOTLOADER
 int utils_open(void);
 int utils_write(const void *buf, int size);
 int utils_read(void *buf, int size);
-void utils_close(void);
-
-__attribute__((section(".utils"),used)) 
-static void *utils_interface[4] = {
-    (void *)utils_open,
-    (void *)utils_write,
-    (void *)utils_read,
-    (void *)utils_close
-};
+int utils_close(void);
+int utils_confirm(void);
+
+/* The table, in utils.c */
+extern const struct utils_table utils_interface;
+
+/* Append to the shared log (also on behalf of the bootloader itself) */
+void utils_log_init(void);
+int utils_log_write(const char *s, int len);
+void utils_log_puts(const char *s);
+void utils_log_hex(uint32_t val);
 
 #else
 
-static void **utils_interface = (void**)(0x00000400);
+#define utils_interface ((const struct utils_table *)(0x00000400))
+
+/* Table with a descriptor, of the same major version */
+static inline int utils_abi_ok(void) {
+    return (utils_interface->magic == UTILS_MAGIC) &&
+        ((utils_interface->abi_version >> 16) == UTILS_ABI_MAJOR);
+}
+
+/* Entry provided by the running bootloader */
+#define UTILS_HAS(entry) (utils_abi_ok() && \
+        (utils_interface->size >= offsetof(struct utils_table, entry) + \
+         sizeof(utils_interface->entry)))
 
 static inline int utils_open(void) {
-    int (*do_open)(void) = (int (*)(void))(utils_interface[0]);
-    return do_open();
+    return utils_interface->open();
 }
 
 static inline int utils_write(const void *buf, int size) {
-    int (*do_write)(const void*,int) = (int (*)(const void*,int))(utils_interface[1]);
-    return do_write(buf, size);
+    return utils_interface->write(buf, size);
 }
 
 static inline int utils_read(void *buf, int size) {
-    int (*do_read)(void*, int) = (int (*)(void*,int))(utils_interface[2]);
-    return do_read(buf, size);
+    return utils_interface->read(buf, size);
+}
+
+static inline int utils_close(void) {
+    return utils_interface->close();
+}
+
+static inline int utils_confirm(void) {
+    return utils_interface->confirm();
+}
+
+static inline uint32_t utils_caps(void) {
+    if (!UTILS_HAS(caps))
+        return UTILS_CAP_UPDATE;
+    return utils_interface->caps;
+}
+
+static inline int utils_flash_erase(uint32_t addr, uint32_t len) {
+    if (!UTILS_HAS(flash_erase))
+        return -1;
+    return utils_interface->flash_erase(addr, len);
+}
+
+static inline int utils_flash_write(uint32_t addr, const void *data, uint32_t len) {
+    if (!UTILS_HAS(flash_write))
+        return -1;
+    return utils_interface->flash_write(addr, data, len);
+}
+
+/* Returns 0 if the service is not there: check utils_caps() first */
+static inline uint32_t utils_crc32(uint32_t crc, const void *buf, uint32_t len) {
+    if (!UTILS_HAS(crc32))
+        return 0;
+    return utils_interface->crc32(crc, buf, len);
 }
 
-static inline void utils_close(void) {
-    void (*do_close)(void) = (void (*)(void))(utils_interface[3]);
-    do_close();
+static inline int utils_log_write(const char *s, int len) {
+    if (!UTILS_HAS(log_write))
+        return -1;
+    return utils_interface->log_write(s, len);
 }
 
 #endif /* ifdef BOOTLOADER */
@@ -0,0 +1,228 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+
+/* Host benchmark for the OWN_MALLOC allocator in malloc.c.
+ *
+ * Replays allocation traces, one operation per line:
+ *   a <id> <size>      p[id] = malloc(size)
+ *   f <id>             free(p[id])
+ * Lines starting with '#' are comments. Blocks still allocated at the
+ * end of a trace are freed before the next pass.
+ *
+ * Usage:
+ *   malloc_bench [-n passes] [-s heap_size] trace...
+ *   malloc_bench -g ops [seed] > random.trace
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+static char *bench_heap;
+static unsigned int heap_size = 187 * 1024;
+
+#define OWN_MALLOC
+#define HEAP_START bench_heap
+#define HEAP_END   (bench_heap + heap_size)
+#define malloc     heap_malloc
+#define free       heap_free
+#include "../malloc.c"
+#undef malloc
+#undef free
+
+struct op {
+    char type;
+    unsigned int id;
+    unsigned int size;
+};
+
+struct trace {
+    struct op *ops;
+    unsigned int n_ops;
+    unsigned int max_id;
+};
+
+static int trace_load(const char *path, struct trace *t)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    unsigned int cap = 1024;
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(t, 0, sizeof(*t));
+    t->ops = malloc(cap * sizeof(struct op));
+    while (fgets(line, sizeof(line), f)) {
+        struct op o = { 0 };
+        if ((line[0] == '#') || (line[0] == '\n'))
+            continue;
+        if ((sscanf(line, "a %u %u", &o.id, &o.size) == 2))
+            o.type = 'a';
+        else if (sscanf(line, "f %u", &o.id) == 1)
+            o.type = 'f';
+        else {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            fclose(f);
+            return -1;
+        }
+        if (t->n_ops == cap) {
+            cap *= 2;
+            t->ops = realloc(t->ops, cap * sizeof(struct op));
+        }
+        if (o.id > t->max_id)
+            t->max_id = o.id;
+        t->ops[t->n_ops++] = o;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* One pass over the trace. If st_worst is not NULL, the heap statistics
+ * are sampled during the replay and the most fragmented state is kept.
+ */
+static unsigned int replay(struct trace *t, void **ptrs, struct heap_stats *st_end,
+        struct heap_stats *st_worst)
+{
+    unsigned int i, failed = 0;
+    struct heap_stats st;
+    for (i = 0; i < t->n_ops; i++) {
+        struct op *o = &t->ops[i];
+        if (o->type == 'a') {
+            heap_free(ptrs[o->id]);
+            ptrs[o->id] = heap_malloc(o->size);
+            if (!ptrs[o->id])
+                failed++;
+        } else {
+            heap_free(ptrs[o->id]);
+            ptrs[o->id] = NULL;
+        }
+        if (st_worst && ((i & 63) == 0)) {
+            heap_get_stats(&st);
+            if (st.fragmentation >= st_worst->fragmentation)
+                *st_worst = st;
+        }
+    }
+    if (st_end)
+        heap_get_stats(st_end);
+    for (i = 0; i <= t->max_id; i++) {
+        heap_free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    return failed;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Random trace: mostly small objects, a few large ones, random lifetimes */
+static void generate(unsigned int n_ops, uint32_t seed)
+{
+    enum { LIVE = 256 };
+    int live[LIVE] = { 0 };
+    unsigned int i;
+    uint32_t x = seed ? seed : 1;
+#define RAND() (x ^= x << 13, x ^= x >> 17, x ^= x << 5)
+    printf("# random trace: %u operations, seed %u\n", n_ops, seed);
+    for (i = 0; i < n_ops; i++) {
+        unsigned int id = RAND() % LIVE;
+        unsigned int r = RAND() % 100, size;
+        if (live[id]) {
+            printf("f %u\n", id);
+            live[id] = 0;
+            continue;
+        }
+        if (r < 70)
+            size = 4 + RAND() % 60;
+        else if (r < 95)
+            size = 64 + RAND() % 448;
+        else
+            size = 512 + RAND() % 3584;
+        printf("a %u %u\n", id, size);
+        live[id] = 1;
+    }
+#undef RAND
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int passes = 100;
+    int i;
+
+    if ((argc > 2) && !strcmp(argv[1], "-g")) {
+        generate(strtoul(argv[2], NULL, 0), (argc > 3) ? strtoul(argv[3], NULL, 0) : 1);
+        return 0;
+    }
+    for (i = 1; (i + 1 < argc) && (argv[i][0] == '-'); i += 2) {
+        if (!strcmp(argv[i], "-n"))
+            passes = strtoul(argv[i + 1], NULL, 0);
+        else if (!strcmp(argv[i], "-s"))
+            heap_size = strtoul(argv[i + 1], NULL, 0);
+    }
+    if ((i >= argc) || (passes == 0)) {
+        fprintf(stderr, "Usage: %s [-n passes] [-s heap_size] trace...\n"
+                "       %s -g ops [seed]\n", argv[0], argv[0]);
+        return 1;
+    }
+    bench_heap = malloc(heap_size + ALIGNMENT);
+
+    printf("%-20s %8s %8s %10s %10s %10s %12s %7s\n", "trace", "ops", "ns/op",
+            "highwater", "frag-worst", "frag-end", "largest-end", "failed");
+    for (; i < argc; i++) {
+        struct trace t;
+        struct heap_stats st_end, st_worst = { 0 };
+        unsigned int failed, p;
+        void **ptrs;
+        double t0, t1;
+        if (trace_load(argv[i], &t) < 0)
+            return 1;
+        ptrs = calloc(t.max_id + 1, sizeof(void *));
+
+        /* First pass collects the statistics, the others are timed */
+        failed = replay(&t, ptrs, &st_end, &st_worst);
+        t0 = now_ns();
+        for (p = 0; p < passes; p++)
+            replay(&t, ptrs, NULL, NULL);
+        t1 = now_ns();
+
+        printf("%-20s %8u %8.1f %10u %9u%% %9u%% %12u %7u\n", argv[i], t.n_ops,
+                (t1 - t0) / ((double)passes * t.n_ops),
+                st_end.high_water, st_worst.fragmentation / 10,
+                st_end.fragmentation / 10, st_end.largest_free, failed);
+        free(ptrs);
+        free(t.ops);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef HEAP_H_INCLUDED
+#define HEAP_H_INCLUDED
+#include <stdint.h>
+
+/* Statistics of the OWN_MALLOC allocator (malloc.c), in bytes */
+struct heap_stats {
+    uint32_t size;          /* managed by the allocator */
+    uint32_t in_use;        /* in allocated blocks, headers included */
+    uint32_t high_water;    /* highest in_use so far */
+    uint32_t total_free;    /* in free blocks */
+    uint32_t free_blocks;   /* number of free blocks */
+    uint32_t largest_free;  /* largest request that can succeed now */
+    uint32_t fragmentation; /* 1 - largest free block / free, per mille */
+};
+
+void heap_get_stats(struct heap_stats *st);
+
+#endif
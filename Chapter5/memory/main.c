@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include "pool.h"
 
 
 
@@ -54,11 +55,18 @@ void fn0(void)
 }
 
 
+/* Fixed-size message buffers, usable from ISRs: not taken from the heap */
+POOL_DEFINE(msg_pool, 32, 8);
+
 extern int mpu_enable(void);
 
 void main(void) {
+    void *msg;
+    pool_init();
     mpu_enable();
     fn0();
+    msg = pool_alloc(&msg_pool);
+    pool_free(&msg_pool, msg);
 
     while(1);;
 }
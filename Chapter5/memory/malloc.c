@@ -28,81 +28,292 @@
  * SOFTWARE.
  */
 extern unsigned int _start_heap;
+#ifndef NULL
 #define NULL (((void *)0))
+#endif
 
 #ifdef OWN_MALLOC
-struct malloc_block {
-    unsigned int signature;
-    unsigned int size;
+#include <stdint.h>
+#include "heap.h"
+
+/* Heap boundaries, from the linker script */
+#ifndef HEAP_START
+extern unsigned int _end_heap;
+#define HEAP_START ((char *)&_start_heap)
+#define HEAP_END   ((char *)&_end_heap)
+#endif
+
+/* Segregated free lists with boundary tags.
+ *
+ * Every block is preceded by a header word: the block size (a multiple
+ * of 8, header included) and two flags. Free blocks also keep the links
+ * of their free list in the payload, and a copy of the size in their last
+ * word (footer), so that free() finds the previous block in O(1).
+ *
+ *   allocated: [size|flags][payload ..................]
+ *   free:      [size|flags][next][prev] ...      [size]
+ *
+ * Two free blocks are never adjacent: free() merges them immediately.
+ *
+ * Blocks smaller than SMALL_LIMIT have one list per exact size, so small
+ * requests are served from the head of their list in O(1). Larger
+ * blocks are kept in power-of-two size ranges. A bitmap of the non-empty
+ * lists finds the first list with a large enough block without scanning.
+ */
+struct free_links {
+    char *next;
+    char *prev;
 };
 
-#define SIGNATURE_IN_USE (0xAAC0FFEE)
-#define SIGNATURE_FREED  (0xFEEDFACE)
+#define ALIGNMENT       (8)
+#define HDR_SIZE        (sizeof(uint32_t))
+#define ALIGN_UP(x)     (((x) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+#define MIN_BLOCK       ALIGN_UP(HDR_SIZE + sizeof(struct free_links) + HDR_SIZE)
+#define IN_USE          (0x01)
+#define PREV_IN_USE     (0x02)
+#define SIZE_MASK       (~0x07U)
 
-void *malloc(unsigned int size)
+#define SMALL_LIMIT     (128)
+#define SMALL_LIMIT_LOG (7)
+#define N_SMALL_BINS    ((SMALL_LIMIT - MIN_BLOCK) / ALIGNMENT)
+#define N_LARGE_BINS    (11)    /* 128 B .. 128 KB and above */
+#define N_BINS          (N_SMALL_BINS + N_LARGE_BINS)
+
+static char *bins[N_BINS];
+static uint32_t bin_map;
+static char *heap_first;
+static char *heap_last;
+static uint32_t heap_in_use;
+static uint32_t heap_high_water;
+
+#define HDR(bp)         (*(uint32_t *)((bp) - HDR_SIZE))
+#define BLK_SIZE(bp)    (HDR(bp) & SIZE_MASK)
+#define FTR(bp)         (*(uint32_t *)((bp) + BLK_SIZE(bp) - 2 * HDR_SIZE))
+#define NEXT_BLK(bp)    ((bp) + BLK_SIZE(bp))
+#define PREV_BLK(bp)    ((bp) - (*(uint32_t *)((bp) - 2 * HDR_SIZE) & SIZE_MASK))
+#define LINKS(bp)       ((struct free_links *)(bp))
+
+static int bin_index(uint32_t size)
 {
-    static unsigned int *end_heap = 0;
-    struct malloc_block *blk;
-    char *ret = NULL;
-    if (((size >>2) << 2) != size)
-        size = ((size >> 2) + 1) << 2;
-    if (!end_heap) {
-        end_heap = &_start_heap;
-    }
-    blk = (struct malloc_block *)&_start_heap;
-    while ((unsigned int *)blk < end_heap) {
-        if ((blk->signature == SIGNATURE_FREED) && (blk->size >= size)) {
-            blk->signature = SIGNATURE_IN_USE;
-            ret = ((char *)blk) + sizeof(struct malloc_block);
-            return ret;
+    int idx;
+    if (size < SMALL_LIMIT)
+        return (size - MIN_BLOCK) / ALIGNMENT;
+    idx = N_SMALL_BINS + (31 - __builtin_clz(size)) - SMALL_LIMIT_LOG;
+    if (idx >= N_BINS)
+        idx = N_BINS - 1;
+    return idx;
+}
+
+static void bin_insert(char *bp)
+{
+    int idx = bin_index(BLK_SIZE(bp));
+    LINKS(bp)->prev = NULL;
+    LINKS(bp)->next = bins[idx];
+    if (bins[idx])
+        LINKS(bins[idx])->prev = bp;
+    bins[idx] = bp;
+    bin_map |= (1U << idx);
+}
+
+static void bin_remove(char *bp)
+{
+    int idx = bin_index(BLK_SIZE(bp));
+    struct free_links *l = LINKS(bp);
+    if (l->prev)
+        LINKS(l->prev)->next = l->next;
+    else
+        bins[idx] = l->next;
+    if (l->next)
+        LINKS(l->next)->prev = l->prev;
+    if (!bins[idx])
+        bin_map &= ~(1U << idx);
+}
+
+/* The whole heap starts as a single free block, followed by an
+ * allocated, zero-sized block that stops the coalescing at the top.
+ */
+static void heap_init(void)
+{
+    uintptr_t first = ALIGN_UP((uintptr_t)HEAP_START + HDR_SIZE);
+    uintptr_t last = ((uintptr_t)HEAP_END) & ~(ALIGNMENT - 1);
+    heap_first = (char *)first;
+    heap_last = (char *)last;
+    HDR(heap_last) = IN_USE;
+    if (last < first + MIN_BLOCK)
+        return;
+    HDR(heap_first) = (uint32_t)(last - first) | PREV_IN_USE;
+    FTR(heap_first) = (uint32_t)(last - first);
+    bin_insert(heap_first);
+}
+
+static char *find_fit(uint32_t asize)
+{
+    int idx = bin_index(asize);
+    uint32_t map;
+    char *bp;
+    if (idx >= N_SMALL_BINS) {
+        /* Large ranges: first fit within the range */
+        for (bp = bins[idx]; bp; bp = LINKS(bp)->next) {
+            if (BLK_SIZE(bp) >= asize)
+                return bp;
         }
-        blk = (struct malloc_block *)(((char *)blk) + sizeof(struct malloc_block) + blk->size);
+    } else if (bins[idx]) {
+        return bins[idx];
     }
-    blk = (struct malloc_block *)end_heap;
-    blk->signature = SIGNATURE_IN_USE;
-    blk->size = size;
-    ret = ((char *)end_heap) + sizeof(struct malloc_block);
-    end_heap = (unsigned int *)(ret + size);
-    return ret;
+    /* Any block in a higher list is big enough */
+    if (idx + 1 >= N_BINS)
+        return NULL;
+    map = bin_map & ~((2U << idx) - 1);
+    if (!map)
+        return NULL;
+    return bins[__builtin_ctz(map)];
+}
+
+/* Allocate asize bytes from the free block bp, split off the rest */
+static void place(char *bp, uint32_t asize)
+{
+    uint32_t size = BLK_SIZE(bp);
+    uint32_t prev = HDR(bp) & PREV_IN_USE;
+    char *rest;
+    bin_remove(bp);
+    if (size - asize >= MIN_BLOCK) {
+        HDR(bp) = asize | prev | IN_USE;
+        rest = NEXT_BLK(bp);
+        HDR(rest) = (size - asize) | PREV_IN_USE;
+        FTR(rest) = size - asize;
+        bin_insert(rest);
+    } else {
+        HDR(bp) = size | prev | IN_USE;
+        HDR(NEXT_BLK(bp)) |= PREV_IN_USE;
+    }
+    heap_in_use += BLK_SIZE(bp);
+    if (heap_in_use > heap_high_water)
+        heap_high_water = heap_in_use;
+}
+
+void *malloc(unsigned int size)
+{
+    uint32_t asize;
+    char *bp;
+    if (!heap_first)
+        heap_init();
+    if ((size == 0) || (size > (uint32_t)(heap_last - heap_first)))
+        return NULL;
+    /* The footer is only needed while the block is free */
+    asize = ALIGN_UP(size + HDR_SIZE);
+    if (asize < MIN_BLOCK)
+        asize = MIN_BLOCK;
+    bp = find_fit(asize);
+    if (!bp)
+        return NULL;
+    place(bp, asize);
+    return bp;
 }
 
 void free(void *ptr)
 {
-    struct malloc_block *blk = (struct malloc_block *) (((char *)ptr)-sizeof(struct malloc_block));
-    if (!ptr)
+    char *bp = ptr;
+    char *next;
+    uint32_t size;
+    if ((bp < heap_first) || (bp >= heap_last))
         return;
-    if (blk->signature != SIGNATURE_IN_USE)
+    if ((HDR(bp) & IN_USE) == 0)
         return;
-    blk->signature = SIGNATURE_FREED;
+    size = BLK_SIZE(bp);
+    heap_in_use -= size;
+
+    next = NEXT_BLK(bp);
+    if ((HDR(next) & IN_USE) == 0) {
+        bin_remove(next);
+        size += BLK_SIZE(next);
+    }
+    if ((HDR(bp) & PREV_IN_USE) == 0) {
+        bp = PREV_BLK(bp);
+        bin_remove(bp);
+        size += BLK_SIZE(bp);
+    }
+    /* The block before a free block is always in use */
+    HDR(bp) = size | PREV_IN_USE;
+    FTR(bp) = size;
+    HDR(NEXT_BLK(bp)) &= ~PREV_IN_USE;
+    bin_insert(bp);
+}
+
+void heap_get_stats(struct heap_stats *st)
+{
+    int idx;
+    char *bp;
+    if (!heap_first)
+        heap_init();
+    st->size = heap_last - heap_first;
+    st->in_use = heap_in_use;
+    st->high_water = heap_high_water;
+    st->total_free = 0;
+    st->free_blocks = 0;
+    st->largest_free = 0;
+    for (idx = 0; idx < N_BINS; idx++) {
+        for (bp = bins[idx]; bp; bp = LINKS(bp)->next) {
+            st->total_free += BLK_SIZE(bp);
+            st->free_blocks++;
+            if (BLK_SIZE(bp) > st->largest_free)
+                st->largest_free = BLK_SIZE(bp);
+        }
+    }
+    /* Free memory that cannot be returned by one allocation */
+    st->fragmentation = 0;
+    if (st->total_free)
+        st->fragmentation = 1000 - (uint32_t)(((uint64_t)st->largest_free * 1000) / st->total_free);
+    /* Usable bytes */
+    if (st->largest_free)
+        st->largest_free -= HDR_SIZE;
 }
 
 #else /* Use newlib's malloc, only implement _sbrk() */
+#include <stddef.h>
+#include <errno.h>
+#include <reent.h>
 
-void * _sbrk(unsigned int incr)
+/* The heap may not grow past _end_heap (linker script), nor closer
+ * than SBRK_STACK_MARGIN bytes to the current stack pointer.
+ */
+extern unsigned int _end_heap;
+#ifndef SBRK_STACK_MARGIN
+#define SBRK_STACK_MARGIN 256
+#endif
+
+static unsigned char *heap = (unsigned char *)&_start_heap;
+
+static void *heap_grow(ptrdiff_t incr)
 {
-    static unsigned char *heap = (unsigned char *)&_start_heap;
-    void *old_heap = heap;
-    if (((incr >> 2) << 2) != incr)
-        incr = ((incr >> 2) + 1) << 2;
-
-    if (heap == NULL)
-		heap = (unsigned char *)&_start_heap;
-	else
-        heap += incr;
+    unsigned char *old_heap = heap;
+    unsigned char *limit = (unsigned char *)&_end_heap;
+    unsigned char *sp;
+
+    incr = (incr + 3) & ~3;
+    asm volatile ("mov %0, sp" : "=r"(sp));
+    if (sp - SBRK_STACK_MARGIN < limit)
+        limit = sp - SBRK_STACK_MARGIN;
+    if ((incr > limit - old_heap) ||
+            (incr < (unsigned char *)&_start_heap - old_heap))
+        return (void *)-1;
+    heap += incr;
     return old_heap;
 }
 
-void * _sbrk_r(unsigned int incr)
+void * _sbrk(ptrdiff_t incr)
 {
-    static unsigned char *heap = NULL;
-    void *old_heap = heap;
-    if (((incr >> 2) << 2) != incr)
-        incr = ((incr >> 2) + 1) << 2;
+    void *ret = heap_grow(incr);
+    if (ret == (void *)-1)
+        errno = ENOMEM;
+    return ret;
+}
 
-    if (old_heap == NULL)
-		old_heap = heap = (unsigned char *)&_start_heap;
-    heap += incr;
-    return old_heap;
+void * _sbrk_r(struct _reent *r, ptrdiff_t incr)
+{
+    void *ret = heap_grow(incr);
+    if (ret == (void *)-1)
+        r->_errno = ENOMEM;
+    return ret;
 }
 
 #endif
@@ -28,6 +28,8 @@
  * SOFTWARE.
  */
 #include <stdint.h>
+#include "system.h"
+#include "adc.h"
 
 
 /* ADC */
@@ -43,14 +45,71 @@
 #define ADC1_CR2        (*(volatile uint32_t *)(ADC1_BASE + 0x08))
 #define ADC1_SMPR1      (*(volatile uint32_t *)(ADC1_BASE + 0x0c))
 #define ADC1_SMPR2      (*(volatile uint32_t *)(ADC1_BASE + 0x10))
+#define ADC1_SQR1       (*(volatile uint32_t *)(ADC1_BASE + 0x2c))
+#define ADC1_SQR2       (*(volatile uint32_t *)(ADC1_BASE + 0x30))
 #define ADC1_SQR3       (*(volatile uint32_t *)(ADC1_BASE + 0x34))
 #define ADC1_DR         (*(volatile uint32_t *)(ADC1_BASE + 0x4c))
 #define ADC_CR1_SCAN            (1 << 8)
+#define ADC_CR1_OVRIE           (1 << 26)
 #define ADC_CR2_EN              (1 << 0)
 #define ADC_CR2_CONT            (1 << 1)
+#define ADC_CR2_DMA             (1 << 8)
+#define ADC_CR2_DDS             (1 << 9)
+#define ADC_CR2_EXTSEL_SHIFT    (24)
+#define ADC_CR2_EXTSEL_TIM2_TRGO (0x6 << ADC_CR2_EXTSEL_SHIFT)
+#define ADC_CR2_EXTEN_RISING    (1 << 28)
+#define ADC_CR2_EXTEN_MASK      (3 << 28)
 #define ADC_CR2_SWSTART         (1 << 30)
 #define ADC_SR_EOC              (1 << 1)
+#define ADC_SR_OVR              (1 << 5)
+#define ADC_SMPR_SMP_15CYC      (0x1)
 #define ADC_SMPR_SMP_480CYC     (0x7)
+#define ADC_SQR1_L_SHIFT        (20)
+#define ADC_COM_CCR_TSVREFE     (1 << 23)
+#define ADC_MAX_CHANNEL         (18)
+/* APB2 runs at CPU_FREQ / 2, the ADC at half of that (ADCPRE = 0) */
+#define ADC_CLOCK               (CPU_FREQ / 4)
+/* 15 cycles of sampling (ADC_SMPR_SMP_15CYC) and 12 of conversion */
+#define ADC_CONV_CYCLES         (15 + 12)
+
+/* DMA2, stream 0, channel 0 is wired to ADC1 */
+#define AHB1_DMA2_CLOCK_ER      (1 << 22)
+#define DMA2_BASE       (0x40026400)
+#define DMA2_LISR       (*(volatile uint32_t *)(DMA2_BASE + 0x00))
+#define DMA2_LIFCR      (*(volatile uint32_t *)(DMA2_BASE + 0x08))
+#define DMA2_S0CR       (*(volatile uint32_t *)(DMA2_BASE + 0x10))
+#define DMA2_S0NDTR     (*(volatile uint32_t *)(DMA2_BASE + 0x14))
+#define DMA2_S0PAR      (*(volatile uint32_t *)(DMA2_BASE + 0x18))
+#define DMA2_S0M0AR     (*(volatile uint32_t *)(DMA2_BASE + 0x1c))
+#define DMA2_S0M1AR     (*(volatile uint32_t *)(DMA2_BASE + 0x20))
+#define DMA_SCR_EN              (1 << 0)
+#define DMA_SCR_TEIE            (1 << 2)
+#define DMA_SCR_TCIE            (1 << 4)
+#define DMA_SCR_CIRC            (1 << 8)
+#define DMA_SCR_MINC            (1 << 10)
+#define DMA_SCR_PSIZE_16        (1 << 11)
+#define DMA_SCR_MSIZE_16        (1 << 13)
+#define DMA_SCR_PL_HIGH         (2 << 16)
+#define DMA_SCR_DBM             (1 << 18)
+#define DMA_SCR_CT              (1 << 19)
+#define DMA_S0_FLAGS            (0x3D)
+#define DMA_LISR_TEIF0          (1 << 3)
+#define DMA_LISR_TCIF0          (1 << 5)
+
+/* TIM2 generates the conversion trigger (TRGO on update) */
+#define APB1_CLOCK_ER           (*(volatile uint32_t *)(0x40023840))
+#define TIM2_APB1_CLOCK_ER_VAL  (1 << 0)
+#define TIM2_BASE       (0x40000000)
+#define TIM2_CR1        (*(volatile uint32_t *)(TIM2_BASE + 0x00))
+#define TIM2_CR2        (*(volatile uint32_t *)(TIM2_BASE + 0x04))
+#define TIM2_PSC        (*(volatile uint32_t *)(TIM2_BASE + 0x28))
+#define TIM2_ARR        (*(volatile uint32_t *)(TIM2_BASE + 0x2c))
+#define TIM2_EGR        (*(volatile uint32_t *)(TIM2_BASE + 0x14))
+#define TIM_CR1_CEN             (1 << 0)
+#define TIM_CR2_MMS_UPDATE      (2 << 4)
+#define TIM_EGR_UG              (1 << 0)
+/* APB1 runs at CPU_FREQ / 4, timers on APB1 at twice that */
+#define TIM2_CLOCK              (CPU_FREQ / 2)
 
 
 
@@ -63,6 +122,18 @@
 #define ADC_PIN     (1)
 #define ADC_PIN_CHANNEL (9)
 
+/* SMPR2 holds channels 0 to 9, SMPR1 channels 10 to 18 */
+static void adc_set_sample_time(int channel, uint32_t smp)
+{
+    if (channel > 9) {
+        uint32_t val = ADC1_SMPR1 & ~(0x7 << ((channel - 10) * 3));
+        ADC1_SMPR1 = val | (smp << ((channel - 10) * 3));
+    } else {
+        uint32_t val = ADC1_SMPR2 & ~(0x7 << (channel * 3));
+        ADC1_SMPR2 = val | (smp << (channel * 3));
+    }
+}
+
 int adc_init(void)
 {
     /* Enable clock */
@@ -85,15 +156,7 @@ int adc_init(void)
     ADC1_CR2 &= ~(ADC_CR2_CONT);
 
     /* Set sample time for channel */
-    if (ADC_PIN_CHANNEL > 9) {
-        uint32_t val = ADC1_SMPR2;
-    //    val = ADC_SMPR_SMP_480CYC << ((ADC_PIN_CHANNEL - 10) * 3);
-        ADC1_SMPR2 = val;
-    } else {
-        uint32_t val = ADC1_SMPR1;
-        val = ADC_SMPR_SMP_480CYC << (ADC_PIN_CHANNEL * 3);
-        ADC1_SMPR1 = val;
-    }
+    adc_set_sample_time(ADC_PIN_CHANNEL, ADC_SMPR_SMP_480CYC);
 
     ADC1_SQR3 |= (ADC_PIN_CHANNEL);
     ADC1_CR2 |= ADC_CR2_EN;
@@ -109,3 +172,196 @@ int adc_read(void)
     while ((ADC1_SR & ADC_SR_EOC) == 0);;
     return (int)(ADC1_DR);
 }
+
+/* Streaming acquisition.
+ *
+ * TIM2 triggers one scan of the channel sequence per sample period. The
+ * DMA stores each conversion into two ping-pong buffers (double buffer
+ * mode): while the ADC fills one, the other is handed to the callback.
+ * The CPU only runs once per block.
+ */
+static struct {
+    uint16_t *buf[2];
+    uint32_t block_len;
+    uint8_t n_channels;
+    uint8_t oversample;
+    adc_block_cb cb;
+} stream;
+
+volatile uint32_t adc_stream_errors = 0;
+volatile uint32_t adc_stream_overruns = 0;
+
+static void adc_set_sequence(const uint8_t *channels, int n)
+{
+    int i;
+    uint32_t sqr1 = (uint32_t)(n - 1) << ADC_SQR1_L_SHIFT;
+    uint32_t sqr2 = 0, sqr3 = 0;
+    for (i = 0; i < n; i++) {
+        uint32_t ch = channels[i];
+        if (i < 6)
+            sqr3 |= ch << (i * 5);
+        else if (i < 12)
+            sqr2 |= ch << ((i - 6) * 5);
+        else
+            sqr1 |= ch << ((i - 12) * 5);
+        adc_set_sample_time(ch, ADC_SMPR_SMP_15CYC);
+    }
+    ADC1_SQR1 = sqr1;
+    ADC1_SQR2 = sqr2;
+    ADC1_SQR3 = sqr3;
+}
+
+static int adc_trigger_setup(uint32_t rate_hz)
+{
+    uint32_t ticks = TIM2_CLOCK / rate_hz;
+    uint32_t psc = 0;
+    if ((rate_hz == 0) || (ticks < 2))
+        return -1;
+    /* TIM2 is 32 bit: the prescaler is only needed for very low rates */
+    while ((ticks / (psc + 1)) > 0xFFFFFFFE)
+        psc++;
+    APB1_CLOCK_ER |= TIM2_APB1_CLOCK_ER_VAL;
+    TIM2_CR1 = 0;
+    TIM2_PSC = psc;
+    TIM2_ARR = (ticks / (psc + 1)) - 1;
+    TIM2_CR2 = TIM_CR2_MMS_UPDATE;
+    TIM2_EGR = TIM_EGR_UG;
+    return 0;
+}
+
+/* Software oversampling: average each group of 'oversample' consecutive
+ * scans, in place. Returns the number of samples left in the block.
+ */
+static uint32_t adc_decimate(uint16_t *block)
+{
+    uint32_t n = stream.n_channels, os = stream.oversample;
+    uint32_t scans = stream.block_len / n;
+    uint32_t i, c, k;
+    for (i = 0; i < scans / os; i++) {
+        for (c = 0; c < n; c++) {
+            uint32_t acc = 0;
+            for (k = 0; k < os; k++)
+                acc += block[((i * os) + k) * n + c];
+            block[i * n + c] = (uint16_t)(acc / os);
+        }
+    }
+    return (scans / os) * n;
+}
+
+/* DMA: peripheral to memory, 16 bit, double buffer, from the start of
+ * the first buffer.
+ */
+static void adc_dma_start(void)
+{
+    DMA2_S0CR = 0;
+    while (DMA2_S0CR & DMA_SCR_EN)
+        ;
+    DMA2_LIFCR = DMA_S0_FLAGS;
+    DMA2_S0PAR = (uint32_t)&ADC1_DR;
+    DMA2_S0M0AR = (uint32_t)stream.buf[0];
+    DMA2_S0M1AR = (uint32_t)stream.buf[1];
+    DMA2_S0NDTR = stream.block_len;
+    DMA2_S0CR = DMA_SCR_DBM | DMA_SCR_CIRC | DMA_SCR_MINC |
+        DMA_SCR_PSIZE_16 | DMA_SCR_MSIZE_16 | DMA_SCR_PL_HIGH |
+        DMA_SCR_TCIE | DMA_SCR_TEIE;
+    DMA2_S0CR |= DMA_SCR_EN;
+}
+
+int adc_stream_start(const uint8_t *channels, int n_channels,
+        uint32_t rate_hz, uint8_t oversample,
+        uint16_t *buf0, uint16_t *buf1, uint32_t block_len,
+        adc_block_cb cb)
+{
+    int i;
+    if ((n_channels < 1) || (n_channels > 16) || !buf0 || !buf1 || !cb)
+        return -1;
+    for (i = 0; i < n_channels; i++) {
+        if (channels[i] > ADC_MAX_CHANNEL)
+            return -1;
+    }
+    if (oversample == 0)
+        oversample = 1;
+    if ((block_len == 0) || (block_len > 0xFFFF) ||
+            (block_len % (n_channels * oversample)) != 0)
+        return -1;
+    /* Each scan must end before the next trigger, or the ADC overruns */
+    if (rate_hz > (ADC_CLOCK / (n_channels * ADC_CONV_CYCLES)) / oversample)
+        return -1;
+    adc_stream_stop();
+    stream.buf[0] = buf0;
+    stream.buf[1] = buf1;
+    stream.block_len = block_len;
+    stream.n_channels = n_channels;
+    stream.oversample = oversample;
+    stream.cb = cb;
+
+    if (adc_trigger_setup(rate_hz * oversample) < 0)
+        return -1;
+
+    /* ADC: scan the sequence on each TIM2 TRGO, request DMA per EOC */
+    ADC1_CR2 &= ~(ADC_CR2_EN | ADC_CR2_CONT);
+    adc_set_sequence(channels, n_channels);
+    ADC1_CR1 |= ADC_CR1_SCAN;
+    ADC1_SR &= ~ADC_SR_OVR;
+    ADC1_CR2 = (ADC1_CR2 & ~(ADC_CR2_EXTEN_MASK | (0xF << ADC_CR2_EXTSEL_SHIFT))) |
+        ADC_CR2_EXTEN_RISING | ADC_CR2_EXTSEL_TIM2_TRGO |
+        ADC_CR2_DMA | ADC_CR2_DDS;
+
+    AHB1_CLOCK_ER |= AHB1_DMA2_CLOCK_ER;
+    DMB();
+    adc_dma_start();
+    nvic_irq_setprio(NVIC_DMA2_STREAM0_IRQN, 1);
+    nvic_irq_enable(NVIC_DMA2_STREAM0_IRQN);
+    /* Same priority: the overrun handler does not preempt the DMA one */
+    ADC1_CR1 |= ADC_CR1_OVRIE;
+    nvic_irq_setprio(NVIC_ADC_IRQN, 1);
+    nvic_irq_enable(NVIC_ADC_IRQN);
+
+    ADC1_CR2 |= ADC_CR2_EN;
+    TIM2_CR1 |= TIM_CR1_CEN;
+    return 0;
+}
+
+void adc_stream_stop(void)
+{
+    TIM2_CR1 &= ~TIM_CR1_CEN;
+    ADC1_CR2 &= ~(ADC_CR2_EXTEN_MASK | ADC_CR2_DMA | ADC_CR2_DDS);
+    ADC1_CR1 &= ~ADC_CR1_OVRIE;
+    nvic_irq_disable(NVIC_ADC_IRQN);
+    nvic_irq_disable(NVIC_DMA2_STREAM0_IRQN);
+    DMA2_S0CR &= ~DMA_SCR_EN;
+}
+
+void isr_dma2_stream0(void)
+{
+    uint32_t isr = DMA2_LISR;
+    uint16_t *block;
+    uint32_t len;
+    if (isr & DMA_LISR_TEIF0)
+        adc_stream_errors++;
+    DMA2_LIFCR = DMA_S0_FLAGS;
+    if ((isr & DMA_LISR_TCIF0) == 0)
+        return;
+    /* CT points at the buffer now being filled: the other one is ready */
+    block = stream.buf[(DMA2_S0CR & DMA_SCR_CT) ? 0 : 1];
+    len = stream.block_len;
+    if (stream.oversample > 1)
+        len = adc_decimate(block);
+    stream.cb(block, len);
+}
+
+/* Overrun: a conversion was lost, and the ADC no longer requests DMA
+ * transfers. Restart the stream from the first buffer (the blocks in
+ * progress are dropped): reinitialize the DMA, clear OVR, and let the
+ * next trigger start a new scan.
+ */
+void isr_adc(void)
+{
+    if ((ADC1_SR & ADC_SR_OVR) == 0)
+        return;
+    adc_stream_overruns++;
+    ADC1_CR2 &= ~(ADC_CR2_EN | ADC_CR2_DMA);
+    adc_dma_start();
+    ADC1_SR &= ~ADC_SR_OVR;
+    ADC1_CR2 |= ADC_CR2_DMA | ADC_CR2_EN;
+}
@@ -30,6 +30,32 @@
 #ifndef ADC_H_INCLUDED
 #define ADC_H_INCLUDED
 
+#include <stdint.h>
+
 int adc_init(void);
 int adc_read(void);
+
+/* Called from interrupt context with a full block of samples, interleaved
+ * in sequence order (ch0, ch1, ... ch0, ch1, ...). The buffer is written
+ * again by the DMA one block later.
+ */
+typedef void (*adc_block_cb)(const uint16_t *block, uint32_t len);
+
+/* Sample 'channels' (scan sequence, up to 16) at 'rate_hz' scans per
+ * second into the ping-pong buffers buf0/buf1, each 'block_len' samples.
+ * With 'oversample' > 1 the ADC runs that many times faster and each
+ * group of scans is averaged, so blocks hold block_len / oversample
+ * samples. block_len must be a multiple of n_channels * oversample.
+ * Channels go up to 18, and a scan of the sequence must fit in the
+ * trigger period (27 ADC cycles per channel): returns -1 otherwise.
+ */
+int adc_stream_start(const uint8_t *channels, int n_channels,
+        uint32_t rate_hz, uint8_t oversample,
+        uint16_t *buf0, uint16_t *buf1, uint32_t block_len,
+        adc_block_cb cb);
+void adc_stream_stop(void);
+
+/* DMA transfer errors, and ADC overruns (the stream restarts) */
+extern volatile uint32_t adc_stream_errors;
+extern volatile uint32_t adc_stream_overruns;
 #endif
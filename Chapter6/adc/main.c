@@ -33,15 +33,35 @@
 #include "adc.h"
 
 
+#define BLOCK_LEN (256)
+static uint16_t adc_buf[2][BLOCK_LEN];
+static const uint8_t adc_channels[] = { 9 };
+static volatile uint32_t blocks = 0;
+static volatile uint32_t last_avg = 0;
+
+/* Runs once per block: check blocks and last_avg with the debugger,
+ * and adc_stream_overruns, which counts the restarts after an overrun.
+ */
+static void adc_block_ready(const uint16_t *block, uint32_t len)
+{
+    uint32_t i, acc = 0;
+    for (i = 0; i < len; i++)
+        acc += block[i];
+    last_avg = acc / len;
+    blocks++;
+}
+
 void main(void) {
     flash_set_waitstates();
     clock_config();
     adc_init();
-    while(1) {
-        /* Reading the adc value continuously.
-         * check the returned value with the debugger.
-         */
-        volatile int r = adc_read();
-    }
 
+    /* One-shot reading, as before */
+    volatile int r = adc_read();
+
+    /* 100 kS/s, 4x oversampling: 64 averaged samples per block */
+    adc_stream_start(adc_channels, sizeof(adc_channels), 100000, 4,
+            adc_buf[0], adc_buf[1], BLOCK_LEN, adc_block_ready);
+    while(1)
+        WFI();
 }
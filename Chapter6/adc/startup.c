@@ -28,11 +28,13 @@
  * SOFTWARE.
  */
 
-extern unsigned int _stored_data;
-extern unsigned int _start_data;
-extern unsigned int _end_data;
-extern unsigned int _start_bss;
-extern unsigned int _end_bss;
+/* Written by the linker script: {load address, start, end} for each
+ * section to copy, {start, end} for each one to zero
+ */
+extern unsigned int _start_copy_table;
+extern unsigned int _end_copy_table;
+extern unsigned int _start_zero_table;
+extern unsigned int _end_zero_table;
 extern unsigned int _end_stack;
 extern unsigned int _start_heap;
 
@@ -45,23 +47,94 @@ static volatile unsigned int avail_mem = 0;
 static unsigned int sp;
 
 extern void main(void);
+extern void isr_adc(void);
+extern void isr_dma2_stream0(void);
+
+/* Reset-to-main time in CPU cycles, from the DWT cycle counter (it
+ * reads 0 where there is none, e.g. in QEMU)
+ */
+#define DEMCR       (*(volatile unsigned int *)(0xE000EDFC))
+#define DWT_CTRL    (*(volatile unsigned int *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile unsigned int *)(0xE0001004))
+#define DEMCR_TRCENA        (1 << 24)
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+
+volatile unsigned int startup_cycles;
+
+/* Copy [dst, end) from src: eight words per LDM/STM pair, then the
+ * remaining words one at a time. Naked, so the loop is the same at -O0.
+ */
+static void __attribute__((naked, used)) init_copy(unsigned int *dst,
+        const unsigned int *src, unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r11}\n"
+        "1:\n"
+        "add r3, r0, #32\n"
+        "cmp r3, r2\n"
+        "bhi 2f\n"
+        "ldmia r1!, {r4-r11}\n"
+        "stmia r0!, {r4-r11}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r2\n"
+        "bhs 3f\n"
+        "ldr r3, [r1], #4\n"
+        "str r3, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r11}\n"
+        "bx lr\n"
+    );
+}
+
+/* Zero [dst, end): eight words per STM, then one at a time */
+static void __attribute__((naked, used)) init_zero(unsigned int *dst,
+        unsigned int *end)
+{
+    asm volatile(
+        "push {r4-r9}\n"
+        "mov r2, #0\n"
+        "mov r3, #0\n"
+        "mov r4, #0\n"
+        "mov r5, #0\n"
+        "mov r6, #0\n"
+        "mov r7, #0\n"
+        "mov r8, #0\n"
+        "mov r9, #0\n"
+        "1:\n"
+        "add r12, r0, #32\n"
+        "cmp r12, r1\n"
+        "bhi 2f\n"
+        "stmia r0!, {r2-r9}\n"
+        "b 1b\n"
+        "2:\n"
+        "cmp r0, r1\n"
+        "bhs 3f\n"
+        "str r2, [r0], #4\n"
+        "b 2b\n"
+        "3:\n"
+        "pop {r4-r9}\n"
+        "bx lr\n"
+    );
+}
 
 void isr_reset(void) {
-    register unsigned int *src, *dst;
-    src = (unsigned int *) &_stored_data;
-    dst = (unsigned int *) &_start_data;
-    while (dst < (unsigned int *)&_end_data) {
-        *dst = *src;
-        dst++;
-        src++;
-    }
+    register unsigned int *t, *dst;
 
-    /* Initialize the BSS section to 0 */
-    dst = &_start_bss;
-    while (dst < (unsigned int *)&_end_bss) {
-        *dst = 0U;
-        dst++;
-    }
+    /* Count the cycles from here to main() */
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    /* Copy the .data sections from flash to RAM */
+    for (t = &_start_copy_table; t < &_end_copy_table; t += 3)
+        init_copy((unsigned int *)t[1], (const unsigned int *)t[0],
+                (unsigned int *)t[2]);
+
+    /* Initialize the .bss sections to 0 (.noinit is not in the table) */
+    for (t = &_start_zero_table; t < &_end_zero_table; t += 2)
+        init_zero((unsigned int *)t[0], (unsigned int *)t[1]);
 
     /* Paint the stack. */
     avail_mem = &_end_stack - &_start_heap;
@@ -75,6 +148,8 @@ void isr_reset(void) {
         }
     }
 #endif
+    startup_cycles = DWT_CYCCNT;
+
     /* Run the program! */
     main();
 }
@@ -147,7 +222,7 @@ void (* const IV[])(void) =
     isr_empty,              // DMA1_STREAM4_IRQ 15
     isr_empty,              // DMA1_STREAM5_IRQ 16
     isr_empty,              // DMA1_STREAM6_IRQ 17
-    isr_empty,              // ADC_IRQ 18
+    isr_adc,                // ADC_IRQ 18
     isr_empty,              // CAN1_TX_IRQ 19
     isr_empty,              // CAN1_RX0_IRQ 20
     isr_empty,              // CAN1_RX1_IRQ 21
@@ -177,5 +252,14 @@ void (* const IV[])(void) =
     isr_empty,              // TIM8_TRG_COM_TIM14_IRQ 45
     isr_empty,              // TIM8_CC_IRQ 46
     isr_empty,              // DMA1_STREAM7_IRQ 47
+    isr_empty,              // FSMC_IRQ 48
+    isr_empty,              // SDIO_IRQ 49
+    isr_empty,              // TIM5_IRQ 50
+    isr_empty,              // SPI3_IRQ 51
+    isr_empty,              // UART4_IRQ 52
+    isr_empty,              // UART5_IRQ 53
+    isr_empty,              // TIM6_DAC_IRQ 54
+    isr_empty,              // TIM7_IRQ 55
+    isr_dma2_stream0,       // DMA2_STREAM0_IRQ 56
 
 };
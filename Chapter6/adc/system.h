@@ -46,7 +46,9 @@ void flash_set_waitstates(void);
 /* NVIC */
 /* NVIC ISER Base register (Cortex-M) */
 
+#define NVIC_ADC_IRQN           (18)
 #define NVIC_TIM2_IRQN          (28)
+#define NVIC_DMA2_STREAM0_IRQN  (56)
 #define NVIC_ISER_BASE (0xE000E100)
 #define NVIC_ICER_BASE (0xE000E180)
 #define NVIC_IPRI_BASE (0xE000E400)
@@ -73,17 +73,17 @@ int timer_init(uint32_t clock, uint32_t prescaler, uint32_t interval_ms)
     nvic_irq_enable(NVIC_TIM2_IRQN);
     nvic_irq_setprio(NVIC_TIM2_IRQN, 0);
     APB1_CLOCK_RST |= TIM2_APB1_CLOCK_ER_VAL;
-    __asm__ volatile ("dmb");
+    DMB();
     APB1_CLOCK_RST &= ~TIM2_APB1_CLOCK_ER_VAL;
     APB1_CLOCK_ER |= TIM2_APB1_CLOCK_ER_VAL;
 
     TIM2_CR1    = 0;
-    __asm__ volatile ("dmb");
+    DMB();
     TIM2_PSC    = psc;
     TIM2_ARR    = val;
     TIM2_CR1    |= TIM_CR1_CLOCK_ENABLE;
     TIM2_DIER   |= TIM_DIER_UIE;
-    __asm__ volatile ("dmb");
+    DMB();
     return 0;
 }
 
@@ -28,6 +28,7 @@
  * SOFTWARE.
  */
 #include <stdint.h>
+#include "system.h"
 #include "i2c.h"
 
 #define I2C1 (0x40005400)
@@ -35,27 +36,64 @@
 #define I2C1_CR2        (*(volatile uint32_t *)(I2C1 + 0x04))
 #define I2C1_OAR1       (*(volatile uint32_t *)(I2C1 + 0x08))
 #define I2C1_OAR2       (*(volatile uint32_t *)(I2C1 + 0x0c))
+#define I2C1_TIMINGR    (*(volatile uint32_t *)(I2C1 + 0x10))
+#define I2C1_TIMEOUTR   (*(volatile uint32_t *)(I2C1 + 0x14))
 #define I2C1_ISR        (*(volatile uint32_t *)(I2C1 + 0x18))
+#define I2C1_ICR        (*(volatile uint32_t *)(I2C1 + 0x1c))
 #define I2C1_RXDR       (*(volatile uint32_t *)(I2C1 + 0x24))
 #define I2C1_TXDR       (*(volatile uint32_t *)(I2C1 + 0x28))
 
 #define I2C_CR1_ENABLE              (1 << 0)
+#define I2C_CR1_TXIE                (1 << 1)
+#define I2C_CR1_RXIE                (1 << 2)
+#define I2C_CR1_NACKIE              (1 << 4)
+#define I2C_CR1_STOPIE              (1 << 5)
+#define I2C_CR1_TCIE                (1 << 6)
+#define I2C_CR1_ERRIE               (1 << 7)
+#define I2C_CR1_ALL_IE              (I2C_CR1_TXIE | I2C_CR1_RXIE | \
+        I2C_CR1_NACKIE | I2C_CR1_STOPIE | I2C_CR1_TCIE | I2C_CR1_ERRIE)
+
+#define I2C_CR2_RD_WRN              (1 << 10)
 #define I2C_CR2_START		    (1 << 13)
 #define I2C_CR2_STOP		    (1 << 14)
 #define I2C_CR2_NACK		    (1 << 15)
-#define I2C_CR2_FREQ_MASK           (0x3ff)
+#define I2C_CR2_NBYTES_SHIFT        (16)
+#define I2C_CR2_AUTOEND             (1 << 25)
 
-#define I2C_ISR_RX_NOTEMPTY  	    (1 << 2)
 #define I2C_ISR_TX_EMPTY	    (1 << 0)
-
+#define I2C_ISR_TXIS                (1 << 1)
+#define I2C_ISR_RX_NOTEMPTY  	    (1 << 2)
+#define I2C_ISR_NACKF               (1 << 4)
+#define I2C_ISR_STOPF               (1 << 5)
+#define I2C_ISR_TC                  (1 << 6)
+#define I2C_ISR_BERR                (1 << 8)
+#define I2C_ISR_ARLO                (1 << 9)
+#define I2C_ISR_TIMEOUT             (1 << 12)
 #define I2C_ISR_BUSY                (1 << 15)
 
+/* ICR clear bits have the same position as the ISR flags */
+#define I2C_ICR_ALL  (I2C_ISR_NACKF | I2C_ISR_STOPF | I2C_ISR_BERR | \
+        I2C_ISR_ARLO | I2C_ISR_TIMEOUT)
+
+#define I2C_TIMEOUTR_TIMOUTEN       (1 << 15)
+
+/* 100 kHz standard mode, I2C1 clocked from PCLK1 at 80 MHz */
+#define I2C1_TIMING_100KHZ          (0x10909CEC)
+#define I2C1_CLOCK                  (CPU_FREQ)
+
+/* SCL held low for longer than this aborts the transfer */
+#ifndef I2C1_TIMEOUT_MS
+#define I2C1_TIMEOUT_MS             (25)
+#endif
+
 #define APB1_CLOCK_RST (*(volatile uint32_t *)(0x40021038))
 #define APB1_CLOCK_ER (*(volatile uint32_t *)(0x40021058))
 #define I2C1_APB1_CLOCK_ER_VAL 	(1 << 21)
 
 #define GPIOB_BASE 0x48000400
 #define GPIOB_MODE  (*(volatile uint32_t *)(GPIOB_BASE + 0x00))
+#define GPIOB_OTYPE (*(volatile uint32_t *)(GPIOB_BASE + 0x04))
+#define GPIOB_PUPD  (*(volatile uint32_t *)(GPIOB_BASE + 0x0c))
 #define GPIOB_AFL   (*(volatile uint32_t *)(GPIOB_BASE + 0x20))
 #define GPIOB_AFH   (*(volatile uint32_t *)(GPIOB_BASE + 0x24))
 
@@ -77,7 +115,14 @@ static void i2c1_pins_setup(void)
     reg = GPIOB_MODE & ~ (0x03 << (I2C1_SDA * 2));
     GPIOB_MODE = reg | (2 << (I2C1_SDA * 2));
 
+    /* Open drain, with pull-ups */
+    GPIOB_OTYPE |= (1 << I2C1_SCL) | (1 << I2C1_SDA);
+    reg = GPIOB_PUPD & ~((0x03 << (I2C1_SCL * 2)) | (0x03 << (I2C1_SDA * 2)));
+    GPIOB_PUPD = reg | (1 << (I2C1_SCL * 2)) | (1 << (I2C1_SDA * 2));
+
     /* Alternate function: */
+    reg =  GPIOB_AFH & ~(0xf << ((I2C1_SCL - 8) * 4));
+    GPIOB_AFH = reg | (I2C1_PIN_AF << ((I2C1_SCL - 8) * 4));
     reg =  GPIOB_AFH & ~(0xf << ((I2C1_SDA - 8) * 4));
     GPIOB_AFH = reg | (I2C1_PIN_AF << ((I2C1_SDA - 8) * 4));
 }
@@ -88,57 +133,166 @@ static void i2c1_reset(void)
     APB1_CLOCK_RST &= ~I2C1_APB1_CLOCK_ER_VAL;
 }
 
-static void i2c1_send_start(void)
+/* Transaction queue. The head is the transaction on the bus. */
+static struct i2c_xfer *xfer_head = 0;
+static struct i2c_xfer *xfer_tail = 0;
+static uint8_t xfer_idx;
+static int xfer_rx_phase;
+
+static void i2c1_irq_onoff(int enable)
 {
-    I2C1_CR2 |= I2C_CR2_START;
+    if (enable) {
+        nvic_irq_enable(NVIC_I2C1_EV_IRQN);
+        nvic_irq_enable(NVIC_I2C1_ER_IRQN);
+    } else {
+        nvic_irq_disable(NVIC_I2C1_EV_IRQN);
+        nvic_irq_disable(NVIC_I2C1_ER_IRQN);
+    }
 }
 
-static void i2c1_send_stop(void)
+/* Address the target for the current phase. A write phase followed by a
+ * read phase does not end with a STOP: TC fires instead, and the read
+ * phase begins with a repeated START.
+ */
+static void i2c1_start_phase(struct i2c_xfer *x)
 {
-    I2C1_CR2 |= I2C_CR2_STOP;
+    uint32_t cr2 = ((uint32_t)x->addr << 1) | I2C_CR2_START;
+    xfer_idx = 0;
+    if ((x->tx_len > 0) && !xfer_rx_phase) {
+        cr2 |= (uint32_t)x->tx_len << I2C_CR2_NBYTES_SHIFT;
+        if (x->rx_len == 0)
+            cr2 |= I2C_CR2_AUTOEND;
+    } else {
+        xfer_rx_phase = 1;
+        cr2 |= I2C_CR2_RD_WRN | I2C_CR2_AUTOEND;
+        cr2 |= (uint32_t)x->rx_len << I2C_CR2_NBYTES_SHIFT;
+    }
+    I2C1_CR2 = cr2;
 }
 
-void i2c1_test_sequence(void)
+static void i2c1_start_next(void)
 {
-    volatile uint32_t isr;
-    const uint8_t address = 0x42;
-    I2C1_CR1 &= ~I2C_CR1_ENABLE;
-    I2C1_CR2 &= ~I2C_CR2_STOP;
-    I2C1_CR2 &= ~I2C_CR2_NACK;
-    I2C1_CR1 |= I2C_CR1_ENABLE;
+    if (!xfer_head)
+        return;
+    xfer_rx_phase = 0;
+    i2c1_start_phase(xfer_head);
+}
 
-    /* Wait if the bus is busy */
-    do {
-        isr = I2C1_ISR;
-    } while ((isr & I2C_ISR_BUSY) != 0);;
-    
-    /* Send a start condition */
-    i2c1_send_start;
-
-    /* Send address + R/W = 0 */
-    I2C1_TXDR = (address << 1);
-    do {
-        isr = I2C1_ISR;
-    } while ((isr & I2C_ISR_BUSY) != I2C_ISR_BUSY);;
-    I2C1_TXDR = (0x00);
-    do {
-        isr = I2C1_ISR;
-    } while ((isr & I2C_ISR_TX_EMPTY) != 0);;
-    I2C1_TXDR = (0x01);
-    do {
-        isr = I2C1_ISR;
-    } while ((isr & I2C_ISR_TX_EMPTY) != 0);;
-
-    i2c1_send_stop();
+static void i2c1_complete(int status)
+{
+    struct i2c_xfer *x = xfer_head;
+    int queued;
+    xfer_head = x->next;
+    if (!xfer_head)
+        xfer_tail = 0;
+    x->next = 0;
+    x->status = status;
+    /* With an empty queue, a transaction submitted by the callback is
+     * started by i2c1_submit() itself: only start the ones that were
+     * already waiting.
+     */
+    queued = (xfer_head != 0);
+    if (x->complete)
+        x->complete(x, status);
+    if (queued)
+        i2c1_start_next();
+}
+
+int i2c1_submit(struct i2c_xfer *x)
+{
+    if ((x == 0) || ((x->tx_len == 0) && (x->rx_len == 0)))
+        return -1;
+    if ((x->rx_len > 0) && (x->rx_buf == 0))
+        return -1;
+    if ((x->tx_len > 0) && (x->tx_buf == 0))
+        return -1;
+    x->status = I2C_XFER_PENDING;
+    x->next = 0;
+    i2c1_irq_onoff(0);
+    if (xfer_tail) {
+        xfer_tail->next = x;
+        xfer_tail = x;
+    } else {
+        xfer_head = xfer_tail = x;
+        i2c1_start_next();
+    }
+    i2c1_irq_onoff(1);
+    return 0;
+}
+
+int i2c1_busy(void)
+{
+    return xfer_head != 0;
+}
+
+void isr_i2c1(void)
+{
+    struct i2c_xfer *x = xfer_head;
+    uint32_t isr = I2C1_ISR;
+
+    if (isr & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_TIMEOUT)) {
+        I2C1_ICR = I2C_ICR_ALL;
+        /* Reset the state machine, the bus may be left without a STOP */
+        I2C1_CR1 &= ~I2C_CR1_ENABLE;
+        DMB();
+        I2C1_CR1 |= I2C_CR1_ENABLE;
+        if (x)
+            i2c1_complete((isr & I2C_ISR_TIMEOUT) ?
+                    I2C_XFER_TIMEOUT : I2C_XFER_ERROR);
+        return;
+    }
+    if (!x) {
+        I2C1_ICR = I2C_ICR_ALL;
+        return;
+    }
+    if (isr & I2C_ISR_NACKF) {
+        /* A STOP follows automatically, finish on STOPF */
+        I2C1_ICR = I2C_ISR_NACKF;
+        x->status = I2C_XFER_NACK;
+    }
+    if (isr & I2C_ISR_TXIS)
+        I2C1_TXDR = x->tx_buf[xfer_idx++];
+    if (isr & I2C_ISR_RX_NOTEMPTY) {
+        uint8_t b = I2C1_RXDR;
+        if (xfer_idx < x->rx_len)
+            x->rx_buf[xfer_idx++] = b;
+    }
+    if ((isr & I2C_ISR_TC) && !xfer_rx_phase) {
+        /* Write phase done: repeated START for the read phase */
+        xfer_rx_phase = 1;
+        i2c1_start_phase(x);
+    }
+    if (isr & I2C_ISR_STOPF) {
+        I2C1_ICR = I2C_ISR_STOPF;
+        I2C1_CR2 = 0;
+        i2c1_complete((x->status == I2C_XFER_NACK) ?
+                I2C_XFER_NACK : I2C_XFER_OK);
+    }
 }
 
 void i2c1_setup(void)
 {
-    uint32_t reg;
+    uint32_t timeout;
     i2c1_pins_setup();
     APB1_CLOCK_ER |= I2C1_APB1_CLOCK_ER_VAL;
     I2C1_CR1 &= ~I2C_CR1_ENABLE;
     i2c1_reset();
 
+    I2C1_TIMINGR = I2C1_TIMING_100KHZ;
+
+    /* SCL low timeout: (TIMEOUTA + 1) * 2048 I2C clock cycles */
+    timeout = ((I2C1_CLOCK / 1000) * I2C1_TIMEOUT_MS) / 2048;
+    if (timeout > 0x1000)
+        timeout = 0x1000;
+    if (timeout == 0)
+        timeout = 1;
+    I2C1_TIMEOUTR = (timeout - 1);
+    I2C1_TIMEOUTR |= I2C_TIMEOUTR_TIMOUTEN;
+
+    I2C1_CR1 |= I2C_CR1_ALL_IE;
+    nvic_irq_setprio(NVIC_I2C1_EV_IRQN, 0);
+    nvic_irq_setprio(NVIC_I2C1_ER_IRQN, 0);
+    i2c1_irq_onoff(1);
+
     I2C1_CR1 |= I2C_CR1_ENABLE;
 }
@@ -32,10 +32,34 @@
 #include <stdint.h>
 
 
-void i2c1_setup(void);
-void i2c1_write(uint8_t addr, const char byte);
-uint8_t i2c1_read(uint8_t addr);
+/* Transaction status */
+#define I2C_XFER_OK         (0)
+#define I2C_XFER_PENDING    (1)
+#define I2C_XFER_NACK       (-1)
+#define I2C_XFER_TIMEOUT    (-2)
+#define I2C_XFER_ERROR      (-3)
+
+/* One I2C transaction, queued with i2c1_submit():
+ *  - write:                tx_len > 0, rx_len == 0
+ *  - read:                 tx_len == 0, rx_len > 0
+ *  - write-then-read:      tx_len > 0, rx_len > 0 (repeated START)
+ * The structure and the buffers belong to the driver until 'complete'
+ * is called, from interrupt context.
+ */
+struct i2c_xfer {
+    uint8_t addr;               /* 7-bit target address */
+    const uint8_t *tx_buf;
+    uint8_t tx_len;
+    uint8_t *rx_buf;
+    uint8_t rx_len;
+    void (*complete)(struct i2c_xfer *x, int status);
+    void *arg;
+    volatile int status;
+    struct i2c_xfer *next;
+};
 
-void i2c1_test_sequence(void);
+void i2c1_setup(void);
+int i2c1_submit(struct i2c_xfer *x);
+int i2c1_busy(void);
 
 #endif
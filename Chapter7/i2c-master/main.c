@@ -32,18 +32,40 @@
 #include "i2c.h"
 
 
+static const uint8_t test_sequence[2] = { 0x00, 0x01 };
+static const uint8_t reg_addr = 0x00;
+static uint8_t reg_value;
+static volatile int last_status = I2C_XFER_PENDING;
+
+static void xfer_done(struct i2c_xfer *x, int status)
+{
+    last_status = status;
+}
+
 void main(void) {
-    uint8_t b;
-    int i;
+    const uint8_t address = 0x42;
+    struct i2c_xfer wr = {
+        .addr = address,
+        .tx_buf = test_sequence,
+        .tx_len = sizeof(test_sequence),
+    };
+    struct i2c_xfer wr_rd = {
+        .addr = address,
+        .tx_buf = &reg_addr,
+        .tx_len = 1,
+        .rx_buf = &reg_value,
+        .rx_len = 1,
+        .complete = xfer_done,
+    };
     flash_set_waitstates();
     clock_config();
     i2c1_setup();
 
-    i2c1_test_sequence();
-    for (i = 0; i < 9999999; i++) {
-        asm volatile("nop");
-    }
-    i2c1_test_sequence();
+    /* Both are queued, the CPU is free until the callback */
+    i2c1_submit(&wr);
+    i2c1_submit(&wr_rd);
+    while (last_status == I2C_XFER_PENDING)
+        WFI();
     while(1)
         WFI();
 }
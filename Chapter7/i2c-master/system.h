@@ -35,8 +35,14 @@
 #define PLL_FULL_MASK (0xFFFFFFFF)
 
 /* Assembly helpers */
+#ifdef HOST_SIM
+#include "hostsim.h"
+#define DMB() __sync_synchronize();
+#define WFI() hostsim_wfi();
+#else
 #define DMB() __asm__ volatile ("dmb");
 #define WFI() __asm__ volatile ("wfi");
+#endif
 
 /* Master clock setting */
 void clock_config(void);
@@ -47,6 +53,8 @@ void flash_set_waitstates(void);
 /* NVIC ISER Base register (Cortex-M) */
 
 #define NVIC_TIM2_IRQN          (28)
+#define NVIC_I2C1_EV_IRQN       (31)
+#define NVIC_I2C1_ER_IRQN       (32)
 #define NVIC_ISER_BASE (0xE000E100)
 #define NVIC_ICER_BASE (0xE000E180)
 #define NVIC_IPRI_BASE (0xE000E400)
@@ -0,0 +1,119 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include "system.h"
+#include "uart.h"
+#include "pool.h"
+
+static uint8_t rx_dma_buf[256];
+static const char hello[] = "Hello World!\r\n";
+static volatile int hello_sent = 0;
+
+static void hello_complete(void)
+{
+    hello_sent = 1;
+}
+
+/* Each received slice is copied to message buffers taken from a pool,
+ * in the RX interrupt: the data no longer waits in the circular DMA
+ * buffer, and no heap is involved. The TX completion interrupt returns
+ * each buffer to the pool once sent.
+ */
+#define ECHO_MSG_SIZE 32
+struct echo_msg {
+    struct echo_msg *next;
+    uint32_t len;
+    uint8_t data[ECHO_MSG_SIZE];
+};
+POOL_DEFINE(echo_pool, sizeof(struct echo_msg), 8);
+
+/* Messages waiting for TX, oldest first, and the one being sent */
+static struct echo_msg *echo_head = NULL, *echo_tail = NULL;
+static struct echo_msg *echo_sending = NULL;
+
+/* Bytes received while the pool was empty */
+volatile uint32_t echo_dropped = 0;
+
+static void echo_next(void)
+{
+    struct echo_msg *m = echo_sending;
+    echo_sending = NULL;
+    if (m)
+        pool_free(&echo_pool, m);
+    m = echo_head;
+    if (!m)
+        return;
+    echo_head = m->next;
+    if (!echo_head)
+        echo_tail = NULL;
+    echo_sending = m;
+    usart2_write(m->data, m->len, echo_next);
+}
+
+static void echo(const uint8_t *data, uint32_t len)
+{
+    struct echo_msg *m;
+    uint32_t i, n;
+    while (len > 0) {
+        m = pool_alloc(&echo_pool);
+        if (!m) {
+            echo_dropped += len;
+            break;
+        }
+        n = (len > ECHO_MSG_SIZE) ? ECHO_MSG_SIZE : len;
+        for (i = 0; i < n; i++)
+            m->data[i] = data[i];
+        m->len = n;
+        m->next = NULL;
+        if (echo_tail)
+            echo_tail->next = m;
+        else
+            echo_head = m;
+        echo_tail = m;
+        data += n;
+        len -= n;
+    }
+    if (!echo_sending)
+        echo_next();
+}
+
+void main(void) {
+    flash_set_waitstates();
+    clock_config();
+    pool_init();
+    usart2_setup(115200, 8, 'N', 1);
+    usart2_write(hello, sizeof(hello) - 1, hello_complete);
+    while (!hello_sent)
+        WFI();
+    usart2_read_start(rx_dma_buf, sizeof(rx_dma_buf), echo);
+    while(1)
+        WFI();
+}
@@ -0,0 +1,147 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "pool.h"
+
+#ifdef HOST_SIM
+/* Host build: the simulator delivers interrupts on peripheral register
+ * accesses only, so nothing can interrupt the free list updates.
+ */
+extern struct pool __start_pools;
+extern struct pool __stop_pools;
+#define _start_pools __start_pools
+#define _end_pools __stop_pools
+
+static inline void *ldrex(void *volatile *addr)
+{
+    return *addr;
+}
+
+static inline int strex(void *val, void *volatile *addr)
+{
+    *addr = val;
+    return 0;
+}
+
+#define clrex() do {} while (0)
+#else
+extern struct pool _start_pools;
+extern struct pool _end_pools;
+
+/* Exclusive access helpers. The exclusive monitor is cleared on every
+ * exception entry and return, so a pop interrupted by an ISR that
+ * takes and returns the same object fails its STREX and retries: the
+ * ABA problem of a compare-and-swap free list does not apply.
+ */
+static inline void *ldrex(void *volatile *addr)
+{
+    void *val;
+    __asm__ volatile ("ldrex %0, [%1]" : "=r"(val) : "r"(addr) : "memory");
+    return val;
+}
+
+static inline int strex(void *val, void *volatile *addr)
+{
+    int failed;
+    __asm__ volatile ("strex %0, %2, [%1]" : "=&r"(failed) : "r"(addr), "r"(val) : "memory");
+    return failed;
+}
+
+#define clrex() __asm__ volatile ("clrex")
+#endif
+
+static void pool_build(struct pool *p)
+{
+    uint32_t i;
+    uint8_t *obj = p->storage;
+    for (i = 0; i + 1 < p->n_objs; i++) {
+        *(void **)obj = obj + p->obj_size;
+        obj += p->obj_size;
+    }
+    if (p->n_objs > 0)
+        *(void **)obj = 0;
+    p->free_list = p->n_objs ? p->storage : 0;
+    p->in_use = 0;
+    p->high_water = 0;
+    p->failures = 0;
+}
+
+void pool_init(void)
+{
+    struct pool *p;
+    for (p = &_start_pools; p < &_end_pools; p++)
+        pool_build(p);
+}
+
+void *pool_alloc(struct pool *p)
+{
+    void *obj;
+    uint32_t used, hw;
+    do {
+        obj = ldrex(&p->free_list);
+        if (!obj) {
+            clrex();
+            __atomic_fetch_add(&p->failures, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (strex(*(void **)obj, &p->free_list));
+
+    used = __atomic_add_fetch(&p->in_use, 1, __ATOMIC_RELAXED);
+    hw = p->high_water;
+    while ((used > hw) &&
+            !__atomic_compare_exchange_n(&p->high_water, &hw, used, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return obj;
+}
+
+void pool_free(struct pool *p, void *obj)
+{
+    uint8_t *o = obj;
+    void *head;
+    if ((o < p->storage) || (o >= p->storage + p->n_objs * p->obj_size))
+        return;
+    if (((uint32_t)(o - p->storage) % p->obj_size) != 0)
+        return;
+    /* Link the object before the exclusive section: no other store
+     * happens between LDREX and STREX.
+     */
+    for (;;) {
+        head = p->free_list;
+        *(void **)obj = head;
+        if (ldrex(&p->free_list) != head) {
+            clrex();
+            continue;
+        }
+        if (!strex(obj, &p->free_list))
+            break;
+    }
+    __atomic_fetch_sub(&p->in_use, 1, __ATOMIC_RELAXED);
+}
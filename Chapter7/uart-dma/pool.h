@@ -0,0 +1,91 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+#include <stdint.h>
+
+/* Fixed-size object pools.
+ *
+ * Pools are defined at compile time with POOL_DEFINE(). The descriptors
+ * are collected by the linker in the .pools section, the objects are
+ * placed in .pool_storage (see target.ld), never in the heap.
+ *
+ * pool_alloc() and pool_free() are O(1) and lock-free (LDREX/STREX), so
+ * they can be called from interrupt handlers as well as from threads.
+ */
+
+/* The host build (hostsim) has no linker script: the linker collects
+ * the sections itself, under names that are valid C identifiers.
+ */
+#ifdef HOST_SIM
+#define POOL_SECTION         "pools"
+#define POOL_STORAGE_SECTION "pool_storage"
+#else
+#define POOL_SECTION         ".pools"
+#define POOL_STORAGE_SECTION ".pool_storage"
+#endif
+
+struct pool {
+    void *volatile free_list;
+    uint8_t *storage;
+    uint32_t obj_size;
+    uint32_t n_objs;
+    const char *name;
+    /* Usage counters */
+    volatile uint32_t in_use;
+    volatile uint32_t high_water;
+    volatile uint32_t failures;
+};
+
+#define POOL_ALIGN      (8)
+#define POOL_OBJ_SIZE(size) \
+    ((((size) < sizeof(void *) ? sizeof(void *) : (size)) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+/* Define pool 'id' of 'count' objects of 'size' bytes each.
+ * The explicit alignment keeps the compiler from padding the descriptors,
+ * so that .pools is an array that pool_init() can walk.
+ */
+#define POOL_DEFINE(id, size, count) \
+    static uint8_t id##_storage[(count) * POOL_OBJ_SIZE(size)] \
+        __attribute__((section(POOL_STORAGE_SECTION), aligned(POOL_ALIGN))); \
+    struct pool id __attribute__((section(POOL_SECTION), used, aligned(sizeof(void *)))) = { \
+        .storage = id##_storage, \
+        .obj_size = POOL_OBJ_SIZE(size), \
+        .n_objs = (count), \
+        .name = #id, \
+    }
+
+/* Build the free lists of all the pools, before any pool_alloc() */
+void pool_init(void);
+
+void *pool_alloc(struct pool *p);
+void pool_free(struct pool *p, void *obj);
+
+#endif
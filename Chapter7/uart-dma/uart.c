@@ -0,0 +1,319 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "system.h"
+#include "uart.h"
+
+#define USART2 (0x40004400)
+
+#define USART2_CR1      (*(volatile uint32_t *)(USART2))
+#define USART2_CR2      (*(volatile uint32_t *)(USART2 + 0x04))
+#define USART2_CR3      (*(volatile uint32_t *)(USART2 + 0x08))
+#define USART2_BRR      (*(volatile uint32_t *)(USART2 + 0x0C))
+#define USART2_SR       (*(volatile uint32_t *)(USART2 + 0x1C))
+#define USART2_ICR      (*(volatile uint32_t *)(USART2 + 0x20))
+#define USART2_RDR      (*(volatile uint32_t *)(USART2 + 0x24))
+#define USART2_TDR      (*(volatile uint32_t *)(USART2 + 0x28))
+
+#define USART2_CR1_USART_ENABLE    (1 << 0)
+#define USART2_CR1_SYMBOL_LEN     (0 << 28)
+#define USART2_CR1_PARITY_ENABLED (1 << 10)
+#define USART2_CR1_PARITY_ODD     (1 << 9)
+#define USART2_CR1_TX_ENABLE      (1 << 3)
+#define USART2_CR1_RX_ENABLE      (1 << 2)
+#define USART2_CR1_IDLEIE         (1 << 4)
+#define USART2_CR2_STOPBITS       (0 << 12)
+#define USART2_CR3_DMAT           (1 << 7)
+#define USART2_CR3_DMAR           (1 << 6)
+#define USART2_SR_IDLE            (1 << 4)
+#define USART2_SR_OVERRUN         (1 << 3)
+#define USART2_ICR_IDLECF         (1 << 4)
+#define USART2_ICR_ORECF          (1 << 3)
+
+#define APB1_CLOCK_ER           (*(volatile uint32_t *)(0x40021058))
+#define USART2_APB1_CLOCK_ER_VAL 	(1 << 17)
+
+#define AHB1_CLOCK_ER           (*(volatile uint32_t *)(0x40021048))
+#define DMA1_AHB1_CLOCK_ER_VAL      (1 << 0)
+#define DMAMUX1_AHB1_CLOCK_ER_VAL   (1 << 2)
+
+#define AHB2_CLOCK_ER (*(volatile uint32_t *)(0x4002104C))
+#define GPIOD_AHB2_CLOCK_ER (1 << 3)
+#define GPIOD_BASE 0x48000c00
+#define GPIOD_MODE  (*(volatile uint32_t *)(GPIOD_BASE + 0x00))
+#define GPIOD_AFL   (*(volatile uint32_t *)(GPIOD_BASE + 0x20))
+#define GPIOD_AFH   (*(volatile uint32_t *)(GPIOD_BASE + 0x24))
+#define GPIO_MODE_AF (7)
+#define USART2_PIN_AF 7
+#define USART2_RX_PIN 6
+#define USART2_TX_PIN 5
+
+/*** DMA1 ***/
+#define DMA1_BASE (0x40020000)
+#define DMA1_ISR        (*(volatile uint32_t *)(DMA1_BASE + 0x00))
+#define DMA1_IFCR       (*(volatile uint32_t *)(DMA1_BASE + 0x04))
+#define DMA1_CCR(c)     (*(volatile uint32_t *)(DMA1_BASE + 0x08 + 0x14 * ((c) - 1)))
+#define DMA1_CNDTR(c)   (*(volatile uint32_t *)(DMA1_BASE + 0x0C + 0x14 * ((c) - 1)))
+#define DMA1_CPAR(c)    (*(volatile uint32_t *)(DMA1_BASE + 0x10 + 0x14 * ((c) - 1)))
+#define DMA1_CMAR(c)    (*(volatile uint32_t *)(DMA1_BASE + 0x14 + 0x14 * ((c) - 1)))
+
+#define DMA_CCR_EN      (1 << 0)
+#define DMA_CCR_TCIE    (1 << 1)
+#define DMA_CCR_HTIE    (1 << 2)
+#define DMA_CCR_TEIE    (1 << 3)
+#define DMA_CCR_DIR     (1 << 4) /* Read from memory */
+#define DMA_CCR_CIRC    (1 << 5)
+#define DMA_CCR_MINC    (1 << 7)
+
+/* Flags for channel 'c' in DMA1_ISR/DMA1_IFCR */
+#define DMA_GIF(c)      (1 << (4 * ((c) - 1)))
+#define DMA_TCIF(c)     (1 << (4 * ((c) - 1) + 1))
+#define DMA_HTIF(c)     (1 << (4 * ((c) - 1) + 2))
+#define DMA_TEIF(c)     (1 << (4 * ((c) - 1) + 3))
+
+/*** DMAMUX1: DMA1 channel 'c' is driven by mux channel c - 1 ***/
+#define DMAMUX1_BASE (0x40020800)
+#define DMAMUX1_CCR(c)  (*(volatile uint32_t *)(DMAMUX1_BASE + 4 * ((c) - 1)))
+#define DMAMUX_REQ_USART2_RX (26)
+#define DMAMUX_REQ_USART2_TX (27)
+
+#define USART2_RX_DMA_CH 6
+#define USART2_TX_DMA_CH 7
+
+static void usart2_pins_setup(void)
+{
+    uint32_t reg;
+    AHB2_CLOCK_ER |= GPIOD_AHB2_CLOCK_ER;
+    /* Set mode = AF */
+    reg = GPIOD_MODE & ~ (0x03 << (USART2_RX_PIN * 2));
+    GPIOD_MODE = reg | (2 << (USART2_RX_PIN * 2));
+    reg = GPIOD_MODE & ~ (0x03 << (USART2_TX_PIN * 2));
+    GPIOD_MODE = reg | (2 << (USART2_TX_PIN * 2));
+
+    /* Alternate function: use low pins (6 and 5) */
+    reg = GPIOD_AFL & ~(0xf << (USART2_TX_PIN * 4));
+    GPIOD_AFL = reg | (USART2_PIN_AF << (USART2_TX_PIN * 4));
+    reg = GPIOD_AFL & ~(0xf << (USART2_RX_PIN  * 4));
+    GPIOD_AFL = reg | (USART2_PIN_AF << (USART2_RX_PIN * 4));
+}
+
+static void usart2_dma_setup(void)
+{
+    AHB1_CLOCK_ER |= DMA1_AHB1_CLOCK_ER_VAL | DMAMUX1_AHB1_CLOCK_ER_VAL;
+    DMB();
+
+    /* Route the USART2 requests to the two DMA1 channels */
+    DMAMUX1_CCR(USART2_RX_DMA_CH) = DMAMUX_REQ_USART2_RX;
+    DMAMUX1_CCR(USART2_TX_DMA_CH) = DMAMUX_REQ_USART2_TX;
+
+    DMA1_CCR(USART2_RX_DMA_CH) = 0;
+    DMA1_CCR(USART2_TX_DMA_CH) = 0;
+    DMA1_CPAR(USART2_RX_DMA_CH) = (uint32_t)&USART2_RDR;
+    DMA1_CPAR(USART2_TX_DMA_CH) = (uint32_t)&USART2_TDR;
+
+    nvic_irq_enable(NVIC_DMA1_CH6_IRQN);
+    nvic_irq_setprio(NVIC_DMA1_CH6_IRQN, 0);
+    nvic_irq_enable(NVIC_DMA1_CH7_IRQN);
+    nvic_irq_setprio(NVIC_DMA1_CH7_IRQN, 0);
+}
+
+int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
+{
+    uint32_t reg;
+    /* Enable pins and configure for AF7 */
+    usart2_pins_setup();
+    /* Turn on the device */
+    APB1_CLOCK_ER |= USART2_APB1_CLOCK_ER_VAL;
+
+    /* Configure for TX + RX */
+    USART2_CR1 |= (USART2_CR1_TX_ENABLE | USART2_CR1_RX_ENABLE);
+
+    /* Configure clock */
+    USART2_BRR =  CPU_FREQ / bitrate;
+
+    /* Configure data bits */
+    if (data == 8)
+        USART2_CR1 &= ~USART2_CR1_SYMBOL_LEN;
+    else
+        USART2_CR1 |= USART2_CR1_SYMBOL_LEN;
+
+    /* Default: No parity */
+    USART2_CR1 &= ~(USART2_CR1_PARITY_ENABLED | USART2_CR1_PARITY_ODD);
+
+    /* Configure parity */
+    switch (parity) {
+        case 'O':
+            USART2_CR1 |= USART2_CR1_PARITY_ODD;
+            /* fall through to enable parity */
+        case 'E':
+            USART2_CR1 |= USART2_CR1_PARITY_ENABLED;
+            break;
+    }
+    /* Set stop bits */
+    reg = USART2_CR2 & ~USART2_CR2_STOPBITS;
+    if (stop > 1)
+        USART2_CR2 = reg & (2 << 12);
+    else
+        USART2_CR2 = reg;
+
+    /* DMA channels for both directions */
+    usart2_dma_setup();
+    USART2_CR3 |= USART2_CR3_DMAT | USART2_CR3_DMAR;
+
+    /* The USART interrupt is only used for idle-line detection */
+    nvic_irq_enable(NVIC_USART2_IRQN);
+    nvic_irq_setprio(NVIC_USART2_IRQN, 0);
+
+    /* Turn on usart */
+    USART2_CR1 |= USART2_CR1_USART_ENABLE;
+
+    return 0;
+}
+
+/*** TX ***/
+
+static void (*tx_complete_cb)(void) = 0;
+static volatile int tx_busy = 0;
+
+/* Start sending 'len' bytes straight from 'buf'. The buffer must not be
+ * modified until 'tx_complete' is called (from interrupt context).
+ * Returns -1 if a previous transfer is still in progress.
+ */
+int usart2_write(const void *buf, uint32_t len, void (*tx_complete)(void))
+{
+    if (tx_busy)
+        return -1;
+    if (len == 0)
+        return 0;
+    tx_busy = 1;
+    tx_complete_cb = tx_complete;
+    DMA1_CCR(USART2_TX_DMA_CH) = 0;
+    DMA1_IFCR = DMA_GIF(USART2_TX_DMA_CH);
+    DMA1_CMAR(USART2_TX_DMA_CH) = (uint32_t)buf;
+    DMA1_CNDTR(USART2_TX_DMA_CH) = len;
+    DMB();
+    DMA1_CCR(USART2_TX_DMA_CH) = DMA_CCR_MINC | DMA_CCR_DIR |
+        DMA_CCR_TCIE | DMA_CCR_TEIE | DMA_CCR_EN;
+    return (int)len;
+}
+
+int usart2_tx_busy(void)
+{
+    return tx_busy;
+}
+
+void isr_dma1_ch7(void)
+{
+    uint32_t isr = DMA1_ISR;
+    if (isr & (DMA_TCIF(USART2_TX_DMA_CH) | DMA_TEIF(USART2_TX_DMA_CH))) {
+        DMA1_IFCR = DMA_GIF(USART2_TX_DMA_CH);
+        DMA1_CCR(USART2_TX_DMA_CH) = 0;
+        tx_busy = 0;
+        if (tx_complete_cb)
+            tx_complete_cb();
+    }
+}
+
+/*** RX ***/
+
+static uint8_t *rx_buf = 0;
+static uint32_t rx_len = 0;
+static uint32_t rx_last = 0;
+static void (*rx_ready_cb)(const uint8_t *data, uint32_t len) = 0;
+
+/* Bytes lost in hardware because the DMA was not serviced in time (ORE) */
+volatile uint32_t usart2_hw_overruns = 0;
+
+/* Deliver everything the DMA wrote since the last call, as one or two
+ * contiguous slices of the circular buffer.
+ */
+static void usart2_rx_dma_flush(void)
+{
+    uint32_t pos = rx_len - DMA1_CNDTR(USART2_RX_DMA_CH);
+    if (pos == rx_len)
+        pos = 0;
+    if (pos == rx_last)
+        return;
+    if (pos > rx_last) {
+        rx_ready_cb(rx_buf + rx_last, pos - rx_last);
+    } else {
+        rx_ready_cb(rx_buf + rx_last, rx_len - rx_last);
+        if (pos > 0)
+            rx_ready_cb(rx_buf, pos);
+    }
+    rx_last = pos;
+}
+
+/* Receive continuously into 'buf' (circular). 'rx_ready' is called from
+ * interrupt context with each new slice of data, when the buffer is half
+ * full, full, or when the line goes idle after a burst.
+ */
+int usart2_read_start(uint8_t *buf, uint32_t len,
+        void (*rx_ready)(const uint8_t *data, uint32_t len))
+{
+    if ((buf == 0) || (len == 0) || (len > 0xFFFF) || (rx_ready == 0))
+        return -1;
+    rx_buf = buf;
+    rx_len = len;
+    rx_last = 0;
+    rx_ready_cb = rx_ready;
+    DMA1_CCR(USART2_RX_DMA_CH) = 0;
+    DMA1_IFCR = DMA_GIF(USART2_RX_DMA_CH);
+    DMA1_CMAR(USART2_RX_DMA_CH) = (uint32_t)buf;
+    DMA1_CNDTR(USART2_RX_DMA_CH) = len;
+    DMB();
+    DMA1_CCR(USART2_RX_DMA_CH) = DMA_CCR_MINC | DMA_CCR_CIRC |
+        DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+    USART2_ICR = USART2_ICR_IDLECF;
+    USART2_CR1 |= USART2_CR1_IDLEIE;
+    return 0;
+}
+
+void isr_dma1_ch6(void)
+{
+    uint32_t isr = DMA1_ISR;
+    if (isr & (DMA_HTIF(USART2_RX_DMA_CH) | DMA_TCIF(USART2_RX_DMA_CH))) {
+        DMA1_IFCR = DMA_HTIF(USART2_RX_DMA_CH) | DMA_TCIF(USART2_RX_DMA_CH);
+        usart2_rx_dma_flush();
+    }
+}
+
+void isr_usart2(void)
+{
+    uint32_t reg = USART2_SR;
+    if (reg & USART2_SR_OVERRUN) {
+        USART2_ICR = USART2_ICR_ORECF;
+        usart2_hw_overruns++;
+    }
+    if (reg & USART2_SR_IDLE) {
+        USART2_ICR = USART2_ICR_IDLECF;
+        usart2_rx_dma_flush();
+    }
+}
@@ -40,8 +40,9 @@ void main(void) {
     usart2_setup(115200, 8, 'N', 1);
     usart2_write("Hello World!\r\n");
     while(1) {
-        usart2_read(c,1);
-        c[1] = 0;
-        usart2_write(c);
+        if (usart2_read(c, 1) > 0) {
+            c[1] = 0;
+            usart2_write(c);
+        }
     }
 }
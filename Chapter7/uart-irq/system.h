@@ -35,8 +35,14 @@
 #define PLL_FULL_MASK (0xFFFFFFFF)
 
 /* Assembly helpers */
+#ifdef HOST_SIM
+#include "hostsim.h"
+#define DMB() __sync_synchronize();
+#define WFI() hostsim_wfi();
+#else
 #define DMB() __asm__ volatile ("dmb");
 #define WFI() __asm__ volatile ("wfi");
+#endif
 
 /* Master clock setting */
 void clock_config(void);
@@ -38,6 +38,7 @@
 #define USART2_CR2      (*(volatile uint32_t *)(USART2 + 0x04))
 #define USART2_BRR      (*(volatile uint32_t *)(USART2 + 0x0C))
 #define USART2_SR       (*(volatile uint32_t *)(USART2 + 0x1C))
+#define USART2_ICR      (*(volatile uint32_t *)(USART2 + 0x20))
 #define USART2_RDR      (*(volatile uint32_t *)(USART2 + 0x24))
 #define USART2_TDR      (*(volatile uint32_t *)(USART2 + 0x28))
 
@@ -53,6 +54,8 @@
 #define USART2_CR2_STOPBITS       (0 << 12)
 #define USART2_SR_TX_EMPTY        (1 << 7)
 #define USART2_SR_RX_NOTEMPTY     (1 << 5)
+#define USART2_SR_OVERRUN         (1 << 3)
+#define USART2_ICR_ORECF          (1 << 3)
 
 
 
@@ -155,63 +158,114 @@ int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
     return 0;
 }
 
-static char buf_rx[64];
-static int received_bytes = 0;
+/* Lock-free single-producer/single-consumer rings.
+ * RX: produced by isr_usart2(), consumed by usart2_read().
+ * TX: produced by usart2_write(), consumed by isr_usart2().
+ *
+ * head and tail are free-running counters, only ever written by the
+ * producer and the consumer respectively. Sizes must be powers of two.
+ */
+#ifndef USART2_RX_RING_SIZE
+#define USART2_RX_RING_SIZE 256
+#endif
+#ifndef USART2_TX_RING_SIZE
+#define USART2_TX_RING_SIZE 256
+#endif
+
+#if (USART2_RX_RING_SIZE & (USART2_RX_RING_SIZE - 1)) || \
+    (USART2_TX_RING_SIZE & (USART2_TX_RING_SIZE - 1))
+# error "USART2 ring sizes must be a power of two"
+#endif
+
+struct ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+};
 
-static char buf_tx[64];
-static int tx_pending_bytes = 0, tx_transmitted_bytes = 0;
+static char buf_rx[USART2_RX_RING_SIZE];
+static struct ring ring_rx;
+
+static char buf_tx[USART2_TX_RING_SIZE];
+static struct ring ring_tx;
+
+/* Bytes dropped because the RX ring was full */
+volatile uint32_t usart2_rx_overruns = 0;
+/* Bytes lost in hardware because the ISR was too late (ORE) */
+volatile uint32_t usart2_hw_overruns = 0;
+/* Bytes not queued by usart2_write() because the TX ring was full */
+volatile uint32_t usart2_tx_overruns = 0;
 
 void isr_usart2(void)
 {
     volatile uint32_t reg;
+    uint32_t head, tail;
     reg = USART2_SR;
+    if (reg & USART2_SR_OVERRUN) {
+        USART2_ICR = USART2_ICR_ORECF;
+        usart2_hw_overruns++;
+    }
     if (reg & USART2_SR_RX_NOTEMPTY) {
-        if (received_bytes >= 64)
-            reg = USART2_RDR;
-        else
-            buf_rx[received_bytes++] = (char)(USART2_RDR & 0xFF);
+        char c = (char)(USART2_RDR & 0xFF);
+        head = ring_rx.head;
+        if ((head - ring_rx.tail) >= USART2_RX_RING_SIZE) {
+            usart2_rx_overruns++;
+        } else {
+            buf_rx[head & (USART2_RX_RING_SIZE - 1)] = c;
+            DMB();
+            ring_rx.head = head + 1;
+        }
     }
 
-    if ((reg & USART2_SR_TX_EMPTY) &&
-            (tx_pending_bytes > tx_transmitted_bytes)) {
-        USART2_TDR = buf_tx[tx_transmitted_bytes++];
-        if (tx_transmitted_bytes == tx_pending_bytes) {
+    if ((reg & USART2_SR_TX_EMPTY) && (USART2_CR1 & USART2_CR1_TXEIE)) {
+        tail = ring_tx.tail;
+        if (tail == ring_tx.head) {
             usart2_tx_interrupt_onoff(0);
-            tx_transmitted_bytes = tx_pending_bytes = 0;
+        } else {
+            USART2_TDR = buf_tx[tail & (USART2_TX_RING_SIZE - 1)];
+            DMB();
+            ring_tx.tail = tail + 1;
         }
     }
 }
 
-void usart2_write(const char *text)
+/* Queue a string for transmission. Never waits: returns the number of
+ * bytes queued, which is less than strlen(text) if the TX ring is full.
+ */
+int usart2_write(const char *text)
 {
     const char *p = text;
-    volatile uint32_t reg;
+    uint32_t head = ring_tx.head;
+    int queued = 0;
     while(*p) {
-        reg = USART2_SR;
-        if (reg & USART2_SR_TX_EMPTY)
-        {
-            USART2_TDR = *p;
-        } else {
-            if (tx_pending_bytes >= 63)
-                break;
-            buf_tx[tx_pending_bytes++] = *p;
-            usart2_tx_interrupt_onoff(1);
+        if ((head - ring_tx.tail) >= USART2_TX_RING_SIZE) {
+            /* Count the bytes dropped */
+            while (*p++)
+                usart2_tx_overruns++;
+            break;
         }
+        buf_tx[head & (USART2_TX_RING_SIZE - 1)] = *p;
+        head++;
+        queued++;
         p++;
     }
+    if (queued > 0) {
+        DMB();
+        ring_tx.head = head;
+        usart2_tx_interrupt_onoff(1);
+    }
+    return queued;
 }
 
 int usart2_read(char *buf, int len)
 {
-    int ret = 0;
-    if (received_bytes < len)
-        len = received_bytes;
-    if (received_bytes > 0) {
-        int i;
-        for (i = 0; i < len; i++)
-            buf[i] = buf_rx[i];
-        ret = len;
-        received_bytes = 0;
-    }
-    return ret;
+    uint32_t tail = ring_rx.tail;
+    uint32_t avail = ring_rx.head - tail;
+    int i;
+    if (avail < (uint32_t)len)
+        len = avail;
+    for (i = 0; i < len; i++)
+        buf[i] = buf_rx[(tail + i) & (USART2_RX_RING_SIZE - 1)];
+    DMB();
+    ring_rx.tail = tail + len;
+    return len;
 }
@@ -33,7 +33,11 @@
 
 
 int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop);
-void usart2_write(const char *text);
+int usart2_write(const char *text);
 int usart2_read(char *buf, int len);
 
+extern volatile uint32_t usart2_rx_overruns;
+extern volatile uint32_t usart2_hw_overruns;
+extern volatile uint32_t usart2_tx_overruns;
+
 #endif
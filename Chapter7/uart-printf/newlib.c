@@ -29,22 +29,54 @@
  */
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <reent.h>
 extern unsigned int _start_heap;
 
+/* The heap may not grow past _end_heap (linker script), nor closer
+ * than SBRK_STACK_MARGIN bytes to the current stack pointer.
+ */
+extern unsigned int _end_heap;
+#ifndef SBRK_STACK_MARGIN
+#define SBRK_STACK_MARGIN 256
+#endif
+
+static unsigned char *heap = (unsigned char *)&_start_heap;
 
-void * _sbrk_r(unsigned int incr)
+static void *heap_grow(ptrdiff_t incr)
 {
-    static unsigned char *heap = NULL;
-    void *old_heap = heap;
-    if (((incr >> 2) << 2) != incr)
-        incr = ((incr >> 2) + 1) << 2;
+    unsigned char *old_heap = heap;
+    unsigned char *limit = (unsigned char *)&_end_heap;
+    unsigned char *sp;
 
-    if (old_heap == NULL)
-		old_heap = heap = (unsigned char *)&_start_heap;
+    incr = (incr + 3) & ~3;
+    asm volatile ("mov %0, sp" : "=r"(sp));
+    if (sp - SBRK_STACK_MARGIN < limit)
+        limit = sp - SBRK_STACK_MARGIN;
+    if ((incr > limit - old_heap) ||
+            (incr < (unsigned char *)&_start_heap - old_heap))
+        return (void *)-1;
     heap += incr;
     return old_heap;
 }
 
+void * _sbrk(ptrdiff_t incr)
+{
+    void *ret = heap_grow(incr);
+    if (ret == (void *)-1)
+        errno = ENOMEM;
+    return ret;
+}
+
+void * _sbrk_r(struct _reent *r, ptrdiff_t incr)
+{
+    void *ret = heap_grow(incr);
+    if (ret == (void *)-1)
+        r->_errno = ENOMEM;
+    return ret;
+}
+
 int _close(int fd)
 {
     return -1;
@@ -47,6 +47,7 @@ void flash_set_waitstates(void);
 /* NVIC ISER Base register (Cortex-M) */
 
 #define NVIC_TIM2_IRQN          (28)
+#define NVIC_USART2_IRQN        (38)
 #define NVIC_ISER_BASE (0xE000E100)
 #define NVIC_ICER_BASE (0xE000E180)
 #define NVIC_IPRI_BASE (0xE000E400)
@@ -44,6 +44,7 @@
 #define USART2_CR1_FIFO_EN        (1 << 29)
 #define USART2_CR1_PARITY_ENABLED (1 << 10)
 #define USART2_CR1_PARITY_ODD     (1 << 9)
+#define USART2_CR1_TXEIE          (1 << 7)
 #define USART2_CR1_TX_ENABLE      (1 << 3)
 #define USART2_CR1_RX_ENABLE      (1 << 2)
 #define USART2_CR2_STOPBITS       (0 << 12)
@@ -122,24 +123,101 @@ int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
     else
         USART2_CR2 = reg;
 
+    /* Enable interrupts in NVIC: TXE drains the TX ring */
+    nvic_irq_enable(NVIC_USART2_IRQN);
+    nvic_irq_setprio(NVIC_USART2_IRQN, 0);
+
     /* Turn on usart */
     USART2_CR1 |= USART2_CR1_USART_ENABLE;
 
     return 0;
 }
 
+/* Buffered stdout: _write() copies into the TX ring, isr_usart2()
+ * drains it one byte per TXE interrupt.
+ */
+#ifndef USART2_TX_RING_SIZE
+#define USART2_TX_RING_SIZE 512
+#endif
+#if (USART2_TX_RING_SIZE & (USART2_TX_RING_SIZE - 1))
+# error "USART2_TX_RING_SIZE must be a power of two"
+#endif
+
+#ifndef USART2_TX_POLICY
+#define USART2_TX_POLICY USART2_TX_BLOCK
+#endif
+
+static char buf_tx[USART2_TX_RING_SIZE];
+static volatile uint32_t tx_head = 0; /* Written by _write() */
+static volatile uint32_t tx_tail = 0; /* Written by isr_usart2() */
+static int tx_policy = USART2_TX_POLICY;
+
+/* Bytes discarded by the DROP and OVERWRITE policies */
+volatile uint32_t usart2_tx_dropped = 0;
+
+void usart2_set_tx_policy(int policy)
+{
+    tx_policy = policy;
+}
+
+static void usart2_tx_interrupt_onoff(int enable)
+{
+    if (enable)
+        USART2_CR1 |= USART2_CR1_TXEIE;
+    else
+        USART2_CR1 &= ~USART2_CR1_TXEIE;
+}
+
+void isr_usart2(void)
+{
+    uint32_t tail = tx_tail;
+    if ((USART2_SR & USART2_SR_TX_EMPTY) == 0)
+        return;
+    if (tail == tx_head) {
+        usart2_tx_interrupt_onoff(0);
+        return;
+    }
+    USART2_DR = buf_tx[tail & (USART2_TX_RING_SIZE - 1)];
+    tx_tail = tail + 1;
+}
+
 int _write(void *r, uint8_t *text, int len)
 {
-    char *p = (char *)text;
     int i;
-    volatile uint32_t reg;
-    text[len - 1] = 0;
-    while(*p) {
-        do {
-            reg = USART2_SR;
-        } while ((reg & USART2_SR_TX_EMPTY) == 0);
-        USART2_DR = *p;
-        p++;
+    uint32_t head = tx_head;
+    for (i = 0; i < len; i++) {
+        if ((head - tx_tail) >= USART2_TX_RING_SIZE) {
+            if (tx_policy == USART2_TX_DROP) {
+                usart2_tx_dropped += len - i;
+                break;
+            } else if (tx_policy == USART2_TX_OVERWRITE) {
+                /* Discard the oldest byte. The ISR stops at tx_head,
+                 * so publish the bytes queued so far before moving
+                 * the tail past them. The tail belongs to the ISR:
+                 * keep it out while moving it.
+                 */
+                DMB();
+                tx_head = head;
+                nvic_irq_disable(NVIC_USART2_IRQN);
+                if ((head - tx_tail) >= USART2_TX_RING_SIZE) {
+                    tx_tail++;
+                    usart2_tx_dropped++;
+                }
+                nvic_irq_enable(NVIC_USART2_IRQN);
+            } else {
+                /* Publish what is queued so far, and wait for room */
+                DMB();
+                tx_head = head;
+                usart2_tx_interrupt_onoff(1);
+                while ((head - tx_tail) >= USART2_TX_RING_SIZE)
+                    ;
+            }
+        }
+        buf_tx[head & (USART2_TX_RING_SIZE - 1)] = text[i];
+        head++;
     }
+    DMB();
+    tx_head = head;
+    usart2_tx_interrupt_onoff(1);
     return len;
 }
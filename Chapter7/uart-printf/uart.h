@@ -35,4 +35,16 @@
 int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop);
 void usart2_write(const char *text);
 
+/* What _write() does when the TX ring is full.
+ * USART2_TX_BLOCK waits for isr_usart2() to drain the ring: calling
+ * printf() from an interrupt handler of the same or higher priority,
+ * or with interrupts masked, then deadlocks. Use one of the other
+ * policies in that case.
+ */
+#define USART2_TX_BLOCK     0 /* Wait for the ISR to make room */
+#define USART2_TX_DROP      1 /* Discard the new bytes */
+#define USART2_TX_OVERWRITE 2 /* Discard the oldest queued bytes */
+void usart2_set_tx_policy(int policy);
+extern volatile uint32_t usart2_tx_dropped;
+
 #endif
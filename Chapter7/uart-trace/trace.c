@@ -0,0 +1,63 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "system.h"
+#include "uart.h"
+#include "trace.h"
+
+volatile uint32_t trace_dropped = 0;
+
+void trace_emit(uint32_t id, int nargs, const uint32_t *args)
+{
+    uint8_t rec[3 + 4 * TRACE_MAX_ARGS];
+    uint32_t primask;
+    int i, len = 0;
+
+    if (nargs > TRACE_MAX_ARGS)
+        nargs = TRACE_MAX_ARGS;
+    rec[len++] = TRACE_SYNC | nargs;
+    rec[len++] = id & 0xFF;
+    rec[len++] = (id >> 8) & 0xFF;
+    for (i = 0; i < nargs; i++) {
+        rec[len++] = args[i] & 0xFF;
+        rec[len++] = (args[i] >> 8) & 0xFF;
+        rec[len++] = (args[i] >> 16) & 0xFF;
+        rec[len++] = (args[i] >> 24) & 0xFF;
+    }
+
+    /* TRACE() may be called from interrupt handlers too: keep each
+     * record contiguous in the TX ring.
+     */
+    asm volatile("mrs %0, primask" : "=r"(primask));
+    asm volatile("cpsid i");
+    if (usart2_write(rec, len) == 0)
+        trace_dropped++;
+    asm volatile("msr primask, %0" :: "r"(primask));
+}
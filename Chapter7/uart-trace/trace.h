@@ -0,0 +1,66 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+#include <stdint.h>
+
+/* Deferred logging.
+ *
+ * TRACE() places its format string in the .trace_fmt section, which is
+ * kept in image.elf but never loaded to the target. At runtime, only the
+ * offset of the string in that section and the raw 32-bit arguments are
+ * queued for transmission. trace_decode.py rebuilds the text on the host.
+ *
+ * Up to TRACE_MAX_ARGS integer arguments (%d, %u, %x, %c, ...).
+ *
+ * Record layout on the wire (little endian):
+ *   1 byte   TRACE_SYNC | number of arguments
+ *   2 bytes  format string offset in .trace_fmt
+ *   4 bytes  per argument
+ */
+#define TRACE_MAX_ARGS  4
+#define TRACE_SYNC      0xA0
+
+#define TRACE_NARGS(...) TRACE_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define TRACE_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+
+#define TRACE(fmt, ...) do { \
+    static const char trace_fmt_[] \
+        __attribute__((section(".trace_fmt"), used)) = fmt; \
+    const uint32_t trace_args_[TRACE_MAX_ARGS + 1] = { 0, ##__VA_ARGS__ }; \
+    trace_emit((uint32_t)trace_fmt_, TRACE_NARGS(__VA_ARGS__), trace_args_ + 1); \
+} while(0)
+
+void trace_emit(uint32_t id, int nargs, const uint32_t *args);
+
+/* Records discarded because the TX ring was full */
+extern volatile uint32_t trace_dropped;
+
+#endif
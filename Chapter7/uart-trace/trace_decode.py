@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+#
+# Embedded System Architecture - Second Edition
+#
+# Decoder for the deferred TRACE() records sent by uart-trace.
+#
+# The format strings are read from the .trace_fmt section of image.elf,
+# the binary records from a captured byte stream (a file, a serial
+# device configured in raw mode, or standard input).
+#
+# Usage:
+#   ./trace_decode.py image.elf capture.bin
+#   stty -F /dev/ttyACM0 115200 raw -echo
+#   ./trace_decode.py image.elf /dev/ttyACM0
+#
+# MIT License
+#
+import re
+import struct
+import sys
+
+TRACE_SYNC = 0xA0
+TRACE_MAX_ARGS = 4
+SECTION = ".trace_fmt"
+
+CONVERSION = re.compile(
+    r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcs%])")
+
+
+def load_formats(elf_path):
+    """Return (base address, contents) of the .trace_fmt section."""
+    with open(elf_path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 1:
+        raise SystemExit("%s: not a 32-bit little endian ELF file" % elf_path)
+    e_shoff, = struct.unpack_from("<I", elf, 0x20)
+    e_shentsize, e_shnum, e_shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+
+    def section(i):
+        # sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size
+        return struct.unpack_from("<IIIIII", elf, e_shoff + i * e_shentsize)
+
+    strtab = section(e_shstrndx)
+    for i in range(e_shnum):
+        name, _, _, addr, offset, size = section(i)
+        start = strtab[4] + name
+        if elf[start:elf.index(b"\0", start)].decode() == SECTION:
+            return addr, elf[offset:offset + size]
+    raise SystemExit("%s: no %s section" % (elf_path, SECTION))
+
+
+def format_record(fmt, args):
+    """Apply C printf conversions in fmt to the raw 32-bit args."""
+    args = list(args)
+
+    def convert(m):
+        flags, width, precision, _, conv = m.groups()
+        if conv == "%":
+            return "%"
+        if not args:
+            return m.group(0)
+        val = args.pop(0)
+        if conv in "di":
+            val = val - (1 << 32) if val & 0x80000000 else val
+            conv = "d"
+        elif conv == "c":
+            val = chr(val & 0xFF)
+        elif conv == "s":
+            # Pointers to target memory cannot be resolved on the host
+            val = "<0x%08x>" % val
+        spec = "%" + flags + width
+        if precision is not None:
+            spec += "." + precision
+        return (spec + conv) % val
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(stream, base, formats, out):
+    buf = b""
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            break
+        buf += chunk
+        while buf:
+            hdr = buf[0]
+            nargs = hdr & 0x0F
+            if (hdr & 0xF0) != TRACE_SYNC or nargs > TRACE_MAX_ARGS:
+                # Lost sync: skip to the next candidate header byte
+                buf = buf[1:]
+                continue
+            size = 3 + 4 * nargs
+            if len(buf) < size:
+                break
+            offset, = struct.unpack_from("<H", buf, 1)
+            args = struct.unpack_from("<%dI" % nargs, buf, 3)
+            buf = buf[size:]
+            offset -= base & 0xFFFF
+            if offset < 0 or offset >= len(formats):
+                out.write("<unknown trace id 0x%04x>\n" % offset)
+                continue
+            fmt = formats[offset:formats.index(b"\0", offset)].decode()
+            out.write(format_record(fmt, args))
+            out.flush()
+
+
+def main():
+    if len(sys.argv) != 3:
+        raise SystemExit("Usage: %s image.elf <capture file|tty|->" % sys.argv[0])
+    base, formats = load_formats(sys.argv[1])
+    if sys.argv[2] == "-":
+        decode(sys.stdin.buffer, base, formats, sys.stdout)
+    else:
+        with open(sys.argv[2], "rb", buffering=0) as stream:
+            decode(stream, base, formats, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,262 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal 
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ */
+#include <stdint.h>
+#include "system.h"
+#include "uart.h"
+
+#define USART2 (0x40004400)
+
+#define USART2_CR1      (*(volatile uint32_t *)(USART2))
+#define USART2_CR2      (*(volatile uint32_t *)(USART2 + 0x04))
+#define USART2_BRR      (*(volatile uint32_t *)(USART2 + 0x0C))
+#define USART2_SR       (*(volatile uint32_t *)(USART2 + 0x1C))
+#define USART2_ICR      (*(volatile uint32_t *)(USART2 + 0x20))
+#define USART2_RDR      (*(volatile uint32_t *)(USART2 + 0x24))
+#define USART2_TDR      (*(volatile uint32_t *)(USART2 + 0x28))
+
+#define USART2_CR1_USART_ENABLE    (1 << 0)
+#define USART2_CR1_SYMBOL_LEN     (0 << 28)
+#define USART2_CR1_FIFO_EN        (1 << 29)
+#define USART2_CR1_PARITY_ENABLED (1 << 10)
+#define USART2_CR1_PARITY_ODD     (1 << 9)
+#define USART2_CR1_TXEIE          (1 << 7)
+#define USART2_CR1_RXNEIE         (1 << 5)
+#define USART2_CR1_TX_ENABLE      (1 << 3)
+#define USART2_CR1_RX_ENABLE      (1 << 2)
+#define USART2_CR2_STOPBITS       (0 << 12)
+#define USART2_SR_TX_EMPTY        (1 << 7)
+#define USART2_SR_RX_NOTEMPTY     (1 << 5)
+#define USART2_SR_OVERRUN         (1 << 3)
+#define USART2_ICR_ORECF          (1 << 3)
+
+
+
+#define APB1_CLOCK_ER           (*(volatile uint32_t *)(0x40021058))
+#define USART2_APB1_CLOCK_ER_VAL 	(1 << 17)
+
+#define AHB2_CLOCK_ER (*(volatile uint32_t *)(0x4002104C))
+#define GPIOD_AHB2_CLOCK_ER (1 << 3)
+#define GPIOD_BASE 0x48000c00
+#define GPIOD_MODE  (*(volatile uint32_t *)(GPIOD_BASE + 0x00))
+#define GPIOD_AFL   (*(volatile uint32_t *)(GPIOD_BASE + 0x20))
+#define GPIOD_AFH   (*(volatile uint32_t *)(GPIOD_BASE + 0x24))
+#define GPIO_MODE_AF (7)
+#define USART2_PIN_AF 7
+#define USART2_RX_PIN 6
+#define USART2_TX_PIN 5
+
+static void usart2_tx_interrupt_onoff(int enable)
+{
+    if (enable)
+        USART2_CR1 |= USART2_CR1_TXEIE;
+    else
+        USART2_CR1 &= ~USART2_CR1_TXEIE;
+}
+
+static void usart2_rx_interrupt_onoff(int enable)
+{
+    if (enable)
+        USART2_CR1 |= USART2_CR1_RXNEIE;
+    else
+        USART2_CR1 &= ~USART2_CR1_RXNEIE;
+}
+
+static void usart2_pins_setup(void)
+{
+    uint32_t reg;
+    AHB2_CLOCK_ER |= GPIOD_AHB2_CLOCK_ER;
+    /* Set mode = AF */
+    reg = GPIOD_MODE & ~ (0x03 << (USART2_RX_PIN * 2));
+    GPIOD_MODE = reg | (2 << (USART2_RX_PIN * 2));
+    reg = GPIOD_MODE & ~ (0x03 << (USART2_TX_PIN * 2));
+    GPIOD_MODE = reg | (2 << (USART2_TX_PIN * 2));
+
+    /* Alternate function: use low pins (6 and 5) */
+    reg = GPIOD_AFL & ~(0xf << (USART2_TX_PIN * 4));
+    GPIOD_AFL = reg | (USART2_PIN_AF << (USART2_TX_PIN * 4));
+    reg = GPIOD_AFL & ~(0xf << (USART2_RX_PIN  * 4));
+    GPIOD_AFL = reg | (USART2_PIN_AF << (USART2_RX_PIN * 4));
+}
+
+int usart2_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
+{
+    uint32_t reg;
+    /* Enable pins and configure for AF7 */
+    usart2_pins_setup();
+    /* Turn on the device */
+    APB1_CLOCK_ER |= USART2_APB1_CLOCK_ER_VAL;
+
+    /* Configure for TX + RX */
+    USART2_CR1 |= (USART2_CR1_TX_ENABLE | USART2_CR1_RX_ENABLE);
+
+    /* Configure clock */
+    USART2_BRR =  CPU_FREQ / bitrate;
+
+    /* Configure data bits */
+    if (data == 8)
+        USART2_CR1 &= ~USART2_CR1_SYMBOL_LEN;
+    else
+        USART2_CR1 |= USART2_CR1_SYMBOL_LEN;
+
+    /* Default: No parity */
+    USART2_CR1 &= ~(USART2_CR1_PARITY_ENABLED | USART2_CR1_PARITY_ODD);
+
+    /* Configure parity */
+    switch (parity) {
+        case 'O':
+            USART2_CR1 |= USART2_CR1_PARITY_ODD;
+            /* fall through to enable parity */
+        case 'E':
+            USART2_CR1 |= USART2_CR1_PARITY_ENABLED;
+            break;
+    }
+    /* Set stop bits */
+    reg = USART2_CR2 & ~USART2_CR2_STOPBITS;
+    if (stop > 1)
+        USART2_CR2 = reg & (2 << 12);
+    else
+        USART2_CR2 = reg;
+
+    /* Enable interrupts in NVIC */
+    nvic_irq_enable(NVIC_USART2_IRQN);
+    nvic_irq_setprio(NVIC_USART2_IRQN, 0);
+
+    /* Enable RX interrupt */
+    usart2_rx_interrupt_onoff(1);
+
+    /* Turn on usart */
+    USART2_CR1 |= USART2_CR1_USART_ENABLE;
+
+    return 0;
+}
+
+/* Lock-free single-producer/single-consumer rings.
+ * RX: produced by isr_usart2(), consumed by usart2_read().
+ * TX: produced by usart2_write(), consumed by isr_usart2().
+ *
+ * head and tail are free-running counters, only ever written by the
+ * producer and the consumer respectively. Sizes must be powers of two.
+ */
+#ifndef USART2_RX_RING_SIZE
+#define USART2_RX_RING_SIZE 256
+#endif
+#ifndef USART2_TX_RING_SIZE
+#define USART2_TX_RING_SIZE 256
+#endif
+
+#if (USART2_RX_RING_SIZE & (USART2_RX_RING_SIZE - 1)) || \
+    (USART2_TX_RING_SIZE & (USART2_TX_RING_SIZE - 1))
+# error "USART2 ring sizes must be a power of two"
+#endif
+
+struct ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+};
+
+static char buf_rx[USART2_RX_RING_SIZE];
+static struct ring ring_rx;
+
+static char buf_tx[USART2_TX_RING_SIZE];
+static struct ring ring_tx;
+
+/* Bytes dropped because the RX ring was full */
+volatile uint32_t usart2_rx_overruns = 0;
+/* Bytes lost in hardware because the ISR was too late (ORE) */
+volatile uint32_t usart2_hw_overruns = 0;
+/* Bytes not queued by usart2_write() because the TX ring was full */
+volatile uint32_t usart2_tx_overruns = 0;
+
+void isr_usart2(void)
+{
+    volatile uint32_t reg;
+    uint32_t head, tail;
+    reg = USART2_SR;
+    if (reg & USART2_SR_OVERRUN) {
+        USART2_ICR = USART2_ICR_ORECF;
+        usart2_hw_overruns++;
+    }
+    if (reg & USART2_SR_RX_NOTEMPTY) {
+        char c = (char)(USART2_RDR & 0xFF);
+        head = ring_rx.head;
+        if ((head - ring_rx.tail) >= USART2_RX_RING_SIZE) {
+            usart2_rx_overruns++;
+        } else {
+            buf_rx[head & (USART2_RX_RING_SIZE - 1)] = c;
+            DMB();
+            ring_rx.head = head + 1;
+        }
+    }
+
+    if ((reg & USART2_SR_TX_EMPTY) && (USART2_CR1 & USART2_CR1_TXEIE)) {
+        tail = ring_tx.tail;
+        if (tail == ring_tx.head) {
+            usart2_tx_interrupt_onoff(0);
+        } else {
+            USART2_TDR = buf_tx[tail & (USART2_TX_RING_SIZE - 1)];
+            DMB();
+            ring_tx.tail = tail + 1;
+        }
+    }
+}
+
+/* Queue a binary buffer for transmission. Never waits, and never
+ * queues a partial buffer: returns len, or 0 if the TX ring does not
+ * have room for all of it.
+ */
+int usart2_write(const uint8_t *buf, int len)
+{
+    uint32_t head = ring_tx.head;
+    int i;
+    if ((USART2_TX_RING_SIZE - (head - ring_tx.tail)) < (uint32_t)len) {
+        usart2_tx_overruns += len;
+        return 0;
+    }
+    for (i = 0; i < len; i++)
+        buf_tx[(head + i) & (USART2_TX_RING_SIZE - 1)] = buf[i];
+    DMB();
+    ring_tx.head = head + len;
+    usart2_tx_interrupt_onoff(1);
+    return len;
+}
+
+int usart2_read(char *buf, int len)
+{
+    uint32_t tail = ring_rx.tail;
+    uint32_t avail = ring_rx.head - tail;
+    int i;
+    if (avail < (uint32_t)len)
+        len = avail;
+    for (i = 0; i < len; i++)
+        buf[i] = buf_rx[(tail + i) & (USART2_RX_RING_SIZE - 1)];
+    DMB();
+    ring_rx.tail = tail + len;
+    return len;
+}
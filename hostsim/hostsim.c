@@ -0,0 +1,1486 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "system.h"
+#include "hostsim.h"
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "hostsim runs on Linux x86_64 hosts"
+#endif
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* Peripheral address windows mapped at their target addresses.
+ * The 'bus' mapping is what the firmware sees: it stays PROT_NONE, so
+ * every access faults. The simulator works on a second, always
+ * accessible 'shadow' mapping of the same pages.
+ */
+struct window {
+    uint32_t base;
+    uint32_t size;
+    uint8_t *shadow;
+};
+
+static struct window windows[] = {
+    { 0x40000000, 0x00030000 },     /* APB1, APB2, AHB1 */
+    { 0x48000000, 0x00003000 },     /* AHB2: GPIOA..GPIOI */
+    { 0xE0000000, 0x00100000 },     /* Private peripheral bus */
+};
+#define N_WINDOWS (sizeof(windows) / sizeof(windows[0]))
+#define PAGE_SIZE 4096
+
+/*** Register map ***/
+#define TIM2_BASE       (0x40000000)
+#define TIM_SPAN        (0x400)
+#define N_TIMERS        (3)         /* TIM2, TIM3, TIM4 */
+#define TIM_CR1         (0x00)
+#define TIM_DIER        (0x0c)
+#define TIM_SR          (0x10)
+#define TIM_EGR         (0x14)
+#define TIM_CNT         (0x24)
+#define TIM_PSC         (0x28)
+#define TIM_ARR         (0x2c)
+#define TIM_CR1_CEN     (1 << 0)
+#define TIM_CR1_URS     (1 << 2)
+#define TIM_UIF         (1 << 0)
+
+#define USART2_BASE     (0x40004400)
+#define USART_CR1       (0x00)
+#define USART_CR3       (0x08)
+#define USART_BRR       (0x0c)
+#define USART_ISR       (0x1c)
+#define USART_ICR       (0x20)
+#define USART_RDR       (0x24)
+#define USART_TDR       (0x28)
+#define USART_CR1_UE    (1 << 0)
+#define USART_CR1_RE    (1 << 2)
+#define USART_CR1_TE    (1 << 3)
+#define USART_CR1_IDLEIE (1 << 4)
+#define USART_CR1_RXNEIE (1 << 5)
+#define USART_CR1_TCIE  (1 << 6)
+#define USART_CR1_TXEIE (1 << 7)
+#define USART_CR3_DMAR  (1 << 6)
+#define USART_CR3_DMAT  (1 << 7)
+#define USART_ORE       (1 << 3)
+#define USART_IDLE      (1 << 4)
+#define USART_RXNE      (1 << 5)
+#define USART_TC        (1 << 6)
+#define USART_TXE       (1 << 7)
+#define USART_ICR_MASK  (0x0000015F)
+
+#define DMA1_BASE       (0x40020000)
+#define N_DMA_CH        (7)
+#define DMA_ISR         (0x00)
+#define DMA_IFCR        (0x04)
+#define DMA_CCR(c)      (0x08 + 0x14 * ((c) - 1))
+#define DMA_CNDTR(c)    (0x0C + 0x14 * ((c) - 1))
+#define DMA_CPAR(c)     (0x10 + 0x14 * ((c) - 1))
+#define DMA_CMAR(c)     (0x14 + 0x14 * ((c) - 1))
+#define DMA_CCR_EN      (1 << 0)
+#define DMA_CCR_IE_MASK (0x0E)      /* TCIE, HTIE, TEIE */
+#define DMA_CCR_DIR     (1 << 4)
+#define DMA_CCR_CIRC    (1 << 5)
+#define DMA_CCR_MINC    (1 << 7)
+#define DMA_GIF(c)      (1U << (4 * ((c) - 1)))
+#define DMA_TCIF(c)     (1U << (4 * ((c) - 1) + 1))
+#define DMA_HTIF(c)     (1U << (4 * ((c) - 1) + 2))
+#define DMAMUX1_BASE    (0x40020800)
+#define DMAMUX_CCR(c)   (DMAMUX1_BASE + 4 * ((c) - 1))
+#define DMAMUX_REQ_USART2_RX (26)
+#define DMAMUX_REQ_USART2_TX (27)
+
+#define I2C1_BASE       (0x40005400)
+#define I2C_CR1         (0x00)
+#define I2C_CR2         (0x04)
+#define I2C_TIMINGR     (0x10)
+#define I2C_ISR         (0x18)
+#define I2C_ICR         (0x1c)
+#define I2C_RXDR        (0x24)
+#define I2C_TXDR        (0x28)
+#define I2C_CR1_PE      (1 << 0)
+#define I2C_CR1_TXIE    (1 << 1)
+#define I2C_CR1_RXIE    (1 << 2)
+#define I2C_CR1_NACKIE  (1 << 4)
+#define I2C_CR1_STOPIE  (1 << 5)
+#define I2C_CR1_TCIE    (1 << 6)
+#define I2C_CR1_ERRIE   (1 << 7)
+#define I2C_CR2_RD_WRN  (1 << 10)
+#define I2C_CR2_START   (1 << 13)
+#define I2C_CR2_STOP    (1 << 14)
+#define I2C_CR2_AUTOEND (1 << 25)
+#define I2C_TXE         (1 << 0)
+#define I2C_TXIS        (1 << 1)
+#define I2C_RXNE        (1 << 2)
+#define I2C_NACKF       (1 << 4)
+#define I2C_STOPF       (1 << 5)
+#define I2C_TC          (1 << 6)
+#define I2C_ERRORS      (0x00001F00)
+#define I2C_BUSY        (1 << 15)
+#define I2C_ICR_MASK    (0x00003F38)
+
+#define SYSCFG_EXTICR1  (0x40010008)
+#define EXTI_BASE       (0x40010400)
+#define EXTI_IMR        (0x00)
+#define EXTI_RTSR       (0x08)
+#define EXTI_FTSR       (0x0c)
+#define EXTI_SWIER      (0x10)
+#define EXTI_PR         (0x14)
+
+#define RCC_BASE        (0x40021000)
+#define RCC_CR          (0x00)
+#define RCC_CFGR        (0x08)
+#define RCC_BDCR        (0x90)
+#define RCC_CSR         (0x94)
+#define RCC_CRRCR       (0x98)
+
+#define GPIO_BASE       (0x48000000)
+#define GPIO_SPAN       (0x400)
+#define N_GPIO          (9)
+#define GPIO_IDR        (0x10)
+#define GPIO_ODR        (0x14)
+#define GPIO_BSRR       (0x18)
+#define GPIO_BRR        (0x28)
+
+#define DWT_CTRL        (0xE0001000)
+#define DWT_CYCCNT      (0xE0001004)
+#define SYSTICK_CSR     (0xE000E010)
+#define SYSTICK_RVR     (0xE000E014)
+#define SYSTICK_CVR     (0xE000E018)
+#define SYSTICK_ENABLE  (1 << 0)
+#define SYSTICK_TICKINT (1 << 1)
+#define SYSTICK_COUNTFLAG (1 << 16)
+#define NVIC_ISER       (0xE000E100)
+#define NVIC_ICER       (0xE000E180)
+#define NVIC_ISPR       (0xE000E200)
+#define NVIC_ICPR       (0xE000E280)
+#define NVIC_BANKS      (4)
+#define SCB_ICSR        (0xE000ED04)
+#define ICSR_PENDSVSET  (1 << 28)
+#define ICSR_PENDSVCLR  (1 << 27)
+#define ICSR_PENDSTSET  (1 << 26)
+#define ICSR_PENDSTCLR  (1 << 25)
+
+/*** Exceptions ***/
+#define EXC_PENDSV      (14)
+#define EXC_SYSTICK     (15)
+#define EXC_IRQ(n)      (16 + (n))
+#define N_EXC           (EXC_IRQ(32 * NVIC_BANKS))
+
+#define IRQ_EXTI0       (6)
+#define IRQ_DMA1_CH1    (11)
+#define IRQ_EXTI9_5     (23)
+#define IRQ_TIM2        (28)
+#define IRQ_I2C1_EV     (31)
+#define IRQ_I2C1_ER     (32)
+#define IRQ_USART2      (38)
+#define IRQ_EXTI15_10   (40)
+
+extern void isr_pendsv(void) __attribute__((weak));
+extern void isr_systick(void) __attribute__((weak));
+extern void isr_exti0(void) __attribute__((weak));
+extern void isr_exti1(void) __attribute__((weak));
+extern void isr_exti2(void) __attribute__((weak));
+extern void isr_exti3(void) __attribute__((weak));
+extern void isr_exti4(void) __attribute__((weak));
+extern void isr_exti9_5(void) __attribute__((weak));
+extern void isr_exti15_10(void) __attribute__((weak));
+extern void isr_tim2(void) __attribute__((weak));
+extern void isr_tim3(void) __attribute__((weak));
+extern void isr_tim4(void) __attribute__((weak));
+extern void isr_i2c1(void) __attribute__((weak));
+extern void isr_usart2(void) __attribute__((weak));
+extern void isr_dma1_ch1(void) __attribute__((weak));
+extern void isr_dma1_ch2(void) __attribute__((weak));
+extern void isr_dma1_ch3(void) __attribute__((weak));
+extern void isr_dma1_ch4(void) __attribute__((weak));
+extern void isr_dma1_ch5(void) __attribute__((weak));
+extern void isr_dma1_ch6(void) __attribute__((weak));
+extern void isr_dma1_ch7(void) __attribute__((weak));
+
+static void (*handlers[N_EXC])(void);
+
+/* Firmware text boundaries, from the host linker */
+extern char __executable_start[];
+extern char etext[];
+
+#define NEVER (UINT64_MAX)
+
+/*** Simulator state ***/
+static uint64_t now;
+static uint64_t cycle_limit;
+static uint32_t access_cycles = 2;
+static uint64_t n_accesses;
+static int trace_gpio;
+static struct timespec wall_start;
+
+static uint8_t exc_pending[N_EXC];
+static uint8_t exc_level[N_EXC];
+static uint32_t nvic_enabled[NVIC_BANKS];
+static uint64_t exc_count[N_EXC];
+static volatile int in_handler;
+static volatile int sim_busy;
+static int active_exc;
+
+/* Register access in progress, between the fault and the single step */
+static int step_active;
+static uint32_t step_addr;
+static int step_write;
+static uint32_t step_old;
+
+/* Busy-wait detection */
+static uint32_t last_addr;
+static uint32_t last_val;
+static int last_write;
+static int spins;
+
+static volatile uint32_t *reg(uint32_t addr)
+{
+    static uint32_t dummy;
+    unsigned int i;
+    for (i = 0; i < N_WINDOWS; i++) {
+        if (addr - windows[i].base < windows[i].size)
+            return (volatile uint32_t *)(windows[i].shadow + (addr - windows[i].base));
+    }
+    return &dummy;
+}
+#define R(a) (*reg(a))
+
+static int in_range(uint32_t a, uint32_t base, uint32_t size)
+{
+    return (a - base) < size;
+}
+
+/*** Timers: TIM2, TIM3, TIM4 ***/
+struct sim_timer {
+    uint32_t base;
+    uint64_t t0;        /* time when cnt0 was latched */
+    uint32_t cnt0;
+    uint64_t due;       /* next update event */
+};
+static struct sim_timer timers[N_TIMERS];
+
+static uint32_t tim_prescaler(struct sim_timer *t)
+{
+    return (R(t->base + TIM_PSC) & 0xFFFF) + 1;
+}
+
+static uint32_t tim_cnt(struct sim_timer *t)
+{
+    if ((R(t->base + TIM_CR1) & TIM_CR1_CEN) == 0)
+        return t->cnt0;
+    return t->cnt0 + (uint32_t)((now - t->t0) / tim_prescaler(t));
+}
+
+/* Called before the configuration changes, with the old settings */
+static void tim_latch(struct sim_timer *t)
+{
+    t->cnt0 = tim_cnt(t);
+    t->t0 = now;
+}
+
+static void tim_schedule(struct sim_timer *t)
+{
+    uint32_t arr = R(t->base + TIM_ARR);
+    if (((R(t->base + TIM_CR1) & TIM_CR1_CEN) == 0) || (arr == 0)) {
+        t->due = NEVER;
+        return;
+    }
+    if (t->cnt0 > arr)
+        t->cnt0 = 0;
+    t->due = t->t0 + (uint64_t)(arr - t->cnt0 + 1) * tim_prescaler(t);
+}
+
+static void tim_update_event(struct sim_timer *t)
+{
+    R(t->base + TIM_SR) |= TIM_UIF;
+    t->t0 = t->due;
+    t->cnt0 = 0;
+    tim_schedule(t);
+}
+
+static void tim_write(struct sim_timer *t, uint32_t off, uint32_t old, uint32_t val)
+{
+    switch (off) {
+        case TIM_SR:
+            /* rc_w0 */
+            R(t->base + TIM_SR) = old & val;
+            break;
+        case TIM_CNT:
+            t->cnt0 = val;
+            break;
+        case TIM_EGR:
+            if (val & 1) {
+                t->cnt0 = 0;
+                if ((R(t->base + TIM_CR1) & TIM_CR1_URS) == 0)
+                    R(t->base + TIM_SR) |= TIM_UIF;
+            }
+            R(t->base + TIM_EGR) = 0;
+            break;
+    }
+    tim_schedule(t);
+}
+
+/*** SysTick ***/
+static uint64_t systick_due = NEVER;
+static uint32_t systick_cvr;
+
+static uint32_t systick_current(void)
+{
+    if (systick_due == NEVER)
+        return systick_cvr;
+    return (uint32_t)(systick_due - now);
+}
+
+static void systick_start(uint32_t from)
+{
+    uint32_t rvr = R(SYSTICK_RVR) & 0xFFFFFF;
+    if (from == 0) {
+        /* Reload on the next clock */
+        if (rvr == 0) {
+            systick_due = NEVER;
+            systick_cvr = 0;
+            return;
+        }
+        systick_due = now + 1 + rvr;
+    } else {
+        systick_due = now + from;
+    }
+}
+
+static void systick_event(void)
+{
+    uint32_t rvr = R(SYSTICK_RVR) & 0xFFFFFF;
+    R(SYSTICK_CSR) |= SYSTICK_COUNTFLAG;
+    if (R(SYSTICK_CSR) & SYSTICK_TICKINT)
+        exc_pending[EXC_SYSTICK] = 1;
+    if (rvr == 0) {
+        systick_due = NEVER;
+        systick_cvr = 0;
+    } else {
+        systick_due += rvr + 1;
+    }
+}
+
+static void systick_write(uint32_t a, uint32_t old, uint32_t val)
+{
+    if (a == SYSTICK_CSR) {
+        R(SYSTICK_CSR) = (val & ~SYSTICK_COUNTFLAG) | (old & SYSTICK_COUNTFLAG);
+        if ((val & SYSTICK_ENABLE) && !(old & SYSTICK_ENABLE)) {
+            systick_start(systick_cvr);
+        } else if (!(val & SYSTICK_ENABLE) && (old & SYSTICK_ENABLE)) {
+            systick_cvr = systick_current();
+            systick_due = NEVER;
+        }
+    } else if (a == SYSTICK_CVR) {
+        R(SYSTICK_CVR) = 0;
+        R(SYSTICK_CSR) &= ~SYSTICK_COUNTFLAG;
+        systick_cvr = 0;
+        if (R(SYSTICK_CSR) & SYSTICK_ENABLE)
+            systick_start(0);
+    }
+}
+
+/*** USART2: TX to stdout, RX from stdin ***/
+static struct {
+    uint64_t tx_due;        /* shift register done */
+    uint8_t tx_shift;
+    int tdr_full;
+    uint8_t tdr;
+    uint64_t rx_due;        /* next byte on the line */
+    uint8_t rx_byte;
+    int rx_held;            /* rx_byte waits for RDR to be read */
+    uint64_t idle_due;      /* line idle after the last byte */
+    int stdin_eof;
+} usart;
+
+#define USART(off) R(USART2_BASE + (off))
+
+static uint64_t usart_frame(void)
+{
+    uint32_t brr = USART(USART_BRR) & 0xFFFF;
+    if (brr < 16)
+        brr = 16;
+    return 10 * (uint64_t)brr;
+}
+
+static int usart_rx_enabled(void)
+{
+    uint32_t cr1 = USART(USART_CR1);
+    return (cr1 & USART_CR1_UE) && (cr1 & USART_CR1_RE);
+}
+
+/* Queue the next byte from stdin, arriving one frame after 'when' */
+static int usart_rx_fetch(uint64_t when, int block)
+{
+    struct pollfd pfd = { .fd = 0, .events = POLLIN };
+    uint8_t c;
+    if (usart.stdin_eof || (usart.rx_due != NEVER) || usart.rx_held ||
+            !usart_rx_enabled())
+        return 0;
+    if (!block && (poll(&pfd, 1, 0) <= 0))
+        return 0;
+    if (read(0, &c, 1) != 1) {
+        usart.stdin_eof = 1;
+        return 0;
+    }
+    usart.rx_byte = c;
+    usart.rx_due = when + usart_frame();
+    usart.idle_due = NEVER;
+    return 1;
+}
+
+static void usart_tx_event(void)
+{
+    write(1, &usart.tx_shift, 1);
+    if (usart.tdr_full) {
+        usart.tx_shift = usart.tdr;
+        usart.tdr_full = 0;
+        usart.tx_due += usart_frame();
+        USART(USART_ISR) |= USART_TXE;
+    } else {
+        usart.tx_due = NEVER;
+        USART(USART_ISR) |= USART_TC;
+    }
+}
+
+/* The sender is flow controlled: a byte is never sent while RDR is full,
+ * so piped input is not lost to overruns.
+ */
+static void usart_rx_event(void)
+{
+    usart.rx_due = NEVER;
+    if (USART(USART_ISR) & USART_RXNE) {
+        usart.rx_held = 1;
+        return;
+    }
+    USART(USART_RDR) = usart.rx_byte;
+    USART(USART_ISR) |= USART_RXNE;
+    if (!usart_rx_fetch(now, 0))
+        usart.idle_due = now + usart_frame();
+}
+
+static void usart_write(uint32_t off, uint32_t old, uint32_t val)
+{
+    uint32_t cr1 = USART(USART_CR1);
+    switch (off) {
+        case USART_CR1:
+            if (!(val & USART_CR1_UE)) {
+                usart.tx_due = NEVER;
+                usart.tdr_full = 0;
+                USART(USART_ISR) |= USART_TXE | USART_TC;
+            }
+            usart_rx_fetch(now, 0);
+            break;
+        case USART_ISR:
+            USART(USART_ISR) = old;
+            break;
+        case USART_ICR:
+            USART(USART_ISR) &= ~(val & USART_ICR_MASK);
+            USART(USART_ICR) = 0;
+            break;
+        case USART_TDR:
+            if (!(cr1 & USART_CR1_UE) || !(cr1 & USART_CR1_TE))
+                break;
+            USART(USART_ISR) &= ~USART_TC;
+            if (usart.tx_due == NEVER) {
+                usart.tx_shift = (uint8_t)val;
+                usart.tx_due = now + usart_frame();
+            } else {
+                usart.tdr = (uint8_t)val;
+                usart.tdr_full = 1;
+                USART(USART_ISR) &= ~USART_TXE;
+            }
+            break;
+    }
+}
+
+static void usart_read(uint32_t off)
+{
+    if (off != USART_RDR)
+        return;
+    USART(USART_ISR) &= ~USART_RXNE;
+    if (usart.rx_held) {
+        usart.rx_held = 0;
+        usart.rx_due = now + usart_frame();
+    }
+}
+
+/*** I2C1 controller, with one simulated target device ***/
+enum i2c_step { I2C_IDLE, I2C_ADDR, I2C_BYTE_TX, I2C_BYTE_RX, I2C_STOP };
+
+static struct {
+    enum i2c_step step;
+    uint64_t due;
+    int rd;
+    uint32_t nbytes;
+    uint32_t count;
+    int autoend;
+    uint8_t sadd;
+    uint8_t txbyte;
+    int set_ptr;            /* next written byte is the register pointer */
+    uint8_t dev;
+    uint8_t ptr;
+    uint8_t regs[256];
+} i2c = { .due = NEVER, .dev = 0x42 };
+
+#define I2C(off) R(I2C1_BASE + (off))
+
+static uint64_t i2c_bit(void)
+{
+    uint32_t t = I2C(I2C_TIMINGR);
+    uint64_t presc = (t >> 28) + 1;
+    uint64_t scll = (t & 0xFF) + 1;
+    uint64_t sclh = ((t >> 8) & 0xFF) + 1;
+    return presc * (scll + sclh);
+}
+
+static void i2c_schedule(enum i2c_step step, uint64_t bits)
+{
+    i2c.step = step;
+    i2c.due = now + bits * i2c_bit();
+}
+
+static void i2c_end_of_bytes(void)
+{
+    if (i2c.autoend) {
+        i2c_schedule(I2C_STOP, 1);
+    } else {
+        I2C(I2C_ISR) |= I2C_TC;
+        i2c.step = I2C_IDLE;
+        i2c.due = NEVER;
+    }
+}
+
+static void i2c_event(void)
+{
+    i2c.due = NEVER;
+    switch (i2c.step) {
+        case I2C_ADDR:
+            if (i2c.sadd != i2c.dev) {
+                I2C(I2C_ISR) |= I2C_NACKF;
+                i2c_schedule(I2C_STOP, 1);
+            } else if (i2c.nbytes == 0) {
+                i2c_end_of_bytes();
+            } else if (i2c.rd) {
+                i2c_schedule(I2C_BYTE_RX, 9);
+            } else {
+                i2c.set_ptr = 1;
+                I2C(I2C_ISR) |= I2C_TXIS;
+                i2c.step = I2C_IDLE;
+            }
+            break;
+        case I2C_BYTE_TX:
+            if (i2c.set_ptr)
+                i2c.ptr = i2c.txbyte;
+            else
+                i2c.regs[i2c.ptr++] = i2c.txbyte;
+            i2c.set_ptr = 0;
+            i2c.count++;
+            I2C(I2C_ISR) |= I2C_TXE;
+            i2c.step = I2C_IDLE;
+            if (i2c.count < i2c.nbytes)
+                I2C(I2C_ISR) |= I2C_TXIS;
+            else
+                i2c_end_of_bytes();
+            break;
+        case I2C_BYTE_RX:
+            /* The clock is stretched until RXDR is read */
+            I2C(I2C_RXDR) = i2c.regs[i2c.ptr++];
+            I2C(I2C_ISR) |= I2C_RXNE;
+            i2c.count++;
+            i2c.step = I2C_IDLE;
+            break;
+        case I2C_STOP:
+            I2C(I2C_ISR) |= I2C_STOPF;
+            I2C(I2C_ISR) &= ~I2C_BUSY;
+            i2c.step = I2C_IDLE;
+            break;
+        default:
+            break;
+    }
+}
+
+static void i2c_write(uint32_t off, uint32_t old, uint32_t val)
+{
+    switch (off) {
+        case I2C_CR1:
+            if ((old & I2C_CR1_PE) && !(val & I2C_CR1_PE)) {
+                /* Software reset */
+                I2C(I2C_ISR) = I2C_TXE;
+                i2c.step = I2C_IDLE;
+                i2c.due = NEVER;
+            }
+            break;
+        case I2C_CR2:
+            if (!(I2C(I2C_CR1) & I2C_CR1_PE))
+                break;
+            I2C(I2C_CR2) = val & ~(I2C_CR2_START | I2C_CR2_STOP);
+            if (val & I2C_CR2_START) {
+                i2c.sadd = (val >> 1) & 0x7F;
+                i2c.rd = !!(val & I2C_CR2_RD_WRN);
+                i2c.nbytes = (val >> 16) & 0xFF;
+                i2c.autoend = !!(val & I2C_CR2_AUTOEND);
+                i2c.count = 0;
+                I2C(I2C_ISR) &= ~I2C_TC;
+                I2C(I2C_ISR) |= I2C_BUSY;
+                i2c_schedule(I2C_ADDR, 10);
+            } else if (val & I2C_CR2_STOP) {
+                I2C(I2C_ISR) &= ~I2C_TC;
+                i2c_schedule(I2C_STOP, 1);
+            }
+            break;
+        case I2C_ISR:
+            /* Only TXE can be set, to flush TXDR */
+            I2C(I2C_ISR) = old | (val & I2C_TXE);
+            break;
+        case I2C_ICR:
+            I2C(I2C_ISR) &= ~(val & I2C_ICR_MASK);
+            I2C(I2C_ICR) = 0;
+            break;
+        case I2C_TXDR:
+            if (!(I2C(I2C_ISR) & I2C_TXIS))
+                break;
+            I2C(I2C_ISR) &= ~(I2C_TXIS | I2C_TXE);
+            i2c.txbyte = (uint8_t)val;
+            i2c_schedule(I2C_BYTE_TX, 9);
+            break;
+    }
+}
+
+static void i2c_read(uint32_t off)
+{
+    if ((off != I2C_RXDR) || !(I2C(I2C_ISR) & I2C_RXNE))
+        return;
+    I2C(I2C_ISR) &= ~I2C_RXNE;
+    if (i2c.count < i2c.nbytes)
+        i2c_schedule(I2C_BYTE_RX, 9);
+    else
+        i2c_end_of_bytes();
+}
+
+/*** DMA1 and DMAMUX1: byte transfers between memory and USART2 ***/
+static struct {
+    uint32_t n;             /* CNDTR when the channel was enabled */
+    uint32_t pos;           /* memory offset from CMAR */
+} dma_ch[N_DMA_CH + 1];
+
+#define DMA(off) R(DMA1_BASE + (off))
+
+static void sim_write(uint32_t a, uint32_t old, uint32_t val);
+static void sim_sync(uint32_t a);
+static void sim_read(uint32_t a);
+
+/* DMAMUX request line of channel 'c' */
+static int dma_request(int c)
+{
+    uint32_t cr3 = USART(USART_CR3), isr = USART(USART_ISR);
+    switch (R(DMAMUX_CCR(c)) & 0x7F) {
+        case DMAMUX_REQ_USART2_RX:
+            return (cr3 & USART_CR3_DMAR) && (isr & USART_RXNE);
+        case DMAMUX_REQ_USART2_TX:
+            return (cr3 & USART_CR3_DMAT) && (isr & USART_TXE) &&
+                (USART(USART_CR1) & USART_CR1_TE);
+    }
+    return 0;
+}
+
+/* One byte, through the same register hooks used by the firmware.
+ * Memory addresses are host addresses: the firmware is linked with
+ * -no-pie so that they fit in CMAR.
+ */
+static void dma_transfer(int c)
+{
+    uint32_t ccr = DMA(DMA_CCR(c));
+    uint32_t par = DMA(DMA_CPAR(c));
+    uint8_t *mem = (uint8_t *)(uintptr_t)(DMA(DMA_CMAR(c)) + dma_ch[c].pos);
+    uint32_t old, left;
+    if (ccr & DMA_CCR_DIR) {
+        old = R(par);
+        R(par) = *mem;
+        sim_write(par, old, *mem);
+    } else {
+        sim_sync(par);
+        *mem = (uint8_t)R(par);
+        sim_read(par);
+    }
+    if (ccr & DMA_CCR_MINC)
+        dma_ch[c].pos++;
+    left = DMA(DMA_CNDTR(c)) - 1;
+    if (left == dma_ch[c].n / 2)
+        DMA(DMA_ISR) |= DMA_HTIF(c) | DMA_GIF(c);
+    if (left == 0) {
+        DMA(DMA_ISR) |= DMA_TCIF(c) | DMA_GIF(c);
+        if (ccr & DMA_CCR_CIRC) {
+            left = dma_ch[c].n;
+            dma_ch[c].pos = 0;
+        }
+    }
+    DMA(DMA_CNDTR(c)) = left;
+}
+
+/* Serve the pending requests, in zero time */
+static void dma_run(void)
+{
+    int c;
+    for (c = 1; c <= N_DMA_CH; c++) {
+        while ((DMA(DMA_CCR(c)) & DMA_CCR_EN) && (DMA(DMA_CNDTR(c)) != 0) &&
+                dma_request(c))
+            dma_transfer(c);
+    }
+}
+
+static void dma_write(uint32_t off, uint32_t old, uint32_t val)
+{
+    int c;
+    if (off == DMA_ISR) {
+        DMA(DMA_ISR) = old;
+    } else if (off == DMA_IFCR) {
+        /* CGIFx clears all the flags of channel x */
+        for (c = 1; c <= N_DMA_CH; c++) {
+            if (val & DMA_GIF(c))
+                val |= 0x0FU << (4 * (c - 1));
+        }
+        DMA(DMA_ISR) &= ~val;
+        DMA(DMA_IFCR) = 0;
+    } else if ((off >= DMA_CCR(1)) && (off < DMA_CCR(N_DMA_CH + 1))) {
+        c = (off - DMA_CCR(1)) / 0x14 + 1;
+        if ((off == DMA_CCR(c)) && (val & DMA_CCR_EN) && !(old & DMA_CCR_EN)) {
+            dma_ch[c].n = DMA(DMA_CNDTR(c)) & 0xFFFF;
+            dma_ch[c].pos = 0;
+        } else if ((off == DMA_CNDTR(c)) && (DMA(DMA_CCR(c)) & DMA_CCR_EN)) {
+            /* Read-only while the channel is enabled */
+            DMA(DMA_CNDTR(c)) = old;
+        }
+    }
+}
+
+/*** GPIO and EXTI ***/
+struct sim_input {
+    uint64_t when;
+    char port;
+    int pin;
+    int level;
+};
+#define MAX_INPUTS 64
+static struct sim_input inputs[MAX_INPUTS];
+static int n_inputs, next_input;
+
+static void exti_edge(int port, int pin, int rising)
+{
+    uint32_t exticr = R(SYSCFG_EXTICR1 + 4 * (pin / 4));
+    uint32_t bit = 1 << pin;
+    if (((exticr >> (4 * (pin % 4))) & 0x0F) != (uint32_t)port)
+        return;
+    if (rising && !(R(EXTI_BASE + EXTI_RTSR) & bit))
+        return;
+    if (!rising && !(R(EXTI_BASE + EXTI_FTSR) & bit))
+        return;
+    if (R(EXTI_BASE + EXTI_IMR) & bit)
+        R(EXTI_BASE + EXTI_PR) |= bit;
+}
+
+static void exti_write(uint32_t off, uint32_t old, uint32_t val)
+{
+    if (off == EXTI_SWIER) {
+        R(EXTI_BASE + EXTI_PR) |= val & R(EXTI_BASE + EXTI_IMR);
+        R(EXTI_BASE + EXTI_SWIER) = 0;
+    } else if (off == EXTI_PR) {
+        R(EXTI_BASE + EXTI_PR) = old & ~val;
+    }
+}
+
+static void gpio_trace(int port, uint32_t old)
+{
+    char line[80];
+    uint32_t odr = R(GPIO_BASE + port * GPIO_SPAN + GPIO_ODR) & 0xFFFF;
+    int len;
+    if (!trace_gpio || (odr == (old & 0xFFFF)))
+        return;
+    len = snprintf(line, sizeof(line), "hostsim: %12llu GPIO%c ODR 0x%04x\n",
+            (unsigned long long)now, 'A' + port, odr);
+    write(2, line, len);
+}
+
+static void gpio_write(int port, uint32_t off, uint32_t old, uint32_t val)
+{
+    uint32_t base = GPIO_BASE + port * GPIO_SPAN;
+    uint32_t odr = R(base + GPIO_ODR);
+    switch (off) {
+        case GPIO_IDR:
+            R(base + GPIO_IDR) = old;
+            return;
+        case GPIO_ODR:
+            gpio_trace(port, old);
+            return;
+        case GPIO_BSRR:
+            R(base + GPIO_ODR) = (odr | (val & 0xFFFF)) & ~(val >> 16);
+            R(base + GPIO_BSRR) = 0;
+            break;
+        case GPIO_BRR:
+            R(base + GPIO_ODR) = odr & ~(val & 0xFFFF);
+            R(base + GPIO_BRR) = 0;
+            break;
+        default:
+            return;
+    }
+    gpio_trace(port, odr);
+}
+
+void hostsim_gpio_input(char port, int pin, int level)
+{
+    int p = port - 'A';
+    uint32_t bit = 1 << pin;
+    uint32_t idr;
+    if ((p < 0) || (p >= N_GPIO) || (pin < 0) || (pin > 15))
+        return;
+    idr = R(GPIO_BASE + p * GPIO_SPAN + GPIO_IDR);
+    if (!!(idr & bit) == !!level)
+        return;
+    R(GPIO_BASE + p * GPIO_SPAN + GPIO_IDR) = level ? (idr | bit) : (idr & ~bit);
+    exti_edge(p, pin, level);
+}
+
+/*** RCC: oscillators are ready as soon as they are turned on ***/
+static void rcc_write(uint32_t off, uint32_t val)
+{
+    uint32_t rdy;
+    switch (off) {
+        case RCC_CR:
+            /* MSI, HSI, HSE, PLL, PLLSAI1, PLLSAI2 */
+            rdy = ((val & 0x01) << 1) | ((val & 0x100) << 2) |
+                ((val & 0x10000) << 1) | ((val & 0x15000000) << 1);
+            R(RCC_BASE + RCC_CR) = (val & ~0x2A020402) | rdy;
+            break;
+        case RCC_CFGR:
+            R(RCC_BASE + RCC_CFGR) = (val & ~0x0C) | ((val & 0x03) << 2);
+            break;
+        case RCC_BDCR:
+        case RCC_CSR:
+        case RCC_CRRCR:
+            R(RCC_BASE + off) = (val & ~0x02) | ((val & 0x01) << 1);
+            break;
+    }
+}
+
+/*** NVIC, SCB and DWT ***/
+static uint64_t dwt_t0;
+static uint32_t dwt_cyc0;
+
+static void nvic_sync(void)
+{
+    int i, n;
+    for (i = 0; i < NVIC_BANKS; i++) {
+        uint32_t pend = 0;
+        for (n = 0; n < 32; n++) {
+            int exc = EXC_IRQ(32 * i + n);
+            if (exc_pending[exc] || exc_level[exc])
+                pend |= 1U << n;
+        }
+        R(NVIC_ISER + 4 * i) = nvic_enabled[i];
+        R(NVIC_ICER + 4 * i) = nvic_enabled[i];
+        R(NVIC_ISPR + 4 * i) = pend;
+        R(NVIC_ICPR + 4 * i) = pend;
+    }
+}
+
+static void ppb_write(uint32_t a, uint32_t old, uint32_t val)
+{
+    int i, n;
+    if (in_range(a, NVIC_ISER, 4 * NVIC_BANKS)) {
+        nvic_enabled[(a - NVIC_ISER) / 4] |= val;
+    } else if (in_range(a, NVIC_ICER, 4 * NVIC_BANKS)) {
+        nvic_enabled[(a - NVIC_ICER) / 4] &= ~val;
+    } else if (in_range(a, NVIC_ISPR, 4 * NVIC_BANKS)) {
+        i = (a - NVIC_ISPR) / 4;
+        for (n = 0; n < 32; n++)
+            if (val & (1U << n))
+                exc_pending[EXC_IRQ(32 * i + n)] = 1;
+    } else if (in_range(a, NVIC_ICPR, 4 * NVIC_BANKS)) {
+        i = (a - NVIC_ICPR) / 4;
+        for (n = 0; n < 32; n++)
+            if (val & (1U << n))
+                exc_pending[EXC_IRQ(32 * i + n)] = 0;
+    } else if (a == SCB_ICSR) {
+        if (val & ICSR_PENDSVSET)
+            exc_pending[EXC_PENDSV] = 1;
+        if (val & ICSR_PENDSVCLR)
+            exc_pending[EXC_PENDSV] = 0;
+        if (val & ICSR_PENDSTSET)
+            exc_pending[EXC_SYSTICK] = 1;
+        if (val & ICSR_PENDSTCLR)
+            exc_pending[EXC_SYSTICK] = 0;
+    } else if ((a == SYSTICK_CSR) || (a == SYSTICK_CVR)) {
+        systick_write(a, old, val);
+    } else if (a == DWT_CTRL) {
+        if ((val & 1) && !(old & 1))
+            dwt_t0 = now;
+        else if (!(val & 1) && (old & 1))
+            dwt_cyc0 += (uint32_t)(now - dwt_t0);
+    } else if (a == DWT_CYCCNT) {
+        dwt_cyc0 = val;
+        dwt_t0 = now;
+    }
+}
+
+/*** Interrupt lines ***/
+static void update_levels(void)
+{
+    uint32_t cr1, isr, pr;
+    int i;
+
+    dma_run();
+
+    for (i = 0; i < N_TIMERS; i++) {
+        exc_level[EXC_IRQ(IRQ_TIM2 + i)] = (R(timers[i].base + TIM_SR) &
+                R(timers[i].base + TIM_DIER) & TIM_UIF) != 0;
+    }
+
+    cr1 = USART(USART_CR1);
+    isr = USART(USART_ISR);
+    exc_level[EXC_IRQ(IRQ_USART2)] =
+        ((cr1 & USART_CR1_RXNEIE) && (isr & (USART_RXNE | USART_ORE))) ||
+        ((cr1 & USART_CR1_TXEIE) && (isr & USART_TXE)) ||
+        ((cr1 & USART_CR1_TCIE) && (isr & USART_TC)) ||
+        ((cr1 & USART_CR1_IDLEIE) && (isr & USART_IDLE));
+
+    cr1 = I2C(I2C_CR1);
+    isr = I2C(I2C_ISR);
+    exc_level[EXC_IRQ(IRQ_I2C1_EV)] =
+        ((cr1 & I2C_CR1_TXIE) && (isr & I2C_TXIS)) ||
+        ((cr1 & I2C_CR1_RXIE) && (isr & I2C_RXNE)) ||
+        ((cr1 & I2C_CR1_NACKIE) && (isr & I2C_NACKF)) ||
+        ((cr1 & I2C_CR1_STOPIE) && (isr & I2C_STOPF)) ||
+        ((cr1 & I2C_CR1_TCIE) && (isr & I2C_TC));
+    exc_level[EXC_IRQ(IRQ_I2C1_ER)] = (cr1 & I2C_CR1_ERRIE) && (isr & I2C_ERRORS);
+
+    isr = DMA(DMA_ISR);
+    for (i = 1; i <= N_DMA_CH; i++) {
+        exc_level[EXC_IRQ(IRQ_DMA1_CH1 + i - 1)] =
+            ((isr >> (4 * (i - 1))) & DMA(DMA_CCR(i)) & DMA_CCR_IE_MASK) != 0;
+    }
+
+    pr = R(EXTI_BASE + EXTI_PR) & R(EXTI_BASE + EXTI_IMR);
+    for (i = 0; i < 5; i++)
+        exc_level[EXC_IRQ(IRQ_EXTI0 + i)] = (pr >> i) & 1;
+    exc_level[EXC_IRQ(IRQ_EXTI9_5)] = (pr & 0x03E0) != 0;
+    exc_level[EXC_IRQ(IRQ_EXTI15_10)] = (pr & 0xFC00) != 0;
+}
+
+static int exc_enabled(int exc)
+{
+    int irq = exc - 16;
+    if (exc < 16)
+        return 1;
+    return (nvic_enabled[irq / 32] >> (irq % 32)) & 1;
+}
+
+/* Lowest exception number wins: NVIC priorities are not modelled */
+static int next_exception(void)
+{
+    int exc;
+    for (exc = EXC_PENDSV; exc < N_EXC; exc++) {
+        if ((exc_pending[exc] || exc_level[exc]) && exc_enabled(exc))
+            return exc;
+    }
+    return 0;
+}
+
+/*** Virtual time ***/
+static void hostsim_exit(int status);
+
+static uint64_t next_due(void)
+{
+    uint64_t due = systick_due;
+    int i;
+#define EARLIER(t) if ((t) < due) due = (t)
+    for (i = 0; i < N_TIMERS; i++)
+        EARLIER(timers[i].due);
+    EARLIER(usart.tx_due);
+    EARLIER(usart.rx_due);
+    EARLIER(usart.idle_due);
+    EARLIER(i2c.due);
+    if (next_input < n_inputs)
+        EARLIER(inputs[next_input].when);
+#undef EARLIER
+    return due;
+}
+
+static void run_events(void)
+{
+    int i;
+    if (systick_due <= now)
+        systick_event();
+    for (i = 0; i < N_TIMERS; i++) {
+        if (timers[i].due <= now)
+            tim_update_event(&timers[i]);
+    }
+    if (usart.tx_due <= now)
+        usart_tx_event();
+    if (usart.rx_due <= now)
+        usart_rx_event();
+    if (usart.idle_due <= now) {
+        usart.idle_due = NEVER;
+        USART(USART_ISR) |= USART_IDLE;
+    }
+    if (i2c.due <= now)
+        i2c_event();
+    dma_run();
+    while ((next_input < n_inputs) && (inputs[next_input].when <= now)) {
+        struct sim_input *in = &inputs[next_input++];
+        hostsim_gpio_input(in->port, in->pin, in->level);
+    }
+}
+
+static void advance_to(uint64_t t)
+{
+    uint64_t due;
+    if (cycle_limit && (t > cycle_limit))
+        t = cycle_limit;
+    while ((due = next_due()) <= t) {
+        if (due > now)
+            now = due;
+        run_events();
+    }
+    if (t > now)
+        now = t;
+    update_levels();
+    if (cycle_limit && (now >= cycle_limit))
+        hostsim_exit(0);
+}
+
+/* Nothing will happen by itself: wait for the next byte on stdin */
+static void skip_idle(const char *why)
+{
+    uint64_t due = next_due();
+    if ((due == NEVER) && !usart_rx_fetch(now, 1)) {
+        fprintf(stderr, "hostsim: %s with no pending events\n", why);
+        hostsim_exit(0);
+    }
+    advance_to(next_due());
+}
+
+uint64_t hostsim_cycles(void)
+{
+    return now;
+}
+
+/*** Register access hooks ***/
+
+/* Refresh a register that is about to be accessed */
+static void sim_sync(uint32_t a)
+{
+    uint32_t icsr;
+    if (in_range(a, TIM2_BASE, N_TIMERS * TIM_SPAN)) {
+        struct sim_timer *t = &timers[(a - TIM2_BASE) / TIM_SPAN];
+        R(t->base + TIM_CNT) = tim_cnt(t);
+    } else if (a == SYSTICK_CVR) {
+        R(SYSTICK_CVR) = (R(SYSTICK_CSR) & SYSTICK_ENABLE) ? systick_current() : systick_cvr;
+    } else if (a == DWT_CYCCNT) {
+        R(DWT_CYCCNT) = dwt_cyc0 + ((R(DWT_CTRL) & 1) ? (uint32_t)(now - dwt_t0) : 0);
+    } else if (a == SCB_ICSR) {
+        icsr = R(SCB_ICSR) & ~(ICSR_PENDSVSET | ICSR_PENDSTSET | 0x1FF);
+        if (exc_pending[EXC_PENDSV])
+            icsr |= ICSR_PENDSVSET;
+        if (exc_pending[EXC_SYSTICK])
+            icsr |= ICSR_PENDSTSET;
+        R(SCB_ICSR) = icsr | active_exc;
+    } else if (in_range(a, NVIC_ISER, 0x200)) {
+        nvic_sync();
+    }
+}
+
+static void sim_write(uint32_t a, uint32_t old, uint32_t val)
+{
+    if (in_range(a, TIM2_BASE, N_TIMERS * TIM_SPAN)) {
+        tim_write(&timers[(a - TIM2_BASE) / TIM_SPAN], a & (TIM_SPAN - 1), old, val);
+    } else if (in_range(a, USART2_BASE, 0x400)) {
+        usart_write(a - USART2_BASE, old, val);
+    } else if (in_range(a, I2C1_BASE, 0x400)) {
+        i2c_write(a - I2C1_BASE, old, val);
+    } else if (in_range(a, DMA1_BASE, 0x400)) {
+        dma_write(a - DMA1_BASE, old, val);
+    } else if (in_range(a, EXTI_BASE, 0x400)) {
+        exti_write(a - EXTI_BASE, old, val);
+    } else if (in_range(a, RCC_BASE, 0x400)) {
+        rcc_write(a - RCC_BASE, val);
+    } else if (in_range(a, GPIO_BASE, N_GPIO * GPIO_SPAN)) {
+        gpio_write((a - GPIO_BASE) / GPIO_SPAN, a & (GPIO_SPAN - 1), old, val);
+    } else if (a >= 0xE0000000) {
+        ppb_write(a, old, val);
+    }
+}
+
+static void sim_read(uint32_t a)
+{
+    if (in_range(a, USART2_BASE, 0x400))
+        usart_read(a - USART2_BASE);
+    else if (in_range(a, I2C1_BASE, 0x400))
+        i2c_read(a - I2C1_BASE);
+    else if (a == SYSTICK_CSR)
+        R(SYSTICK_CSR) &= ~SYSTICK_COUNTFLAG;
+}
+
+/*** Exception entry ***/
+void hostsim_dispatch(void);
+
+/* Entered in place of the interrupted firmware instruction: preserves
+ * the caller-saved state that a function call would not.
+ * Firmware is built with -mno-red-zone, so the return address can be
+ * pushed right below the interrupted stack pointer.
+ */
+__asm__(
+    ".text\n"
+    ".type hostsim_irq_entry, @function\n"
+    "hostsim_irq_entry:\n"
+    "   pushfq\n"
+    "   push %rax\n"
+    "   push %rcx\n"
+    "   push %rdx\n"
+    "   push %rsi\n"
+    "   push %rdi\n"
+    "   push %r8\n"
+    "   push %r9\n"
+    "   push %r10\n"
+    "   push %r11\n"
+    "   push %rbp\n"
+    "   mov %rsp, %rbp\n"
+    "   and $-16, %rsp\n"
+    "   sub $512, %rsp\n"
+    "   fxsave64 (%rsp)\n"
+    "   call hostsim_dispatch\n"
+    "   fxrstor64 (%rsp)\n"
+    "   mov %rbp, %rsp\n"
+    "   pop %rbp\n"
+    "   pop %r11\n"
+    "   pop %r10\n"
+    "   pop %r9\n"
+    "   pop %r8\n"
+    "   pop %rdi\n"
+    "   pop %rsi\n"
+    "   pop %rdx\n"
+    "   pop %rcx\n"
+    "   pop %rax\n"
+    "   popfq\n"
+    "   ret\n"
+);
+extern char hostsim_irq_entry[];
+
+void hostsim_dispatch(void)
+{
+    int exc;
+    in_handler = 1;
+    while ((exc = next_exception()) != 0) {
+        exc_pending[exc] = 0;
+        exc_count[exc]++;
+        if (!handlers[exc]) {
+            fprintf(stderr, "hostsim: exception %d has no handler\n", exc);
+            hostsim_exit(1);
+        }
+        active_exc = exc;
+        handlers[exc]();
+        active_exc = 0;
+        update_levels();
+    }
+    spins = 0;
+    in_handler = 0;
+}
+
+void hostsim_wfi(void)
+{
+    if (in_handler)
+        return;
+    sim_busy = 1;
+    advance_to(now + access_cycles);
+    while (!next_exception())
+        skip_idle("idle");
+    hostsim_dispatch();
+    sim_busy = 0;
+}
+
+/*** Fault handlers: one register access per single step ***/
+static void bus_protect(uint32_t addr, int prot)
+{
+    mprotect((void *)(uintptr_t)(addr & ~(PAGE_SIZE - 1)), PAGE_SIZE, prot);
+}
+
+static int bus_window(uint32_t addr)
+{
+    unsigned int i;
+    for (i = 0; i < N_WINDOWS; i++) {
+        if (addr - windows[i].base < windows[i].size)
+            return 1;
+    }
+    return 0;
+}
+
+static void on_segv(int sig, siginfo_t *si, void *ctx)
+{
+    ucontext_t *uc = ctx;
+    uintptr_t fault = (uintptr_t)si->si_addr;
+    uint32_t a = (uint32_t)fault & ~3U;
+    int wr = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+
+    if ((fault > UINT32_MAX) || !bus_window(a) || step_active) {
+        /* A real crash: let it happen again with the default action */
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    n_accesses++;
+    advance_to(now + access_cycles);
+    sim_sync(a);
+
+    /* Polling the same register without any change: skip ahead */
+    if (!wr && !last_write && (a == last_addr) && (R(a) == last_val)) {
+        if (++spins >= 2) {
+            skip_idle("stalled polling");
+            sim_sync(a);
+            spins = 0;
+        }
+    } else {
+        spins = 0;
+    }
+    last_addr = a;
+    last_write = wr;
+    last_val = R(a);
+
+    step_active = 1;
+    step_addr = a;
+    step_write = wr;
+    step_old = R(a);
+    bus_protect(a, PROT_READ | PROT_WRITE);
+    uc->uc_mcontext.gregs[REG_EFL] |= 0x100;
+}
+
+/* Interrupt the firmware at the instruction about to be resumed */
+static void irq_inject(ucontext_t *uc)
+{
+    greg_t *gregs = uc->uc_mcontext.gregs;
+    uintptr_t pc = gregs[REG_RIP];
+    if (in_handler || !next_exception())
+        return;
+    if ((pc < (uintptr_t)__executable_start) || (pc >= (uintptr_t)etext))
+        return;
+    gregs[REG_RSP] -= 8;
+    *(uint64_t *)gregs[REG_RSP] = pc;
+    gregs[REG_RIP] = (greg_t)hostsim_irq_entry;
+    in_handler = 1;
+}
+
+static void on_trap(int sig, siginfo_t *si, void *ctx)
+{
+    ucontext_t *uc = ctx;
+    greg_t *gregs = uc->uc_mcontext.gregs;
+
+    if (!step_active) {
+        signal(SIGTRAP, SIG_DFL);
+        raise(SIGTRAP);
+        return;
+    }
+    gregs[REG_EFL] &= ~0x100;
+    bus_protect(step_addr, PROT_NONE);
+    step_active = 0;
+    if (step_write || (R(step_addr) != step_old))
+        sim_write(step_addr, step_old, R(step_addr));
+    else
+        sim_read(step_addr);
+    update_levels();
+    last_val = R(step_addr);
+
+    irq_inject(uc);
+}
+
+/* No register access for a whole period: the firmware is spinning on
+ * memory, e.g. on a flag set by an ISR. Let the time pass until the
+ * next event.
+ */
+static void on_alarm(int sig, siginfo_t *si, void *ctx)
+{
+    static uint64_t accesses;
+    if (sim_busy || in_handler || step_active || (n_accesses != accesses)) {
+        accesses = n_accesses;
+        return;
+    }
+    if (!next_exception())
+        skip_idle("spinning");
+    irq_inject(ctx);
+}
+
+/*** Setup and statistics ***/
+static void hostsim_exit(int status)
+{
+    struct timespec wall;
+    double host_s;
+    int exc;
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    host_s = (wall.tv_sec - wall_start.tv_sec) +
+        (wall.tv_nsec - wall_start.tv_nsec) / 1e9;
+    fprintf(stderr, "hostsim: %llu cycles (%.3f ms at %u MHz), "
+            "%llu register accesses, %.3f s host time\n",
+            (unsigned long long)now, now / (CPU_FREQ / 1000.0),
+            CPU_FREQ / 1000000, (unsigned long long)n_accesses, host_s);
+    for (exc = 1; exc < N_EXC; exc++) {
+        if (!exc_count[exc])
+            continue;
+        if (exc < 16)
+            fprintf(stderr, "hostsim: exception %2d: %llu\n", exc,
+                    (unsigned long long)exc_count[exc]);
+        else
+            fprintf(stderr, "hostsim: irq %2d: %llu\n", exc - 16,
+                    (unsigned long long)exc_count[exc]);
+    }
+    _exit(status);
+}
+
+static int input_cmp(const void *a, const void *b)
+{
+    const struct sim_input *x = a, *y = b;
+    return (x->when > y->when) - (x->when < y->when);
+}
+
+static void parse_inputs(const char *spec)
+{
+    char port;
+    int pin, level, used;
+    unsigned long long when;
+    while (spec && (n_inputs < MAX_INPUTS) &&
+            (sscanf(spec, " %c%d:%d@%llu%n", &port, &pin, &level, &when, &used) == 4)) {
+        inputs[n_inputs].port = port;
+        inputs[n_inputs].pin = pin;
+        inputs[n_inputs].level = level;
+        inputs[n_inputs].when = when;
+        n_inputs++;
+        spec = strchr(spec + used, ',');
+        if (spec)
+            spec++;
+    }
+    qsort(inputs, n_inputs, sizeof(inputs[0]), input_cmp);
+}
+
+static void map_windows(void)
+{
+    unsigned int i;
+    for (i = 0; i < N_WINDOWS; i++) {
+        struct window *w = &windows[i];
+        void *bus;
+        int fd = memfd_create("hostsim", 0);
+        if ((fd < 0) || (ftruncate(fd, w->size) < 0)) {
+            perror("hostsim: memfd");
+            exit(1);
+        }
+        w->shadow = mmap(NULL, w->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        bus = mmap((void *)(uintptr_t)w->base, w->size, PROT_NONE,
+                MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+        if ((w->shadow == MAP_FAILED) || (bus != (void *)(uintptr_t)w->base)) {
+            fprintf(stderr, "hostsim: cannot map 0x%08x\n", w->base);
+            exit(1);
+        }
+        close(fd);
+    }
+}
+
+__attribute__((constructor))
+static void hostsim_init(void)
+{
+    struct itimerval spin_period = { { 0, 1000 }, { 0, 1000 } };
+    struct sigaction sa;
+    const char *env;
+    int i;
+
+    map_windows();
+
+    /* Reset values */
+    R(RCC_BASE + RCC_CR) = 0x00000063;
+    USART(USART_ISR) = USART_TXE | USART_TC;
+    I2C(I2C_ISR) = I2C_TXE;
+    for (i = 0; i < N_TIMERS; i++) {
+        timers[i].base = TIM2_BASE + i * TIM_SPAN;
+        timers[i].due = NEVER;
+    }
+    usart.tx_due = usart.rx_due = usart.idle_due = NEVER;
+
+    handlers[EXC_PENDSV] = isr_pendsv;
+    handlers[EXC_SYSTICK] = isr_systick;
+    handlers[EXC_IRQ(IRQ_EXTI0)] = isr_exti0;
+    handlers[EXC_IRQ(IRQ_EXTI0 + 1)] = isr_exti1;
+    handlers[EXC_IRQ(IRQ_EXTI0 + 2)] = isr_exti2;
+    handlers[EXC_IRQ(IRQ_EXTI0 + 3)] = isr_exti3;
+    handlers[EXC_IRQ(IRQ_EXTI0 + 4)] = isr_exti4;
+    handlers[EXC_IRQ(IRQ_EXTI9_5)] = isr_exti9_5;
+    handlers[EXC_IRQ(IRQ_EXTI15_10)] = isr_exti15_10;
+    handlers[EXC_IRQ(IRQ_TIM2)] = isr_tim2;
+    handlers[EXC_IRQ(IRQ_TIM2 + 1)] = isr_tim3;
+    handlers[EXC_IRQ(IRQ_TIM2 + 2)] = isr_tim4;
+    handlers[EXC_IRQ(IRQ_I2C1_EV)] = isr_i2c1;
+    handlers[EXC_IRQ(IRQ_I2C1_ER)] = isr_i2c1;
+    handlers[EXC_IRQ(IRQ_USART2)] = isr_usart2;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1)] = isr_dma1_ch1;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 1)] = isr_dma1_ch2;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 2)] = isr_dma1_ch3;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 3)] = isr_dma1_ch4;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 4)] = isr_dma1_ch5;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 5)] = isr_dma1_ch6;
+    handlers[EXC_IRQ(IRQ_DMA1_CH1 + 6)] = isr_dma1_ch7;
+
+    if ((env = getenv("HOSTSIM_CYCLES")) != NULL)
+        cycle_limit = strtoull(env, NULL, 0);
+    if ((env = getenv("HOSTSIM_ACCESS")) != NULL)
+        access_cycles = strtoul(env, NULL, 0);
+    if ((env = getenv("HOSTSIM_I2C_ADDR")) != NULL)
+        i2c.dev = strtoul(env, NULL, 0) & 0x7F;
+    trace_gpio = getenv("HOSTSIM_TRACE") != NULL;
+    parse_inputs(getenv("HOSTSIM_INPUT"));
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sigaddset(&sa.sa_mask, SIGALRM);
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = on_segv;
+    sigaction(SIGSEGV, &sa, NULL);
+    sa.sa_sigaction = on_trap;
+    sigaction(SIGTRAP, &sa, NULL);
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sa.sa_sigaction = on_alarm;
+    sigaction(SIGALRM, &sa, NULL);
+    setitimer(ITIMER_REAL, &spin_period, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+}
@@ -0,0 +1,62 @@
+/*
+ *
+ * Embedded System Architecture - Second Edition
+ *
+ * Copyright (c) 2024 Dimitrios Giampouris
+ * Copyright (c) 2018-2022 Packt
+ *
+ * Author: Daniele Lacamera <root@danielinux.net>
+ * Modified: Dimitrios Giampouris <d_g@dgiab.org>
+ *
+ * MIT License
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef HOSTSIM_H_INCLUDED
+#define HOSTSIM_H_INCLUDED
+#include <stdint.h>
+
+/* Host build of the firmware (make host).
+ *
+ * The peripheral address windows are mapped at their real addresses on
+ * the Linux host, so the register macros in system.h and in the drivers
+ * are used unchanged. Every access traps into the simulator, which updates
+ * the peripheral models, advances a virtual cycle clock and delivers the
+ * interrupts to the isr_* handlers of the firmware.
+ *
+ * Runtime options, from the environment:
+ *   HOSTSIM_CYCLES=n      stop after n virtual cycles
+ *   HOSTSIM_ACCESS=n      cycles charged per register access (default 2)
+ *   HOSTSIM_TRACE=1       log GPIO output changes to stderr
+ *   HOSTSIM_INPUT=list    GPIO input events, e.g. "C13:1@8000000,C13:0@9000000"
+ *   HOSTSIM_I2C_ADDR=n    7-bit address of the simulated I2C target (0x42)
+ *
+ * USART2 transmits to stdout and receives from stdin. The DMA1 channels
+ * serve the USART2 requests routed to them by DMAMUX1, one byte at a time.
+ */
+
+/* Virtual clock, in CPU cycles since reset */
+uint64_t hostsim_cycles(void);
+
+/* Idle until the next interrupt, replaces the wfi instruction */
+void hostsim_wfi(void);
+
+/* Drive a GPIO input pin (port 'A'..'I') and trigger the EXTI edge */
+void hostsim_gpio_input(char port, int pin, int level);
+
+#endif
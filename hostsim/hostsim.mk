@@ -0,0 +1,20 @@
+# Host build: run the firmware on Linux against the peripheral models
+# in hostsim/. startup.c and the linker script are not used.
+# Linked with -no-pie, so that buffer addresses fit in the 32-bit DMA
+# address registers.
+#
+#   make host && ./image-host
+#
+HOSTSIM_DIR:=$(dir $(lastword $(MAKEFILE_LIST)))
+HOST_CC:=gcc
+HOST_CFLAGS:=-g -O2 -Wall -Wno-main -Wno-unused -Wno-int-to-pointer-cast \
+	-Wno-pointer-to-int-cast -DHOST_SIM -I. -I$(HOSTSIM_DIR) \
+	-mno-red-zone -fcf-protection=none -no-pie
+HOST_SRCS:=$(filter-out startup.c,$(OBJS:.o=.c)) $(HOSTSIM_DIR)hostsim.c
+
+host: image-host
+
+image-host: $(HOST_SRCS) $(wildcard *.h) $(HOSTSIM_DIR)hostsim.h
+	$(HOST_CC) $(HOST_CFLAGS) $(HOST_SRCS) -o $@
+
+.PHONY: host